@@ -196,6 +196,10 @@ Animation::~Animation()
     for (vector<AnimationSequence*>::iterator i = sequences.begin(); i != sequences.end(); ++i ){
         delete *i;
     }
+    for (size_t i=0; i<frameMasks.size(); i++) {
+        delete frameMasks[i];
+        delete flipedFrameMasks[i];
+    }
     // free fliped image
     if (flipedFullImage != NULL) {
         SDL_FreeSurface(flipedFullImage);
@@ -233,6 +237,11 @@ void Animation::addFrame(SDL_Rect rect, SDL_Rect anchorpoint)
 {
     frameRects.push_back(rect);
     frameAnchorPoints.push_back(anchorpoint);
+
+    if (fullImage != NULL && (fullImage->flags & SDL_SRCCOLORKEY)) {
+        frameMasks.push_back(new PixelMask(fullImage, rect, fullImage->format->colorkey, false));
+        flipedFrameMasks.push_back(new PixelMask(fullImage, rect, fullImage->format->colorkey, true));
+    }
 }
 
 void Animation::addSequence(const char *name, Uint32 framerate, AnimationSequence::AnimationStyle style, int indexarray[], int length)
@@ -269,35 +278,49 @@ SDL_Rect Animation::getCurAnchor()
     return frameAnchorPoints[currentFrame];
 }
 
-void Animation::playSequence(const char *name)
+const PixelMask *Animation::getCurMask()
+{
+    if (currentFrame >= (int)frameMasks.size()) {
+        return NULL;
+    }
+    return flipHorizontal ? flipedFrameMasks[currentFrame] : frameMasks[currentFrame];
+}
+
+int Animation::findSequence(const char *name)
 {
     int index = 0;
     for (vector<AnimationSequence*>::iterator i = sequences.begin(); i != sequences.end(); ++i ){
         if ( (*i)->nameCompare(name) ) {
-            currentSequence = index;
-            sequences[currentSequence]->reset();
-            currentFrame = sequences[currentSequence]->getCurrentFrameIndex();
-            oldFrameStamp = 0;
-            break;
+            return index;
         }
         index ++;
     }
-    backorder = false;
+    return -1;
+}
+
+void Animation::playSequence(const char *name)
+{
+    playSequenceIndex(findSequence(name), false);
 }
 
 void Animation::playSequenceBackorder(const char *name)
 {
-    int index = 0;
-    for (vector<AnimationSequence*>::iterator i = sequences.begin(); i != sequences.end(); ++i ){
-        if ( (*i)->nameCompare(name) ) {
-            currentSequence = index;
-            sequences[currentSequence]->reset();
+    playSequenceIndex(findSequence(name), true);
+}
+
+void Animation::playSequenceIndex(int index, bool backorder)
+{
+    if (index >= 0 && index < (int)sequences.size()) {
+        currentSequence = index;
+        sequences[currentSequence]->reset();
+        if (backorder) {
             currentFrame = sequences[currentSequence]->getPrevFrameIndex();
-            break;
+        } else {
+            currentFrame = sequences[currentSequence]->getCurrentFrameIndex();
+            oldFrameStamp = 0;
         }
-        index ++;
     }
-    backorder = true;
+    this->backorder = backorder;
 }
 
 void Animation::update(Uint32 frameStamp)
@@ -321,21 +344,30 @@ void Animation::update(Uint32 frameStamp)
     }
 }
 
-void Animation::draw(SDL_Surface *dst)
+SDL_Rect Animation::getScreenRect()
 {
     SDL_Rect screenposition = getPositionScreenCoor();
+    SDL_Rect rect = {0, 0, frameRects[currentFrame].w, frameRects[currentFrame].h};
+    if (flipHorizontal) {
+        rect.x = screenposition.x - frameRects[currentFrame].w + frameAnchorPoints[currentFrame].x;
+    } else {
+        rect.x = screenposition.x - frameAnchorPoints[currentFrame].x;
+    }
+    rect.y = screenposition.y - frameAnchorPoints[currentFrame].y;
+    return rect;
+}
+
+void Animation::render(RenderList *list)
+{
+    SDL_Rect dstrect = getScreenRect();
     if (flipHorizontal) {
         SDL_Rect srcrect = {(Sint16)(flipedFullImage->w - frameRects[currentFrame].x - frameRects[currentFrame].w),
                             frameRects[currentFrame].y,
                             frameRects[currentFrame].w,
                             frameRects[currentFrame].h};
-        SDL_Rect dstrect = {(Sint16)(screenposition.x - frameRects[currentFrame].w + frameAnchorPoints[currentFrame].x),
-            (Sint16)(screenposition.y - frameAnchorPoints[currentFrame].y), 0, 0};
-        SDL_BlitSurface(flipedFullImage, &srcrect, dst, &dstrect);
+        list->blit(flipedFullImage, srcrect, dstrect.x, dstrect.y);
     } else {
-        SDL_Rect dstrect = {(Sint16)(screenposition.x - frameAnchorPoints[currentFrame].x),
-            (Sint16)(screenposition.y - frameAnchorPoints[currentFrame].y), 0, 0};
-        SDL_BlitSurface(fullImage, &frameRects[currentFrame], dst, &dstrect);
+        list->blit(fullImage, frameRects[currentFrame], dstrect.x, dstrect.y);
     }
 }
 
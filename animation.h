@@ -5,12 +5,17 @@
 #include <vector>
 #include <string>
 #include "widget.h"
+#include "pixelmask.h"
 
 using std::vector;
 using std::string;
 
 namespace dragonfighting {
 
+// the surface must be locked
+Uint32 getpixel(SDL_Surface *surface, int x, int y);
+void putpixel(SDL_Surface *surface, int x, int y, Uint32 pixel);
+
 class AnimationSequence
 {
 public:
@@ -53,6 +58,8 @@ protected:
     SDL_Surface *flipedFullImage;
     vector<SDL_Rect> frameRects;
     vector<SDL_Rect> frameAnchorPoints;
+    vector<PixelMask *> frameMasks;         // empty without a colorkey
+    vector<PixelMask *> flipedFrameMasks;
     vector<AnimationSequence *> sequences;
     int currentFrame;
     int currentSequence;
@@ -71,10 +78,18 @@ public:
     void setFlipHorizontal(bool b);
     void setDefaultSequence(const char *name);
     SDL_Rect getCurAnchor();
+    // where render puts the current frame on screen
+    SDL_Rect getScreenRect();
+    // opacity mask of the current frame as drawn, NULL if the image has no colorkey
+    const PixelMask *getCurMask();
+    // index for playSequenceIndex, -1 if there is no such sequence
+    int findSequence(const char *name);
     void playSequence(const char *name);
     void playSequenceBackorder(const char *name);
+    // -1 only sets the play order
+    void playSequenceIndex(int index, bool backorder);
     virtual void update(Uint32 frameStamp);
-    virtual void draw(SDL_Surface *dst);
+    virtual void render(RenderList *list);
 };
 
 
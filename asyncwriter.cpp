@@ -0,0 +1,182 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <assert.h>
+#include <algorithm>
+#include "asyncwriter.h"
+
+namespace dragonfighting {
+
+static bool writeFully(int fd, const unsigned char *buffer, size_t length)
+{
+    while (length > 0) {
+        ssize_t ret = write(fd, buffer, length);
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        buffer += ret;
+        length -= ret;
+    }
+    return true;
+}
+
+AsyncWriter::AsyncWriter(size_t capacity) :
+    fd(-1),
+    ring(NULL),
+    capacity(1),
+    mask(0),
+    syncPolicy(SYNC_NEVER),
+    syncInterval(0),
+    lastSyncTime(0),
+    thread(NULL),
+    running(false),
+    droppedRecords(0),
+    head(0),
+    tail(0)
+{
+    while (this->capacity < capacity) {
+        this->capacity <<= 1;
+    }
+    mask = this->capacity - 1;
+    ring = (unsigned char *)malloc(this->capacity);
+    assert(ring != NULL);
+}
+
+AsyncWriter::~AsyncWriter()
+{
+    close();
+    free(ring);
+}
+
+void AsyncWriter::open(const char *filename, enum SyncPolicy policy, Uint32 syncInterval)
+{
+    if (isOpen()) {
+        throw "AsyncWriter already opened";
+    }
+
+    fd = ::open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) {
+        fprintf(stderr, "Unable to open %s: %s\n", filename, strerror(errno));
+        throw "Unable to open";
+    }
+
+    this->syncPolicy = policy;
+    this->syncInterval = syncInterval;
+    this->lastSyncTime = SDL_GetTicks();
+    this->droppedRecords = 0;
+    head.store(0);
+    tail.store(0);
+    running.store(true);
+
+    thread = SDL_CreateThread(threadMain, this);
+    if (thread == NULL) {
+        running.store(false);
+        ::close(fd);
+        fd = -1;
+        throw "Unable to create writer thread";
+    }
+}
+
+void AsyncWriter::close()
+{
+    if (!isOpen()) {
+        return;
+    }
+    running.store(false);
+    SDL_WaitThread(thread, NULL);
+    thread = NULL;
+    ::close(fd);
+    fd = -1;
+}
+
+bool AsyncWriter::isOpen()
+{
+    return fd != -1;
+}
+
+bool AsyncWriter::writeRecord(const void *data, size_t length)
+{
+    size_t h = head.load(std::memory_order_relaxed);
+    size_t t = tail.load(std::memory_order_acquire);
+
+    if (fd == -1 || length > capacity - (h - t)) {
+        droppedRecords ++;
+        return false;
+    }
+
+    size_t offset = h & mask;
+    size_t first = std::min(length, capacity - offset);
+    memcpy(ring + offset, data, first);
+    memcpy(ring, (const unsigned char *)data + first, length - first);
+
+    head.store(h + length, std::memory_order_release);
+    return true;
+}
+
+unsigned long AsyncWriter::getDroppedRecords()
+{
+    return droppedRecords;
+}
+
+// consumer side: write everything queued so far, in at most two spans
+size_t AsyncWriter::flushPending()
+{
+    size_t t = tail.load(std::memory_order_relaxed);
+    size_t h = head.load(std::memory_order_acquire);
+    size_t length = h - t;
+    if (length == 0) {
+        return 0;
+    }
+
+    size_t offset = t & mask;
+    size_t first = std::min(length, capacity - offset);
+    bool ok = writeFully(fd, ring + offset, first);
+    if (ok && length > first) {
+        ok = writeFully(fd, ring, length - first);
+    }
+    if (!ok) {
+        fprintf(stderr, "AsyncWriter: write failed: %s\n", strerror(errno));
+    }
+
+    tail.store(h, std::memory_order_release);
+    return length;
+}
+
+void AsyncWriter::syncIfNeeded(bool force)
+{
+    if (syncPolicy == SYNC_NEVER) {
+        return;
+    }
+    Uint32 now = SDL_GetTicks();
+    if (syncPolicy == SYNC_INTERVAL && !force && now - lastSyncTime < syncInterval) {
+        return;
+    }
+    fdatasync(fd);
+    lastSyncTime = now;
+}
+
+int AsyncWriter::threadMain(void *data)
+{
+    AsyncWriter *writer = (AsyncWriter *)data;
+
+    while (writer->running.load(std::memory_order_acquire)) {
+        if (writer->flushPending() == 0) {
+            SDL_Delay(1);
+        } else {
+            writer->syncIfNeeded(false);
+        }
+    }
+
+    // producer has stopped, drain what is left
+    writer->flushPending();
+    writer->syncIfNeeded(true);
+    return 0;
+}
+
+}
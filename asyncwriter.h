@@ -0,0 +1,64 @@
+#ifndef _ASYNC_WRITER_H_
+#define _ASYNC_WRITER_H_
+
+#include <stddef.h>
+#include <atomic>
+#include <SDL/SDL.h>
+
+namespace dragonfighting {
+
+/**
+ * Append-only file writer for the main loop (replays, logs, traces).
+ * The producer only copies the record into a single-producer/single-consumer
+ * ring, a background thread drains the ring with batched write() calls.
+ * writeRecord() never blocks: when the ring is full the record is dropped
+ * and counted.
+ */
+class AsyncWriter
+{
+public:
+    enum SyncPolicy {
+        SYNC_NEVER,         // leave it to the OS
+        SYNC_EVERY_BATCH,   // fdatasync after every batch written
+        SYNC_INTERVAL,      // fdatasync at most once per syncInterval msec
+    };
+
+protected:
+    int fd;
+    unsigned char *ring;
+    size_t capacity;    // power of 2
+    size_t mask;
+    enum SyncPolicy syncPolicy;
+    Uint32 syncInterval;
+    Uint32 lastSyncTime;
+    SDL_Thread *thread;
+    std::atomic<bool> running;
+    unsigned long droppedRecords;
+
+    // producer owns head, consumer owns tail; keep them on separate cache lines
+    char padding0[64];
+    std::atomic<size_t> head;
+    char padding1[64];
+    std::atomic<size_t> tail;
+    char padding2[64];
+
+    static int threadMain(void *data);
+    size_t flushPending();
+    void syncIfNeeded(bool force);
+
+public:
+    AsyncWriter(size_t capacity = 1 << 20);
+    ~AsyncWriter();
+
+    void open(const char *filename, enum SyncPolicy policy = SYNC_NEVER, Uint32 syncInterval = 1000);
+    void close();
+    bool isOpen();
+
+    // called from the producer thread only
+    bool writeRecord(const void *data, size_t length);
+    unsigned long getDroppedRecords();
+};
+
+}
+
+#endif
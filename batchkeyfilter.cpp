@@ -0,0 +1,262 @@
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "batchkeyfilter.h"
+#include "ftgkeys.h"
+
+namespace dragonfighting {
+
+BatchKeyFilter::BatchKeyFilter(const CommandTable *table, int numPlayers) :
+    commandTable(table),
+    numPlayers(numPlayers)
+{
+    assert(table != NULL && table->isCompiled());
+    assert(numPlayers > 0);
+
+    curKeys = (unsigned char *)calloc(numPlayers, sizeof(unsigned char));
+    preKeys = (unsigned char *)calloc(numPlayers, sizeof(unsigned char));
+    curFrames = (Uint32 *)calloc(numPlayers, sizeof(Uint32));
+    curIndex = (int *)calloc(numPlayers, sizeof(int));
+    beginIndex = (int *)calloc(numPlayers, sizeof(int));
+    commandMasks = (Uint64 *)calloc(numPlayers, sizeof(Uint64));
+    keyRings = (unsigned char *)calloc((size_t)numPlayers * KEY_BUFFER_LEN, sizeof(unsigned char));
+    frameRings = (Uint32 *)calloc((size_t)numPlayers * KEY_BUFFER_LEN, sizeof(Uint32));
+    if (curKeys == NULL || preKeys == NULL || curFrames == NULL || curIndex == NULL ||
+            beginIndex == NULL || commandMasks == NULL || keyRings == NULL || frameRings == NULL) {
+        throw "BatchKeyFilter: out of memory";
+    }
+}
+
+BatchKeyFilter::~BatchKeyFilter()
+{
+    free(curKeys);
+    free(preKeys);
+    free(curFrames);
+    free(curIndex);
+    free(beginIndex);
+    free(commandMasks);
+    free(keyRings);
+    free(frameRings);
+}
+
+// the key state of player changed: close the current entry, start a new one
+void BatchKeyFilter::advance(int player, unsigned char key)
+{
+    size_t row = (size_t)player * KEY_BUFFER_LEN;
+    frameRings[row + curIndex[player]] = curFrames[player];
+    preKeys[player] = curKeys[player];
+    curIndex[player] = (curIndex[player] + 1) % KEY_BUFFER_LEN;
+    keyRings[row + curIndex[player]] = key;
+    curKeys[player] = key;
+    curFrames[player] = 1;
+}
+
+bool BatchKeyFilter::matchPlayer(int player)
+{
+    size_t row = (size_t)player * KEY_BUFFER_LEN;
+    frameRings[row + curIndex[player]] = curFrames[player];
+    Uint64 mask = commandTable->matchAll(keyRings + row, frameRings + row, curIndex[player], beginIndex[player]);
+    if (mask == 0) {
+        return false;
+    }
+    commandMasks[player] = mask;
+    beginIndex[player] = curIndex[player];
+    return true;
+}
+
+int BatchKeyFilter::updateKeys(const unsigned char *keyStates)
+{
+    int matched = 0;
+    int p = 0;
+
+    memset(commandMasks, 0, sizeof(Uint64) * numPlayers);
+
+#ifdef __SSE2__
+    const __m128i buttons = _mm_set1_epi8(FTG_BUTTON_KEYS);
+    const __m128i zero = _mm_setzero_si128();
+    for (; p + 16 <= numPlayers; p += 16) {
+        __m128i keys = _mm_loadu_si128((const __m128i *)(keyStates + p));
+        __m128i cur = _mm_loadu_si128((const __m128i *)(curKeys + p));
+        __m128i same = _mm_cmpeq_epi8(keys, cur);
+
+        // players holding the same keys: one more frame (same lanes are -1)
+        __m128i same16lo = _mm_unpacklo_epi8(same, same);
+        __m128i same16hi = _mm_unpackhi_epi8(same, same);
+        __m128i *frames = (__m128i *)(curFrames + p);
+        _mm_storeu_si128(frames + 0, _mm_sub_epi32(_mm_loadu_si128(frames + 0), _mm_unpacklo_epi16(same16lo, same16lo)));
+        _mm_storeu_si128(frames + 1, _mm_sub_epi32(_mm_loadu_si128(frames + 1), _mm_unpackhi_epi16(same16lo, same16lo)));
+        _mm_storeu_si128(frames + 2, _mm_sub_epi32(_mm_loadu_si128(frames + 2), _mm_unpacklo_epi16(same16hi, same16hi)));
+        _mm_storeu_si128(frames + 3, _mm_sub_epi32(_mm_loadu_si128(frames + 3), _mm_unpackhi_epi16(same16hi, same16hi)));
+
+        unsigned int changed = ~_mm_movemask_epi8(same) & 0xFFFF;
+        while (changed != 0) {
+            int i = __builtin_ctz(changed);
+            advance(p + i, keyStates[p + i]);
+            changed &= changed - 1;
+        }
+
+        // 'command end': a button is down that was not down in the previous key state
+        cur = _mm_loadu_si128((const __m128i *)(curKeys + p));
+        __m128i pre = _mm_loadu_si128((const __m128i *)(preKeys + p));
+        __m128i pressed = _mm_and_si128(cur, buttons);
+        __m128i held = _mm_and_si128(pressed, pre);
+        unsigned int ends = _mm_movemask_epi8(_mm_andnot_si128(_mm_cmpeq_epi8(pressed, zero), _mm_cmpeq_epi8(held, zero)));
+        while (ends != 0) {
+            int i = __builtin_ctz(ends);
+            if (matchPlayer(p + i)) {
+                matched ++;
+            }
+            ends &= ends - 1;
+        }
+    }
+#endif
+
+    for (; p < numPlayers; p++) {
+        if (keyStates[p] == curKeys[p]) {
+            curFrames[p] += 1;
+        } else {
+            advance(p, keyStates[p]);
+        }
+        if ((curKeys[p] & FTG_BUTTON_KEYS) != 0 && (preKeys[p] & curKeys[p] & FTG_BUTTON_KEYS) == 0) {
+            if (matchPlayer(p)) {
+                matched ++;
+            }
+        }
+    }
+    return matched;
+}
+
+const Uint64 *BatchKeyFilter::getCommandMasks()
+{
+    return commandMasks;
+}
+
+Uint64 BatchKeyFilter::getCommandMask(int player)
+{
+    return commandMasks[player];
+}
+
+int BatchKeyFilter::getNumPlayers()
+{
+    return numPlayers;
+}
+
+Uint32 BatchKeyFilter::getKeyState(int player, unsigned char key)
+{
+    if ((curKeys[player] & key) != 0) {
+        return curFrames[player];
+    }
+    return 0;
+}
+
+void BatchKeyFilter::flipHorizontal(int player)
+{
+    unsigned char key = curKeys[player];
+    unsigned char flipped = key & ~(FTGKEY_4 | FTGKEY_6);
+    if ((key & FTGKEY_6) != 0) {
+        flipped |= FTGKEY_4;
+    }
+    if ((key & FTGKEY_4) != 0) {
+        flipped |= FTGKEY_6;
+    }
+    curKeys[player] = flipped;
+    keyRings[(size_t)player * KEY_BUFFER_LEN + curIndex[player]] = flipped;
+}
+
+}
+
+
+#ifdef FTG_TEST
+
+#include <stdio.h>
+#include <time.h>
+#include <vector>
+
+using namespace dragonfighting;
+
+static Uint64 nowNanoseconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (Uint64)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// random players against the same number of KeyFilters, results must agree
+int main(int argc, char **argv)
+{
+    int numPlayers = (argc >= 2) ? atoi(argv[1]) : 4096;
+    int numFrames = (argc >= 3) ? atoi(argv[2]) : 3600;
+    const char *commands[] = {"6323A", "236A", "236B", "22A", "6A", "2A", "3A", "623C", "41236B", "2+A"};
+
+    CommandTable table;
+    for (size_t i=0; i<sizeof(commands)/sizeof(commands[0]); i++) {
+        unsigned char keys[16];
+        size_t length = CommandTable::parseKeys(commands[i], keys, sizeof(keys));
+        if (length >= 2) {
+            table.addCommand(commands[i], keys, length);
+        }
+    }
+    table.compile();
+
+    BatchKeyFilter batch(&table, numPlayers);
+    std::vector<KeyFilter> filters(numPlayers);
+    for (int i=0; i<numPlayers; i++) {
+        filters[i].setCommandTable(&table);
+    }
+
+    const unsigned char directions[] = {0, FTGKEY_1, FTGKEY_2, FTGKEY_3, FTGKEY_4, FTGKEY_6, FTGKEY_7, FTGKEY_8, FTGKEY_9};
+    const unsigned char buttons[] = {FTGKEY_A, FTGKEY_B, FTGKEY_C, FTGKEY_D};
+    std::vector<unsigned char> states(numPlayers, 0);
+    std::vector<int> holds(numPlayers, 0);
+    srand(1);
+
+    Uint64 batchTime = 0, scalarTime = 0;
+    unsigned long recognized = 0, mismatches = 0;
+    for (int frame=0; frame<numFrames; frame++) {
+        for (int i=0; i<numPlayers; i++) {
+            if (holds[i]-- > 0) {
+                continue;
+            }
+            holds[i] = rand() % 6;
+            int r = rand() % 10;
+            if (r < 6) {
+                states[i] = (states[i] & FTG_BUTTON_KEYS) | directions[rand() % 9];
+            } else if (r < 9) {
+                states[i] ^= buttons[rand() % 4];
+            } else {
+                states[i] = 0;
+            }
+        }
+
+        Uint64 t0 = nowNanoseconds();
+        batch.updateKeys(&states[0]);
+        Uint64 t1 = nowNanoseconds();
+        for (int i=0; i<numPlayers; i++) {
+            filters[i].updateKeys(states[i]);
+        }
+        Uint64 t2 = nowNanoseconds();
+        batchTime += t1 - t0;
+        scalarTime += t2 - t1;
+
+        for (int i=0; i<numPlayers; i++) {
+            int command = filters[i].pollCurrentCommand();
+            Uint64 mask = batch.getCommandMask(i);
+            if ((command == -1) != (mask == 0) || (command != -1 && (mask & ((Uint64)1 << command)) == 0)) {
+                mismatches ++;
+            }
+            if (command != -1) {
+                recognized ++;
+            }
+        }
+    }
+
+    printf("%d players x %d frames, %lu commands recognized, %lu mismatches\n", numPlayers, numFrames, recognized, mismatches);
+    printf("BatchKeyFilter: %.2f ns per player-frame\n", (double)batchTime / numPlayers / numFrames);
+    printf("KeyFilter:      %.2f ns per player-frame\n", (double)scalarTime / numPlayers / numFrames);
+    return mismatches == 0 ? 0 : 1;
+}
+
+#endif
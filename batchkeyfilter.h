@@ -0,0 +1,56 @@
+#ifndef _BATCH_KEYFILTER_H_
+#define _BATCH_KEYFILTER_H_
+
+#include <SDL/SDL.h>
+#include "keyfilter.h"
+
+namespace dragonfighting {
+
+/*
+ * KeyFilter for many players at once, for headless simulation.
+ *
+ * The state every frame looks at (current and previous key state, how
+ * long the current one is held) is stored as one array per field across
+ * all players, so a frame is a few SSE2 compares over 16 players at a
+ * time. Only players whose history changed or who pressed a button touch
+ * their key ring, and only those at a 'command end' walk the CommandTable.
+ */
+class BatchKeyFilter
+{
+protected:
+    const CommandTable *commandTable;
+    int numPlayers;
+
+    // one entry per player
+    unsigned char *curKeys;
+    unsigned char *preKeys;
+    Uint32 *curFrames;
+    int *curIndex;
+    int *beginIndex;
+    Uint64 *commandMasks;
+
+    // key rings, KEY_BUFFER_LEN entries per player
+    unsigned char *keyRings;
+    Uint32 *frameRings;
+
+    void advance(int player, unsigned char key);
+    bool matchPlayer(int player);
+
+public:
+    BatchKeyFilter(const CommandTable *table, int numPlayers);
+    ~BatchKeyFilter();
+
+    // keyStates has one ftgkey state per player, returns how many players completed a command
+    int updateKeys(const unsigned char *keyStates);
+    // per player, bit id set for every command completed this frame
+    const Uint64 *getCommandMasks();
+    Uint64 getCommandMask(int player);
+
+    int getNumPlayers();
+    Uint32 getKeyState(int player, unsigned char key);
+    void flipHorizontal(int player);
+};
+
+}
+
+#endif
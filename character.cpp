@@ -4,6 +4,8 @@
 namespace dragonfighting {
 
 Character::Character() :
+    commandTable(NULL),
+    stateTable(NULL),
     keyFilter(NULL),
     keyInputer(NULL),
     state(STAND),
@@ -13,8 +15,12 @@ Character::Character() :
     stateTimer(0),
     stateAllow(0),
     invincible(false),
-    current_key_state(0)
+    current_key_state(0),
+    recognizedCommand(-1),
+    stateCommand(-1),
+    projectileRequest(false)
 {
+    name[0] = '\0';
 }
 
 Character::~Character()
@@ -35,9 +41,54 @@ const char *Character::getName()
     return this->name;
 }
 
+void Character::setCommandTable(const CommandTable *table)
+{
+    this->commandTable = table;
+    bindCommands();
+    if (keyFilter != NULL) {
+        keyFilter->setCommandTable(table);
+    }
+}
+
+const CommandTable *Character::getCommandTable()
+{
+    return commandTable;
+}
+
+void Character::setStateTable(const StateTable *table)
+{
+    this->stateTable = table;
+    bindCommands();
+}
+
+const StateTable *Character::getStateTable()
+{
+    return stateTable;
+}
+
+// resolve the state table's command names once, so a recognized command id
+// indexes straight into its binding
+void Character::bindCommands()
+{
+    commandBindings.clear();
+    if (commandTable == NULL || stateTable == NULL) {
+        return;
+    }
+    commandBindings.resize(commandTable->getNumCommands(), -1);
+    for (int i=0; i<stateTable->getNumCommands(); i++) {
+        int id = commandTable->findCommand(stateTable->getCommand(i)->command);
+        if (id >= 0) {
+            commandBindings[id] = i;
+        }
+    }
+}
+
 void Character::setKeyFilter(KeyFilter *filter)
 {
     this->keyFilter = filter;
+    if (filter != NULL) {
+        filter->setCommandTable(commandTable);
+    }
 }
 
 void Character::setInputer(CtrlKeyReader *inputer)
@@ -98,13 +149,35 @@ bool Character::isInvincible()
     return invincible;
 }
 
+const char *Character::getRecognizedCommand()
+{
+    return (commandTable != NULL) ? commandTable->getCommandName(recognizedCommand) : "";
+}
+
+const char *Character::getStateCommand()
+{
+    return (commandTable != NULL) ? commandTable->getCommandName(stateCommand) : "";
+}
+
+int Character::getStateCommandId()
+{
+    return stateCommand;
+}
+
+bool Character::takeProjectileRequest()
+{
+    bool request = projectileRequest;
+    projectileRequest = false;
+    return request;
+}
+
 void Character::update(Uint32 frameStamp)
 {
     assert(keyFilter != NULL);
     assert(keyInputer != NULL);
 
     struct Ctrl_KeyEvent event;
-    if (this->keyInputer->readEvent(&event, frameStamp) == 1) {
+    while (this->keyInputer->readEvent(&event, frameStamp) == 1) {
         if (event.type == Ctrl_KEYDOWN) {
             current_key_state |= ctrlkey2ftgkey(event.key, facing == LEFT);
         } else if (event.type == Ctrl_KEYUP) {
@@ -116,53 +189,56 @@ void Character::update(Uint32 frameStamp)
     updateStateMachine();
 }
 
+bool Character::canEnterState(int newstate)
+{
+    return state != newstate && (stateAllow & StateTable::allowBit(newstate));
+}
+
+void Character::enterState(int newstate)
+{
+    const struct StateRow *row = stateTable->getRow(newstate);
+    state = (enum State)newstate;
+    stateAllow = row->allow;
+    if (!row->keepTimer) {
+        stateTimer = row->duration;
+    }
+    if (row->moveTime != 0) {
+        moveTimer = row->moveTime;
+    }
+    if (row->invincible >= 0) {
+        invincible = row->invincible;
+    }
+}
+
 void Character::updateStateMachine()
 {
-    bool iscmd = false;
-    char commandname[16];
+    assert(stateTable != NULL);
+
+    int command = -1;
+    enum State oldstate = state;
+    bool bycommand = false;
 
     if (stateTimer == 0) {
-        if (state == JUMP || state == JUMPATTACK || state == JUMPGUARD) {
-            state = LAND;
-            stateAllow = ALLOW_NONE;
-            stateTimer = 8;
-        } else if (state == FALL) {
-            state = LIE;
-            stateAllow = ALLOW_NONE;
-            stateTimer = 60;
-        } else if (state == LIE) {
-            state = RAISE;
-            stateAllow = ALLOW_NONE;
-            stateTimer = 16;
-        } else {
-            state = STAND;
-            stateAllow = ALLOW_ALL;
-            invincible = false;
-        }
+        enterState(stateTable->getRow(state)->next);
     }
 
-    iscmd = this->keyFilter->pollCurrentCommandName(commandname, sizeof(commandname));
+    command = this->keyFilter->pollCurrentCommand();
+    recognizedCommand = command;
 
-    if (!iscmd) {
-        if (state != WALK && (stateAllow & ALLOW_WALK) && this->keyFilter->getKeyState(FTGKEY_6)) {
-            state = WALK;
-            stateAllow = ALLOW_ALL;
-            stateTimer = 2;
+    // which key starts which move is the control scheme, kept here;
+    // what a state does once entered comes from the table
+    if (command == -1) {
+        if (canEnterState(WALK) && this->keyFilter->getKeyState(FTGKEY_6)) {
+            enterState(WALK);
             forward = true;
-        } else if (state != WALK && (stateAllow & ALLOW_WALK) && this->keyFilter->getKeyState(FTGKEY_4)) {
-            state = WALK;
-            stateAllow = ALLOW_ALL;
-            stateTimer = 2;
+        } else if (canEnterState(WALK) && this->keyFilter->getKeyState(FTGKEY_4)) {
+            enterState(WALK);
             forward = false;
-        } else if (state != ATTACK && (stateAllow & ALLOW_ATTACK) && this->keyFilter->getKeyState(FTGKEY_A)
+        } else if (canEnterState(ATTACK) && this->keyFilter->getKeyState(FTGKEY_A)
                 && this->keyFilter->getKeyState(FTGKEY_A) < 10) {
-            state = ATTACK;
-            stateAllow = ALLOW_NONE;
-            stateTimer = 30;
-        } else if (state != JUMP && (stateAllow & ALLOW_JUMP) && this->keyFilter->getKeyState(FTGKEY_8)) {
-            state = JUMP;
-            stateAllow = ALLOW_JUMPATTACK | ALLOW_JUMPGUARD;
-            stateTimer = -1;
+            enterState(ATTACK);
+        } else if (canEnterState(JUMP) && this->keyFilter->getKeyState(FTGKEY_8)) {
+            enterState(JUMP);
             if (this->keyFilter->getKeyState(FTGKEY_6)) {
                 jumpingDirection = 1;
             } else if (this->keyFilter->getKeyState(FTGKEY_4)) {
@@ -170,63 +246,50 @@ void Character::updateStateMachine()
             } else {
                 jumpingDirection = 0;
             }
-        } else if (state == JUMP && (stateAllow & ALLOW_JUMPATTACK) && this->keyFilter->getKeyState(FTGKEY_A)) {
-            state = JUMPATTACK;
-            stateAllow = ALLOW_NONE;
-            stateTimer = stateTimer;
+        } else if (state == JUMP && canEnterState(JUMPATTACK) && this->keyFilter->getKeyState(FTGKEY_A)) {
+            enterState(JUMPATTACK);
         }
-    } else {
-        if (state != ATTACK3 && (stateAllow & ALLOW_ATTACK3) && strcmp(commandname, "6323A") == 0) {
-            state = ATTACK3;
-            stateAllow = ALLOW_NONE;
-            stateTimer = 30;
+    } else if (command < (int)commandBindings.size() && commandBindings[command] >= 0) {
+        const struct StateCommand *binding = stateTable->getCommand(commandBindings[command]);
+        if (canEnterState(binding->state)) {
+            enterState(binding->state);
+            bycommand = true;
+            if (binding->projectile) {
+                projectileRequest = true;
+            }
         }
     }
+    if (state != oldstate) {
+        stateCommand = bycommand ? command : -1;
+    }
     stateTimer --;
     moveTimer --;
 }
 
 void Character::underAttack(enum HitType hittype)
 {
+    stateCommand = -1;
     if (state == GUARD || state == SQUATGUARD || state == JUMPGUARD) {
-        stateTimer = 30;
+        stateTimer = stateTable->getRow(state)->duration;
     } else if ((stateAllow & ALLOW_GUARD) &&
             (stateAllow & ALLOW_SQUATGUARD) &&
             (stateAllow & ALLOW_JUMPGUARD) &&
             this->keyFilter->getKeyState(FTGKEY_4)) {
         if (state == JUMP || state == JUMPATTACK) {
-            state = JUMPGUARD;
-            stateAllow = ALLOW_JUMPGUARD;
-            stateTimer = 30;
+            enterState(JUMPGUARD);
+        } else if (this->keyFilter->getKeyState(FTGKEY_2)) {
+            enterState(SQUATGUARD);
         } else {
-            if (this->keyFilter->getKeyState(FTGKEY_2)) {
-                state = SQUATGUARD;
-                stateAllow = ALLOW_GUARD;
-            } else {
-                state = GUARD;
-                stateAllow = ALLOW_SQUATGUARD;
-            }
-            stateTimer = 30;
-            moveTimer = 10;
+            enterState(GUARD);
         }
     } else {
         if (hittype == NORMAL) {
-            state = HIT;
-            stateAllow = ALLOW_NONE;
-            stateTimer = 15;
-            moveTimer = 10;
-            invincible = true;
+            enterState(HIT);
         } else {
-            state = FALL;
-            stateAllow = ALLOW_NONE;
-            stateTimer = -1;
-            invincible = true;
+            enterState(FALL);
         }
     }
 }
 
 
 }
-
-
-
@@ -3,6 +3,7 @@
 
 #include "keyfilter.h"
 #include "keystream.h"
+#include "statetable.h"
 
 namespace dragonfighting {
 
@@ -64,6 +65,8 @@ public:
 
 protected:
     char name[16];
+    const CommandTable *commandTable;
+    const StateTable *stateTable;
     KeyFilter *keyFilter;
     CtrlKeyReader *keyInputer;
     enum State state;
@@ -79,14 +82,28 @@ private:
     Uint32 stateAllow;
     bool invincible;
     unsigned char current_key_state;
+    int recognizedCommand;  // command recognized this frame
+    int stateCommand;       // command that started the current state
+    vector<int> commandBindings;    // state table command per command id, -1 if unbound
+    bool projectileRequest; // the stage spawns the projectile
 
+    void bindCommands();
+    bool canEnterState(int newstate);
     void updateStateMachine();
 
+protected:
+    // switch to a row of the state table: allow mask, timers, invincibility
+    void enterState(int newstate);
+
 public:
     Character();
     virtual ~Character();
     void setName(const char *name);
     const char *getName();
+    void setCommandTable(const CommandTable *table);
+    const CommandTable *getCommandTable();
+    virtual void setStateTable(const StateTable *table);
+    const StateTable *getStateTable();
     void setKeyFilter(KeyFilter *filter);
     void setInputer(CtrlKeyReader *inputer);
     virtual void update(Uint32 frameStamp);
@@ -97,6 +114,11 @@ public:
     Uint32 getStateAllow();
     bool isGuard();
     bool isInvincible();
+    const char *getRecognizedCommand();
+    const char *getStateCommand();
+    int getStateCommandId();
+    // true once after a projectile special started
+    bool takeProjectileRequest();
 
     void underAttack(enum HitType hittype);
 };
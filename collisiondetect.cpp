@@ -1,3 +1,11 @@
+#include <assert.h>
+#include <stdlib.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
 #include "collisiondetect.h"
 
 bool rectCollide(SDL_Rect rect1, SDL_Rect rect2)
@@ -36,3 +44,262 @@ bool areaCollide(const SDL_Rect *rects1, int size1, const SDL_Rect *rects2, int
     return false;
 }
 
+
+bool rectCollide(const struct CollisionRect &rect1, const struct CollisionRect &rect2)
+{
+    if (rect1.y + rect1.h < rect2.y) return false;
+    if (rect1.y > rect2.y + rect2.h) return false;
+    if (rect1.x + rect1.w < rect2.x) return false;
+    if (rect1.x > rect2.x + rect2.w) return false;
+
+    return true;
+}
+
+bool areaCollide(const struct CollisionRect *rects1, int size1, const struct CollisionRect *rects2, int size2)
+{
+    if (rects1 != NULL && rects2 != NULL)
+    {
+        for (int i=0; i<size1; i++) {
+            for (int j=0; j<size2; j++) {
+                if (rectCollide(rects1[i], rects2[j])) {
+                    return true;
+                }
+            }
+        }
+    }
+
+    return false;
+}
+
+struct CollisionRect rectsBounds(const struct CollisionRect *rects, int size)
+{
+    struct CollisionRect bounds = {0, 0, 0, 0};
+    if (rects == NULL || size <= 0) {
+        return bounds;
+    }
+
+    float left = rects[0].x;
+    float right = rects[0].x + rects[0].w;
+    float top = rects[0].y;
+    float bottom = rects[0].y + rects[0].h;
+    for (int i=1; i<size; i++) {
+        if (rects[i].x < left) left = rects[i].x;
+        if (rects[i].x + rects[i].w > right) right = rects[i].x + rects[i].w;
+        if (rects[i].y < top) top = rects[i].y;
+        if (rects[i].y + rects[i].h > bottom) bottom = rects[i].y + rects[i].h;
+    }
+    bounds.x = left;
+    bounds.y = top;
+    bounds.w = right - left;
+    bounds.h = bottom - top;
+    return bounds;
+}
+
+bool areaCollide(const struct CollisionRect *rects1, int size1, const struct CollisionRect &bounds1,
+        const struct CollisionRect *rects2, int size2, const struct CollisionRect &bounds2)
+{
+    if (rects1 == NULL || rects2 == NULL) {
+        return false;
+    }
+    if (!rectCollide(bounds1, bounds2)) {
+        return false;
+    }
+    return areaCollide(rects1, size1, rects2, size2);
+}
+
+void rectLanesInit(struct RectLanes *lanes, int capacity)
+{
+    capacity = (capacity + RECT_LANES_BLOCK - 1) / RECT_LANES_BLOCK * RECT_LANES_BLOCK;
+    if (capacity == 0) {
+        capacity = RECT_LANES_BLOCK;
+    }
+    float *edges = (float *)calloc(capacity * 4, sizeof(float));
+    assert(edges != NULL);
+    lanes->left = edges;
+    lanes->right = edges + capacity;
+    lanes->top = edges + capacity * 2;
+    lanes->bottom = edges + capacity * 3;
+    lanes->size = 0;
+    lanes->capacity = capacity;
+}
+
+void rectLanesFree(struct RectLanes *lanes)
+{
+    free(lanes->left);
+    lanes->left = lanes->right = lanes->top = lanes->bottom = NULL;
+    lanes->size = 0;
+    lanes->capacity = 0;
+}
+
+void rectLanesSet(struct RectLanes *lanes, const struct CollisionRect *rects, int size, float dx, float dy)
+{
+    assert(size <= lanes->capacity);
+    for (int i=0; i<size; i++) {
+        lanes->left[i] = rects[i].x + dx;
+        lanes->right[i] = lanes->left[i] + rects[i].w;
+        lanes->top[i] = rects[i].y + dy;
+        lanes->bottom[i] = lanes->top[i] + rects[i].h;
+    }
+    lanes->size = size;
+}
+
+int rectCollideLanes(const struct CollisionRect &rect, const struct RectLanes *lanes)
+{
+    float left = rect.x;
+    float right = rect.x + rect.w;
+    float top = rect.y;
+    float bottom = rect.y + rect.h;
+    int i = 0;
+
+    // lanes past size hold stale rects, their bits are masked off
+#if defined(__AVX2__)
+    const __m256 l1 = _mm256_set1_ps(left);
+    const __m256 r1 = _mm256_set1_ps(right);
+    const __m256 t1 = _mm256_set1_ps(top);
+    const __m256 b1 = _mm256_set1_ps(bottom);
+    for (; i < lanes->size; i += 8) {
+        __m256 l2 = _mm256_loadu_ps(lanes->left + i);
+        __m256 r2 = _mm256_loadu_ps(lanes->right + i);
+        __m256 t2 = _mm256_loadu_ps(lanes->top + i);
+        __m256 b2 = _mm256_loadu_ps(lanes->bottom + i);
+        __m256 miss = _mm256_or_ps(
+                _mm256_or_ps(_mm256_cmp_ps(t2, b1, _CMP_GT_OQ), _mm256_cmp_ps(t1, b2, _CMP_GT_OQ)),
+                _mm256_or_ps(_mm256_cmp_ps(l2, r1, _CMP_GT_OQ), _mm256_cmp_ps(l1, r2, _CMP_GT_OQ)));
+        unsigned int hits = ~_mm256_movemask_ps(miss) & 0xFF;
+        if (lanes->size - i < 8) {
+            hits &= (1u << (lanes->size - i)) - 1;
+        }
+        if (hits != 0) {
+            return i + __builtin_ctz(hits);
+        }
+    }
+#elif defined(__SSE2__)
+    const __m128 l1 = _mm_set1_ps(left);
+    const __m128 r1 = _mm_set1_ps(right);
+    const __m128 t1 = _mm_set1_ps(top);
+    const __m128 b1 = _mm_set1_ps(bottom);
+    for (; i < lanes->size; i += 4) {
+        __m128 l2 = _mm_loadu_ps(lanes->left + i);
+        __m128 r2 = _mm_loadu_ps(lanes->right + i);
+        __m128 t2 = _mm_loadu_ps(lanes->top + i);
+        __m128 b2 = _mm_loadu_ps(lanes->bottom + i);
+        __m128 miss = _mm_or_ps(
+                _mm_or_ps(_mm_cmpgt_ps(t2, b1), _mm_cmpgt_ps(t1, b2)),
+                _mm_or_ps(_mm_cmpgt_ps(l2, r1), _mm_cmpgt_ps(l1, r2)));
+        unsigned int hits = ~_mm_movemask_ps(miss) & 0xF;
+        if (lanes->size - i < 4) {
+            hits &= (1u << (lanes->size - i)) - 1;
+        }
+        if (hits != 0) {
+            return i + __builtin_ctz(hits);
+        }
+    }
+#else
+    for (; i < lanes->size; i++) {
+        if (bottom < lanes->top[i]) continue;
+        if (top > lanes->bottom[i]) continue;
+        if (right < lanes->left[i]) continue;
+        if (left > lanes->right[i]) continue;
+        return i;
+    }
+#endif
+    return -1;
+}
+
+bool areaCollideLanes(const struct CollisionRect *rects1, int size1, const struct RectLanes *lanes2,
+        int *index1, int *index2)
+{
+    if (rects1 == NULL || lanes2 == NULL) {
+        return false;
+    }
+    for (int i=0; i<size1; i++) {
+        int j = rectCollideLanes(rects1[i], lanes2);
+        if (j >= 0) {
+            if (index1 != NULL) *index1 = i;
+            if (index2 != NULL) *index2 = j;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool areaCollide(const struct CollisionRect *rects1, int size1, const struct CollisionRect &bounds1,
+        const struct RectLanes *lanes2, const struct CollisionRect &bounds2,
+        int *index1, int *index2)
+{
+    if (rects1 == NULL || lanes2 == NULL || lanes2->size == 0) {
+        return false;
+    }
+    if (!rectCollide(bounds1, bounds2)) {
+        return false;
+    }
+    return areaCollideLanes(rects1, size1, lanes2, index1, index2);
+}
+
+
+#ifdef FTG_TEST
+
+#include <stdio.h>
+#include <time.h>
+
+static Uint64 nowNanoseconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (Uint64)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void randomRects(struct CollisionRect *rects, int size)
+{
+    for (int i=0; i<size; i++) {
+        rects[i].x = (rand() % 3200 - 400) / 4.0f;
+        rects[i].y = (rand() % 1600 - 400) / 4.0f;
+        rects[i].w = rand() % 40;
+        rects[i].h = rand() % 40;
+    }
+}
+
+// random areas through areaCollide and areaCollideLanes, results must agree
+int main(int argc, char **argv)
+{
+    int numRects = (argc >= 2) ? atoi(argv[1]) : 32;
+    int numTests = (argc >= 3) ? atoi(argv[2]) : 100000;
+    struct CollisionRect *rects1 = (struct CollisionRect *)malloc(sizeof(struct CollisionRect) * numRects);
+    struct CollisionRect *rects2 = (struct CollisionRect *)malloc(sizeof(struct CollisionRect) * numRects);
+    struct RectLanes lanes2;
+    rectLanesInit(&lanes2, numRects);
+
+    int mismatches = 0, hits = 0;
+    Uint64 scalarTime = 0, lanesTime = 0;
+    for (int t=0; t<numTests; t++) {
+        int size1 = 1 + rand() % numRects;
+        int size2 = 1 + rand() % numRects;
+        randomRects(rects1, size1);
+        randomRects(rects2, size2);
+        rectLanesSet(&lanes2, rects2, size2);
+
+        Uint64 t0 = nowNanoseconds();
+        bool scalar = areaCollide(rects1, size1, rects2, size2);
+        Uint64 t1 = nowNanoseconds();
+        int i = -1, j = -1;
+        bool lanes = areaCollideLanes(rects1, size1, &lanes2, &i, &j);
+        Uint64 t2 = nowNanoseconds();
+        scalarTime += t1 - t0;
+        lanesTime += t2 - t1;
+
+        if (scalar != lanes || (lanes && !rectCollide(rects1[i], rects2[j]))) {
+            mismatches ++;
+        }
+        hits += scalar;
+    }
+    printf("%d tests of up to %d x %d rects, %d hit, %d mismatches\n", numTests, numRects, numRects, hits, mismatches);
+    printf("areaCollide %.1f ns, areaCollideLanes %.1f ns per test\n",
+            (double)scalarTime / numTests, (double)lanesTime / numTests);
+
+    rectLanesFree(&lanes2);
+    free(rects1);
+    free(rects2);
+    return mismatches != 0;
+}
+
+#endif
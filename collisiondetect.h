@@ -6,5 +6,56 @@
 bool rectCollide(SDL_Rect rect1, SDL_Rect rect2);
 bool areaCollide(const SDL_Rect *rects1, int size1, const SDL_Rect *rects2, int size2);
 
+/*
+ * Rects in simulation space, float like Sprite positions, so collision
+ * does not depend on the camera or the widget tree and keeps sub-pixel
+ * positions. Edges are inclusive like rectCollide.
+ */
+struct CollisionRect {
+    float x;
+    float y;
+    float w;
+    float h;
+};
+
+bool rectCollide(const struct CollisionRect &rect1, const struct CollisionRect &rect2);
+bool areaCollide(const struct CollisionRect *rects1, int size1, const struct CollisionRect *rects2, int size2);
+// smallest rect holding all of rects
+struct CollisionRect rectsBounds(const struct CollisionRect *rects, int size);
+// areaCollide rejecting on the bounds of each area first
+bool areaCollide(const struct CollisionRect *rects1, int size1, const struct CollisionRect &bounds1,
+        const struct CollisionRect *rects2, int size2, const struct CollisionRect &bounds2);
+
+/*
+ * Collision rects as float edge lanes (structure of arrays), so one rect is
+ * tested against 4 (SSE) or 8 (AVX2) rects per compare. Lanes are
+ * allocated in blocks of RECT_LANES_BLOCK so the kernels never read past
+ * the end.
+ */
+const int RECT_LANES_BLOCK = 8;
+
+struct RectLanes {
+    float *left;
+    float *right;
+    float *top;
+    float *bottom;
+    int size;
+    int capacity;
+};
+
+void rectLanesInit(struct RectLanes *lanes, int capacity);
+void rectLanesFree(struct RectLanes *lanes);
+// replace the lanes with rects translated by dx, dy
+void rectLanesSet(struct RectLanes *lanes, const struct CollisionRect *rects, int size, float dx = 0, float dy = 0);
+// index of the first rect in lanes overlapping rect, -1 if none
+int rectCollideLanes(const struct CollisionRect &rect, const struct RectLanes *lanes);
+// first overlapping pair (rects1[*index1], lanes2 rect *index2), indexes may be NULL
+bool areaCollideLanes(const struct CollisionRect *rects1, int size1, const struct RectLanes *lanes2,
+        int *index1 = NULL, int *index2 = NULL);
+// bounds rejection, then areaCollideLanes
+bool areaCollide(const struct CollisionRect *rects1, int size1, const struct CollisionRect &bounds1,
+        const struct RectLanes *lanes2, const struct CollisionRect &bounds2,
+        int *index1 = NULL, int *index2 = NULL);
+
 #endif
 
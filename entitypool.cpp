@@ -0,0 +1,359 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include "entitypool.h"
+
+namespace dragonfighting {
+
+static bool sweepEntryLess(const struct EntityPool::SweepEntry &a, const struct EntityPool::SweepEntry &b)
+{
+    return a.left < b.left;
+}
+
+EntityPool::EntityPool(int capacity) :
+    capacity(capacity),
+    numFree(0),
+    numActive(0),
+    sweepSize(0),
+    sweptBodies(0),
+    bodyRoom(8),
+    droppedSpawns(0)
+{
+    entities = (struct Entity *)calloc(capacity, sizeof(struct Entity));
+    freeSlots = (int *)malloc(sizeof(int) * capacity);
+    activeSlots = (int *)malloc(sizeof(int) * capacity);
+    // room for every entity plus a few bodies, grown if more bodies come
+    sweepList = (struct SweepEntry *)malloc(sizeof(struct SweepEntry) * (capacity + bodyRoom));
+    sweepScratch = (struct SweepEntry *)malloc(sizeof(struct SweepEntry) * (capacity + bodyRoom));
+    nextBody = (int *)malloc(sizeof(int) * (capacity + bodyRoom));
+    if (entities == NULL || freeSlots == NULL || activeSlots == NULL || sweepList == NULL
+            || sweepScratch == NULL || nextBody == NULL) {
+        throw "EntityPool: out of memory";
+    }
+    clear();
+}
+
+EntityPool::~EntityPool()
+{
+    free(entities);
+    free(freeSlots);
+    free(activeSlots);
+    free(sweepList);
+    free(sweepScratch);
+    free(nextBody);
+}
+
+void EntityPool::clear()
+{
+    for (int i=0; i<capacity; i++) {
+        entities[i].alive = false;
+        entities[i].swept = false;
+        // lowest slots handed out first
+        freeSlots[i] = capacity - 1 - i;
+    }
+    numFree = capacity;
+    numActive = 0;
+    sweepSize = 0;
+    sweptBodies = 0;
+}
+
+struct Entity *EntityPool::spawn(int type, int owner, float x, float y, float vx, float vy, int life)
+{
+    if (numFree == 0) {
+        droppedSpawns ++;
+        return NULL;
+    }
+    int slot = freeSlots[--numFree];
+    struct Entity *entity = &entities[slot];
+    // swept stays as it is, the slot's sweep entry serves the new entity
+    entity->type = type;
+    entity->owner = owner;
+    entity->alive = true;
+    entity->x = x;
+    entity->y = y;
+    entity->vx = vx;
+    entity->vy = vy;
+    entity->life = life;
+    entity->rect.x = 0;
+    entity->rect.y = 0;
+    entity->rect.w = 0;
+    entity->rect.h = 0;
+    activeSlots[numActive++] = slot;
+    return entity;
+}
+
+void EntityPool::kill(struct Entity *entity)
+{
+    entity->alive = false;
+}
+
+void EntityPool::update()
+{
+    int n = 0;
+    for (int i=0; i<numActive; i++) {
+        int slot = activeSlots[i];
+        struct Entity *entity = &entities[slot];
+        if (entity->alive) {
+            entity->x += entity->vx;
+            entity->y += entity->vy;
+            if (entity->life > 0 && --entity->life == 0) {
+                entity->alive = false;
+            }
+        }
+        if (entity->alive) {
+            activeSlots[n++] = slot;
+        } else {
+            freeSlots[numFree++] = slot;
+        }
+    }
+    numActive = n;
+}
+
+void EntityPool::updateSweepList(const struct CollisionBody *bodies, int numBodies)
+{
+    if (numBodies > bodyRoom) {
+        bodyRoom = numBodies;
+        struct SweepEntry *list = (struct SweepEntry *)realloc(sweepList, sizeof(struct SweepEntry) * (capacity + numBodies));
+        struct SweepEntry *scratch = (struct SweepEntry *)realloc(sweepScratch, sizeof(struct SweepEntry) * (capacity + numBodies));
+        int *next = (int *)realloc(nextBody, sizeof(int) * (capacity + numBodies));
+        if (list != NULL) sweepList = list;
+        if (scratch != NULL) sweepScratch = scratch;
+        if (next != NULL) nextBody = next;
+        if (list == NULL || scratch == NULL || next == NULL) {
+            throw "EntityPool: out of memory";
+        }
+    }
+
+    // keep last frame's order, dropping what is gone
+    int n = 0;
+    for (int i=0; i<sweepSize; i++) {
+        int id = sweepList[i].id;
+        if (id < capacity) {
+            struct Entity *entity = &entities[id];
+            if (!entity->alive || entity->type != ENTITY_PROJECTILE) {
+                entity->swept = false;
+                continue;
+            }
+            sweepList[n].left = entity->x + entity->rect.x;
+            sweepList[n].right = sweepList[n].left + entity->rect.w;
+        } else {
+            if (numBodies != sweptBodies) {
+                continue;
+            }
+            const struct CollisionRect *bounds = bodies[id - capacity].bounds;
+            sweepList[n].left = bounds->x;
+            sweepList[n].right = bounds->x + bounds->w;
+        }
+        sweepList[n].id = id;
+        n++;
+    }
+
+    // insertion sort on left, nearly sorted already; crowds moving through
+    // each other can make it quadratic, past a budget sort from scratch
+    long budget = 8L * n + 64;
+    for (int i=1; i<n; i++) {
+        struct SweepEntry entry = sweepList[i];
+        int j = i - 1;
+        while (j >= 0 && sweepList[j].left > entry.left) {
+            sweepList[j + 1] = sweepList[j];
+            j--;
+        }
+        sweepList[j + 1] = entry;
+        budget -= i - 1 - j;
+        if (budget < 0) {
+            std::sort(sweepList, sweepList + n, sweepEntryLess);
+            break;
+        }
+    }
+
+    // then what is new, sorted on its own and merged in
+    int numOld = n;
+    for (int i=0; i<numActive; i++) {
+        struct Entity *entity = &entities[activeSlots[i]];
+        if (entity->swept || entity->type != ENTITY_PROJECTILE) {
+            continue;
+        }
+        entity->swept = true;
+        sweepList[n].left = entity->x + entity->rect.x;
+        sweepList[n].right = sweepList[n].left + entity->rect.w;
+        sweepList[n].id = activeSlots[i];
+        n++;
+    }
+    if (numBodies != sweptBodies) {
+        for (int i=0; i<numBodies; i++) {
+            sweepList[n].left = bodies[i].bounds->x;
+            sweepList[n].right = bodies[i].bounds->x + bodies[i].bounds->w;
+            sweepList[n].id = capacity + i;
+            n++;
+        }
+        sweptBodies = numBodies;
+    }
+    sweepSize = n;
+
+    if (numOld < sweepSize) {
+        std::sort(sweepList + numOld, sweepList + sweepSize, sweepEntryLess);
+        std::merge(sweepList, sweepList + numOld, sweepList + numOld, sweepList + sweepSize,
+                sweepScratch, sweepEntryLess);
+        std::swap(sweepList, sweepScratch);
+    }
+}
+
+bool EntityPool::testPair(const struct CollisionBody *bodies, int slot, int body, int *rect)
+{
+    struct Entity *entity = &entities[slot];
+    if (!entity->alive || entity->owner == bodies[body].owner) {
+        return false;
+    }
+    struct CollisionRect world = entity->rect;
+    world.x += entity->x;
+    world.y += entity->y;
+    return rectCollide(world, *bodies[body].bounds) && areaCollideLanes(&world, 1, bodies[body].lanes, NULL, rect);
+}
+
+int EntityPool::collide(const struct CollisionBody *bodies, int numBodies, struct EntityHit *hits, int maxHits)
+{
+    int numHits = 0;
+    int rect = -1;
+
+    updateSweepList(bodies, numBodies);
+
+    int next = sweepSize;
+    for (int i=sweepSize-1; i>=0; i--) {
+        nextBody[i] = next;
+        if (sweepList[i].id >= capacity) {
+            next = i;
+        }
+    }
+
+    // entries after i that start before i ends overlap it on x
+    for (int i=0; i<sweepSize; i++) {
+        int id = sweepList[i].id;
+        if (id >= capacity) {
+            for (int j=i+1; j<sweepSize && sweepList[j].left <= sweepList[i].right; j++) {
+                if (sweepList[j].id >= capacity || !testPair(bodies, sweepList[j].id, id - capacity, &rect)) {
+                    continue;
+                }
+                if (numHits == maxHits) {
+                    return numHits;
+                }
+                hits[numHits].entity = &entities[sweepList[j].id];
+                hits[numHits].body = id - capacity;
+                hits[numHits].rect = rect;
+                numHits ++;
+            }
+        } else {
+            for (int j=nextBody[i]; j<sweepSize && sweepList[j].left <= sweepList[i].right; j=nextBody[j]) {
+                if (!testPair(bodies, id, sweepList[j].id - capacity, &rect)) {
+                    continue;
+                }
+                if (numHits == maxHits) {
+                    return numHits;
+                }
+                hits[numHits].entity = &entities[id];
+                hits[numHits].body = sweepList[j].id - capacity;
+                hits[numHits].rect = rect;
+                numHits ++;
+            }
+        }
+    }
+    return numHits;
+}
+
+int EntityPool::getNumActive()
+{
+    return numActive;
+}
+
+struct Entity *EntityPool::getActive(int i)
+{
+    return &entities[activeSlots[i]];
+}
+
+unsigned long EntityPool::getDroppedSpawns()
+{
+    return droppedSpawns;
+}
+
+}
+
+
+#ifdef FTG_TEST
+
+#include <stdio.h>
+#include <time.h>
+
+using namespace dragonfighting;
+
+static Uint64 nowNanoseconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (Uint64)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// many projectiles crossing a row of bodies, sweep hits against brute force
+int main(int argc, char **argv)
+{
+    int numEntities = (argc >= 2) ? atoi(argv[1]) : 2000;
+    int numBodies = (argc >= 3) ? atoi(argv[2]) : 16;
+    int numFrames = (argc >= 4) ? atoi(argv[3]) : 600;
+
+    EntityPool pool(numEntities);
+    struct CollisionRect *bodyRects = (struct CollisionRect *)malloc(sizeof(struct CollisionRect) * numBodies);
+    struct RectLanes *bodyLanes = (struct RectLanes *)malloc(sizeof(struct RectLanes) * numBodies);
+    struct CollisionBody *bodies = (struct CollisionBody *)malloc(sizeof(struct CollisionBody) * numBodies);
+    struct EntityHit *hits = (struct EntityHit *)malloc(sizeof(struct EntityHit) * numEntities * numBodies);
+    for (int i=0; i<numBodies; i++) {
+        struct CollisionRect rect = {(float)(i * 4000 / numBodies), 100, 40, 80};
+        bodyRects[i] = rect;
+        rectLanesInit(&bodyLanes[i], 1);
+        rectLanesSet(&bodyLanes[i], &bodyRects[i], 1);
+        bodies[i].owner = i % 2 + 1;
+        bodies[i].bounds = &bodyRects[i];
+        bodies[i].lanes = &bodyLanes[i];
+    }
+
+    long mismatches = 0, totalHits = 0;
+    Uint64 sweepTime = 0;
+    for (int frame=0; frame<numFrames; frame++) {
+        while (pool.getNumActive() < numEntities) {
+            float vx = (rand() % 2) ? 3.0f : -3.0f;
+            struct Entity *e = pool.spawn(ENTITY_PROJECTILE, rand() % 2 + 1, rand() % 4000, 60 + rand() % 120, vx, 0, 60 + rand() % 120);
+            e->rect.x = -8;
+            e->rect.y = -8;
+            e->rect.w = 16;
+            e->rect.h = 16;
+        }
+        pool.update();
+
+        Uint64 t0 = nowNanoseconds();
+        int n = pool.collide(bodies, numBodies, hits, numEntities * numBodies);
+        sweepTime += nowNanoseconds() - t0;
+
+        int expected = 0;
+        for (int i=0; i<pool.getNumActive(); i++) {
+            struct Entity *e = pool.getActive(i);
+            struct CollisionRect rect = {e->x + e->rect.x, e->y + e->rect.y, e->rect.w, e->rect.h};
+            for (int b=0; b<numBodies; b++) {
+                if (e->owner != bodies[b].owner && rectCollide(rect, bodyRects[b])) {
+                    expected ++;
+                }
+            }
+        }
+        if (n != expected) {
+            mismatches ++;
+        }
+        totalHits += n;
+        // hit projectiles are gone, as in a game
+        for (int i=0; i<n; i++) {
+            pool.kill(hits[i].entity);
+        }
+    }
+    printf("%d entities, %d bodies, %d frames: %ld hits, %ld mismatched frames\n",
+            numEntities, numBodies, numFrames, totalHits, mismatches);
+    printf("collide %.1f us per frame\n", (double)sweepTime / numFrames / 1000);
+    return mismatches != 0;
+}
+
+#endif
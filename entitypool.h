@@ -0,0 +1,100 @@
+#ifndef _ENTITY_POOL_H_
+#define _ENTITY_POOL_H_
+
+#include <SDL/SDL.h>
+#include "collisiondetect.h"
+
+namespace dragonfighting {
+
+enum EntityType {
+    ENTITY_PROJECTILE,
+    ENTITY_SPARK,
+};
+
+struct Entity {
+    int type;
+    int owner;          // player number, projectiles never hit their owner
+    bool alive;
+    bool swept;         // already in the sweep list
+    float x;
+    float y;
+    float vx;
+    float vy;
+    int life;           // frames left, -1 lives until killed
+    struct CollisionRect rect;  // relative to x, y
+};
+
+// something entities collide with, a player's hit area
+struct CollisionBody {
+    int owner;
+    const struct CollisionRect *bounds;
+    const struct RectLanes *lanes;
+};
+
+struct EntityHit {
+    struct Entity *entity;
+    int body;
+    int rect;           // index in the body's lanes
+};
+
+/*
+ * Fixed capacity pool for projectiles and effects. Entities live in one
+ * array allocated up front, spawn takes a slot from a free list and fails
+ * (counted in getDroppedSpawns) when the pool is full.
+ *
+ * collide() sweeps projectiles and bodies along x. The sweep order is kept
+ * from frame to frame, things move little in a frame, so the insertion
+ * sort that restores it is close to linear; new entries are sorted on
+ * their own and merged in. Projectiles only look at bodies, never at each
+ * other, so the sweep costs the number of entries plus x overlaps with
+ * bodies.
+ */
+class EntityPool
+{
+public:
+    struct SweepEntry {
+        float left;
+        float right;
+        int id;         // entity slot, or capacity + body index
+    };
+
+protected:
+    struct Entity *entities;
+    int capacity;
+    int *freeSlots;
+    int numFree;
+    int *activeSlots;
+    int numActive;
+    struct SweepEntry *sweepList;
+    struct SweepEntry *sweepScratch;
+    int *nextBody;      // per sweep entry, index of the first body after it
+    int sweepSize;
+    int sweptBodies;
+    int bodyRoom;
+    unsigned long droppedSpawns;
+
+    void updateSweepList(const struct CollisionBody *bodies, int numBodies);
+    bool testPair(const struct CollisionBody *bodies, int slot, int body, int *rect);
+
+public:
+    EntityPool(int capacity);
+    ~EntityPool();
+
+    // NULL when the pool is full
+    struct Entity *spawn(int type, int owner, float x, float y, float vx, float vy, int life);
+    // the slot is freed by the next update()
+    void kill(struct Entity *entity);
+    void clear();
+    // move, age and free dead entities, once a frame
+    void update();
+    // projectile against body overlaps, returns how many were written to hits
+    int collide(const struct CollisionBody *bodies, int numBodies, struct EntityHit *hits, int maxHits);
+
+    int getNumActive();
+    struct Entity *getActive(int i);
+    unsigned long getDroppedSpawns();
+};
+
+}
+
+#endif
@@ -26,6 +26,11 @@ void HealthBar::setGeometry(int x, int y, int w, int h)
     this->geometry2 = {(Sint16)(x+1), (Sint16)(y+1), (Uint16)(w-2), (Uint16)(h-2)};
 }
 
+SDL_Rect HealthBar::getGeometry()
+{
+    return geometry;
+}
+
 void HealthBar::setMax(int max)
 {
     this->max = max;
@@ -36,7 +41,7 @@ void HealthBar::setCurrent(int current)
     this->current = current;
 }
 
-void HealthBar::draw(SDL_Surface *dst)
+void HealthBar::render(RenderList *list)
 {
     if (max == 0) {
         return;
@@ -51,9 +56,9 @@ void HealthBar::draw(SDL_Surface *dst)
         r1 = {(Sint16)(geometry2.x+geometry2.w-width), (Sint16)(geometry2.y), (Uint16)(width), (Uint16)(geometry2.h)};
         r2 = {(Sint16)(geometry2.x), (Sint16)(geometry2.y), (Uint16)(geometry2.w-width), (Uint16)(geometry2.h)};
     }
-    SDL_FillRect(dst, &geometry, SDL_MapRGB(dst->format, 213, 213, 213));
-    SDL_FillRect(dst, &r1, SDL_MapRGB(dst->format, 255, 240, 0));
-    SDL_FillRect(dst, &r2, SDL_MapRGB(dst->format, 194, 0, 22));
+    list->fill(geometry, 213, 213, 213);
+    list->fill(r1, 255, 240, 0);
+    list->fill(r2, 194, 0, 22);
 
 }
 
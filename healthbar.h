@@ -19,9 +19,10 @@ class HealthBar : public Widget
         virtual ~HealthBar();
         void setLeftToRight(bool leftToRight);
         void setGeometry(int x, int y, int w, int h);
+        SDL_Rect getGeometry();
         void setMax(int max);
         void setCurrent(int current);
-        virtual void draw(SDL_Surface *dst);
+        virtual void render(RenderList *list);
         virtual void update(Uint32 frameStamp);
 };
 
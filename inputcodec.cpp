@@ -0,0 +1,457 @@
+#include <string.h>
+#include <assert.h>
+#include "inputcodec.h"
+
+namespace dragonfighting {
+
+enum {
+    CTX_STATE,
+    CTX_LENGTH,
+    CTX_NUM,
+};
+
+static void putVarint(vector<unsigned char> &out, Uint32 value)
+{
+    while (value >= 0x80) {
+        out.push_back((unsigned char)(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back((unsigned char)value);
+}
+
+static bool getVarint(const unsigned char *data, size_t length, size_t &pos, Uint32 &value)
+{
+    value = 0;
+    for (int shift = 0; shift < 35; shift += 7) {
+        if (pos >= length) {
+            return false;
+        }
+        unsigned char byte = data[pos++];
+        value |= (Uint32)(byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * Adaptive order-0 model and carryless range coder (Subbotin).
+ * One model per context: state deltas and run length bytes have very
+ * different distributions.
+ */
+struct AdaptiveModel
+{
+    static const Uint32 MAX_TOTAL = 1 << 16;
+    static const Uint32 INCREMENT = 24;
+    Uint32 freq[256];
+    Uint32 total;
+
+    AdaptiveModel()
+    {
+        for (int i=0; i<256; i++) {
+            freq[i] = 1;
+        }
+        total = 256;
+    }
+
+    Uint32 cumFreq(int symbol)
+    {
+        Uint32 cum = 0;
+        for (int i=0; i<symbol; i++) {
+            cum += freq[i];
+        }
+        return cum;
+    }
+
+    void update(int symbol)
+    {
+        freq[symbol] += INCREMENT;
+        total += INCREMENT;
+        if (total > MAX_TOTAL) {
+            total = 0;
+            for (int i=0; i<256; i++) {
+                freq[i] = (freq[i] + 1) / 2;
+                total += freq[i];
+            }
+        }
+    }
+};
+
+static const Uint32 RANGE_TOP = 1 << 24;
+static const Uint32 RANGE_BOT = 1 << 16;
+
+class RangeEncoder
+{
+    vector<unsigned char> &out;
+    Uint32 low;
+    Uint32 range;
+    AdaptiveModel models[CTX_NUM];
+
+public:
+    RangeEncoder(vector<unsigned char> &out) : out(out), low(0), range(0xFFFFFFFF) {}
+
+    void put(int ctx, unsigned char symbol)
+    {
+        AdaptiveModel &m = models[ctx];
+        range /= m.total;
+        low += m.cumFreq(symbol) * range;
+        range *= m.freq[symbol];
+        while ((low ^ (low + range)) < RANGE_TOP || (range < RANGE_BOT && ((range = -low & (RANGE_BOT - 1)), true))) {
+            out.push_back((unsigned char)(low >> 24));
+            low <<= 8;
+            range <<= 8;
+        }
+        m.update(symbol);
+    }
+
+    void flush()
+    {
+        for (int i=0; i<4; i++) {
+            out.push_back((unsigned char)(low >> 24));
+            low <<= 8;
+        }
+    }
+};
+
+class RangeDecoder
+{
+    const unsigned char *data;
+    size_t length;
+    size_t pos;
+    Uint32 low;
+    Uint32 range;
+    Uint32 code;
+    AdaptiveModel models[CTX_NUM];
+
+    unsigned char next()
+    {
+        return pos < length ? data[pos++] : 0;
+    }
+
+public:
+    RangeDecoder(const unsigned char *data, size_t length) :
+        data(data), length(length), pos(0), low(0), range(0xFFFFFFFF), code(0)
+    {
+        for (int i=0; i<4; i++) {
+            code = (code << 8) | next();
+        }
+    }
+
+    bool get(int ctx, unsigned char &symbol)
+    {
+        AdaptiveModel &m = models[ctx];
+        range /= m.total;
+        Uint32 target = (code - low) / range;
+        if (target >= m.total) {
+            return false;
+        }
+        int s = 0;
+        Uint32 cum = 0;
+        while (cum + m.freq[s] <= target) {
+            cum += m.freq[s];
+            s++;
+        }
+        low += cum * range;
+        range *= m.freq[s];
+        while ((low ^ (low + range)) < RANGE_TOP || (range < RANGE_BOT && ((range = -low & (RANGE_BOT - 1)), true))) {
+            code = (code << 8) | next();
+            low <<= 8;
+            range <<= 8;
+        }
+        m.update(s);
+        symbol = (unsigned char)s;
+        return true;
+    }
+};
+
+// plain byte stream, same interface as the range decoder
+class RawDecoder
+{
+    const unsigned char *data;
+    size_t length;
+    size_t pos;
+
+public:
+    RawDecoder(const unsigned char *data, size_t length) : data(data), length(length), pos(0) {}
+
+    bool get(int ctx, unsigned char &symbol)
+    {
+        if (pos >= length) {
+            return false;
+        }
+        symbol = data[pos++];
+        return true;
+    }
+};
+
+template <class Decoder>
+static bool decodeRuns(Decoder &decoder, Uint32 numFrames, vector<unsigned char> &states)
+{
+    unsigned char state = 0;
+    Uint32 frames = 0;
+    while (frames < numFrames) {
+        unsigned char delta;
+        if (!decoder.get(CTX_STATE, delta)) {
+            return false;
+        }
+        state ^= delta;
+
+        Uint32 run = 0;
+        int shift = 0;
+        unsigned char byte;
+        do {
+            if (shift >= 35 || !decoder.get(CTX_LENGTH, byte)) {
+                return false;
+            }
+            run |= (Uint32)(byte & 0x7F) << shift;
+            shift += 7;
+        } while (byte & 0x80);
+        run += 1;
+
+        if (run > numFrames - frames) {
+            return false;
+        }
+        states.insert(states.end(), run, state);
+        frames += run;
+    }
+    return true;
+}
+
+void InputCodec::eventsToFrames(const struct Ctrl_KeyEvent *events, size_t count, char controler,
+        Uint32 firstFrame, Uint32 numFrames, unsigned char *states, unsigned char initialState)
+{
+    unsigned char state = initialState;
+    size_t e = 0;
+    for (Uint32 f=0; f<numFrames; f++) {
+        // events of the same frame apply in order, like Character::update
+        while (e < count && events[e].frameStamp <= firstFrame + f) {
+            const struct Ctrl_KeyEvent *ev = &events[e++];
+            if (ev->controler != controler || ev->key == 0 || ev->key > CTRLKEY_D) {
+                continue;
+            }
+            unsigned char bit = 1 << (ev->key - 1);
+            if (ev->type == Ctrl_KEYDOWN) {
+                state |= bit;
+            } else if (ev->type == Ctrl_KEYUP) {
+                state &= ~bit;
+            }
+        }
+        states[f] = state;
+    }
+}
+
+void InputCodec::framesToEvents(const unsigned char *states, Uint32 numFrames, Uint32 firstFrame,
+        char controler, vector<struct Ctrl_KeyEvent> &events, unsigned char initialState)
+{
+    unsigned char prev = initialState;
+    for (Uint32 f=0; f<numFrames; f++) {
+        unsigned char changed = prev ^ states[f];
+        for (unsigned char key = CTRLKEY_UP; changed != 0 && key <= CTRLKEY_D; key++) {
+            unsigned char bit = 1 << (key - 1);
+            if (changed & bit) {
+                struct Ctrl_KeyEvent ev;
+                ev.controler = controler;
+                ev.type = (states[f] & bit) ? Ctrl_KEYDOWN : Ctrl_KEYUP;
+                ev.key = key;
+                ev.frameStamp = firstFrame + f;
+                events.push_back(ev);
+                changed &= ~bit;
+            }
+        }
+        prev = states[f];
+    }
+}
+
+void InputCodec::encode(const unsigned char *states, Uint32 numFrames, bool entropy, vector<unsigned char> &out)
+{
+    vector<unsigned char> runs;
+    unsigned char prev = 0;
+    Uint32 f = 0;
+    while (f < numFrames) {
+        Uint32 run = 1;
+        while (f + run < numFrames && states[f + run] == states[f]) {
+            run++;
+        }
+        runs.push_back(states[f] ^ prev);
+        putVarint(runs, run - 1);
+        prev = states[f];
+        f += run;
+    }
+
+    vector<unsigned char> payload;
+    if (entropy) {
+        RangeEncoder encoder(payload);
+        // re-walk the run stream so each byte is coded in its context
+        size_t pos = 0;
+        while (pos < runs.size()) {
+            encoder.put(CTX_STATE, runs[pos++]);
+            do {
+                encoder.put(CTX_LENGTH, runs[pos]);
+            } while (runs[pos++] & 0x80);
+        }
+        encoder.flush();
+    } else {
+        payload.swap(runs);
+    }
+
+    out.push_back(entropy ? FLAG_ENTROPY : 0);
+    putVarint(out, numFrames);
+    putVarint(out, payload.size());
+    out.insert(out.end(), payload.begin(), payload.end());
+}
+
+size_t InputCodec::decode(const unsigned char *data, size_t length, vector<unsigned char> &states)
+{
+    size_t pos = 0;
+    Uint32 numFrames = 0;
+    Uint32 payloadLength = 0;
+
+    if (length < 1) {
+        return 0;
+    }
+    unsigned char flags = data[pos++];
+    if (!getVarint(data, length, pos, numFrames) || !getVarint(data, length, pos, payloadLength)) {
+        return 0;
+    }
+    if (payloadLength > length - pos) {
+        return 0;
+    }
+
+    bool ok;
+    states.reserve(states.size() + numFrames);
+    if (flags & FLAG_ENTROPY) {
+        RangeDecoder decoder(data + pos, payloadLength);
+        ok = decodeRuns(decoder, numFrames, states);
+    } else {
+        RawDecoder decoder(data + pos, payloadLength);
+        ok = decodeRuns(decoder, numFrames, states);
+    }
+    if (!ok) {
+        return 0;
+    }
+    return pos + payloadLength;
+}
+
+}
+
+
+#ifdef FTG_TEST
+
+#include <stdlib.h>
+#include <time.h>
+
+using namespace dragonfighting;
+
+// Synthetic match input: long held directions, idle stretches, some
+// motion inputs and button presses.
+static void generateMatch(unsigned char *states, Uint32 numFrames, unsigned int seed)
+{
+    const unsigned char UP = 1 << (CTRLKEY_UP - 1);
+    const unsigned char DOWN = 1 << (CTRLKEY_DOWN - 1);
+    const unsigned char FORWARD = 1 << (CTRLKEY_RIGHT - 1);
+    const unsigned char BACK = 1 << (CTRLKEY_LEFT - 1);
+    const unsigned char A = 1 << (CTRLKEY_A - 1);
+    const unsigned char B = 1 << (CTRLKEY_B - 1);
+    const unsigned char motion236A[] = {DOWN, DOWN | FORWARD, FORWARD, FORWARD | A};
+
+    srand(seed);
+    Uint32 f = 0;
+    while (f < numFrames) {
+        int action = rand() % 10;
+        Uint32 len = 0;
+        unsigned char state = 0;
+        if (action < 3) {
+            len = 30 + rand() % 90;     // idle
+        } else if (action < 6) {
+            len = 10 + rand() % 60;     // walk
+            state = (action == 3) ? BACK : FORWARD;
+        } else if (action < 7) {
+            len = 20 + rand() % 30;     // crouch/jump
+            state = (rand() % 2) ? DOWN : UP;
+        } else if (action < 9) {
+            len = 4 + rand() % 8;       // button tap
+            state = (rand() % 2) ? A : B;
+        } else {
+            for (int i=0; i<4 && f<numFrames; i++) {
+                for (int j=0; j<3 && f<numFrames; j++) {
+                    states[f++] = motion236A[i];
+                }
+            }
+            continue;
+        }
+        for (Uint32 i=0; i<len && f<numFrames; i++) {
+            states[f++] = state;
+        }
+    }
+}
+
+static double nowSeconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv)
+{
+    const Uint32 FRAMES_PER_MINUTE = 60 * 60;
+    const Uint32 MINUTES = 10;
+    const Uint32 numFrames = FRAMES_PER_MINUTE * MINUTES;
+    const int ITERATIONS = 200;
+
+    unsigned char *states = (unsigned char *)malloc(numFrames);
+    generateMatch(states, numFrames, 1);
+
+    vector<struct Ctrl_KeyEvent> events;
+    InputCodec::framesToEvents(states, numFrames, 0, 1, events);
+
+    printf("%u minutes of synthetic input, %lu key events\n", MINUTES, (unsigned long)events.size());
+    printf("%-12s %14s %14s %14s\n", "codec", "bytes/minute", "encode MB/s", "decode MB/s");
+    printf("%-12s %14.1f %14s %14s\n", "events", (double)events.size() * sizeof(struct Ctrl_KeyEvent) / MINUTES, "-", "-");
+    printf("%-12s %14.1f %14s %14s\n", "frames", (double)FRAMES_PER_MINUTE, "-", "-");
+
+    for (int entropy = 0; entropy <= 1; entropy++) {
+        vector<unsigned char> encoded;
+        vector<unsigned char> decoded;
+
+        double t0 = nowSeconds();
+        for (int i=0; i<ITERATIONS; i++) {
+            encoded.clear();
+            InputCodec::encode(states, numFrames, entropy, encoded);
+        }
+        double t1 = nowSeconds();
+        for (int i=0; i<ITERATIONS; i++) {
+            decoded.clear();
+            if (InputCodec::decode(&encoded[0], encoded.size(), decoded) != encoded.size()) {
+                printf("decode failed\n");
+                return 1;
+            }
+        }
+        double t2 = nowSeconds();
+
+        if (decoded.size() != numFrames || memcmp(&decoded[0], states, numFrames) != 0) {
+            printf("round trip mismatch\n");
+            return 1;
+        }
+
+        // throughput is measured on the raw per-frame state bytes
+        double mb = (double)numFrames * ITERATIONS / (1024 * 1024);
+        printf("%-12s %14.1f %14.1f %14.1f\n", entropy ? "rle+range" : "rle",
+                (double)encoded.size() / MINUTES, mb / (t1 - t0), mb / (t2 - t1));
+    }
+
+    // events -> frames must reproduce the same states
+    unsigned char *replayed = (unsigned char *)malloc(numFrames);
+    InputCodec::eventsToFrames(&events[0], events.size(), 1, 0, numFrames, replayed);
+    if (memcmp(replayed, states, numFrames) != 0) {
+        printf("event round trip mismatch\n");
+        return 1;
+    }
+
+    free(replayed);
+    free(states);
+    return 0;
+}
+
+#endif
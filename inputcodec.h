@@ -0,0 +1,44 @@
+#ifndef _INPUT_CODEC_H_
+#define _INPUT_CODEC_H_
+
+#include <vector>
+#include <SDL/SDL.h>
+#include "keystream.h"
+
+using std::vector;
+
+namespace dragonfighting {
+
+/**
+ * Codec for per-frame controller states.
+ *
+ * A controller state is one byte per frame, bit (ctrlkey - 1) set while
+ * CTRLKEY_UP..CTRLKEY_D is held. Input streams are mostly long runs of the
+ * same state, so a stream is stored as runs: the state XOR the previous one
+ * followed by a varint run length. The run stream can optionally be passed
+ * through an adaptive range coder.
+ *
+ * Encoded layout: flags byte, varint frame count, varint payload length,
+ * payload.
+ */
+class InputCodec
+{
+public:
+    static const unsigned char FLAG_ENTROPY = 0x01;
+
+    // Ctrl_KeyEvent stream <-> per-frame states of one controler.
+    // initialState is the state held before firstFrame.
+    static void eventsToFrames(const struct Ctrl_KeyEvent *events, size_t count, char controler,
+            Uint32 firstFrame, Uint32 numFrames, unsigned char *states /*out*/, unsigned char initialState = 0);
+    static void framesToEvents(const unsigned char *states, Uint32 numFrames, Uint32 firstFrame,
+            char controler, vector<struct Ctrl_KeyEvent> &events /*out, appended*/, unsigned char initialState = 0);
+
+    static void encode(const unsigned char *states, Uint32 numFrames, bool entropy,
+            vector<unsigned char> &out /*out, appended*/);
+    // return the number of bytes consumed, 0 if data is corrupt
+    static size_t decode(const unsigned char *data, size_t length, vector<unsigned char> &states /*out*/);
+};
+
+}
+
+#endif
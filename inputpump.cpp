@@ -0,0 +1,71 @@
+#include <assert.h>
+#include "inputpump.h"
+
+namespace dragonfighting {
+
+InputPump::InputPump(SDLKeyConverter *converter) :
+    converter(converter),
+    writer(NULL),
+    controler(1),
+    trace(NULL),
+    tracePlayer(1),
+    quit(false)
+{
+    assert(converter != NULL);
+}
+
+InputPump::~InputPump()
+{
+}
+
+void InputPump::setWriter(CtrlKeyWriter *writer, char controler)
+{
+    this->writer = writer;
+    this->controler = controler;
+}
+
+void InputPump::setTrace(InputTrace *trace, int player)
+{
+    this->trace = trace;
+    this->tracePlayer = player;
+}
+
+int InputPump::pump(Uint32 frame, struct Ctrl_KeyEvent *events, int maxEvents)
+{
+    assert(writer != NULL);
+    int count = 0;
+    SDL_Event event;
+
+    while (count < maxEvents && SDL_PollEvent(&event) == 1) {
+        Uint64 polltime = InputTrace::now();
+        if ((event.type == SDL_KEYDOWN && event.key.keysym.sym == SDLK_ESCAPE) || event.type == SDL_QUIT) {
+            quit = true;
+            continue;
+        }
+        if (event.type != SDL_KEYDOWN && event.type != SDL_KEYUP) {
+            continue;
+        }
+
+        struct Ctrl_KeyEvent *ctrlevent = &events[count];
+        ctrlevent->key = converter->convert(event.key.keysym.sym);
+        if (ctrlevent->key == 0) {
+            continue;
+        }
+        ctrlevent->type = (event.type == SDL_KEYDOWN) ? Ctrl_KEYDOWN : Ctrl_KEYUP;
+        ctrlevent->controler = controler;
+        ctrlevent->frameStamp = frame;
+        writer->writeEvent(ctrlevent);
+        if (trace != NULL) {
+            trace->recordEvent(&event, polltime, tracePlayer, ctrlevent->key, frame);
+        }
+        count ++;
+    }
+    return count;
+}
+
+bool InputPump::quitRequested()
+{
+    return quit;
+}
+
+}
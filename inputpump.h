@@ -0,0 +1,42 @@
+#ifndef _INPUT_PUMP_H_
+#define _INPUT_PUMP_H_
+
+#include <SDL/SDL.h>
+#include "keystream.h"
+#include "inputtrace.h"
+
+namespace dragonfighting {
+
+/*
+ * Drains the SDL event queue once per tick. Every pending key event is
+ * converted, stamped with the current frame and written at once, so a
+ * motion plus button typed faster than the frame rate is not spread
+ * over several frames.
+ */
+class InputPump
+{
+protected:
+    SDLKeyConverter *converter;
+    CtrlKeyWriter *writer;
+    char controler;
+    InputTrace *trace;
+    int tracePlayer;
+    bool quit;
+
+public:
+    InputPump(SDLKeyConverter *converter);
+    ~InputPump();
+
+    void setWriter(CtrlKeyWriter *writer, char controler);
+    void setTrace(InputTrace *trace, int player);
+
+    // poll all pending SDL events, at most maxEvents key events are taken
+    // (copied to events) and the rest stays queued for the next tick
+    int pump(Uint32 frame, struct Ctrl_KeyEvent *events, int maxEvents);
+    // escape or window closed
+    bool quitRequested();
+};
+
+}
+
+#endif
@@ -0,0 +1,240 @@
+#include <string.h>
+#include <time.h>
+#include <assert.h>
+#include <algorithm>
+#include "inputtrace.h"
+
+namespace dragonfighting {
+
+InputLatencyStats::InputLatencyStats() :
+    numEvents(0),
+    numNoEffect(0),
+    maxEffect(0),
+    maxPresent(0)
+{
+    memset(effectMsec, 0, sizeof(effectMsec));
+    memset(presentMsec, 0, sizeof(presentMsec));
+    memset(frames, 0, sizeof(frames));
+}
+
+void InputLatencyStats::add(const struct InputTraceRecord *record)
+{
+    numEvents ++;
+    if (record->effectFrame == INPUT_TRACE_NO_EFFECT) {
+        numNoEffect ++;
+        return;
+    }
+    double effect = (record->effectTime - record->pollTime) / 1e6;
+    effectMsec[std::min((int)effect, (int)MSEC_BUCKETS)] ++;
+    maxEffect = std::max(maxEffect, effect);
+    frames[std::min(record->effectFrame - record->consumedFrame, (Uint32)FRAME_BUCKETS)] ++;
+    if (record->presentTime != 0) {
+        double present = (record->presentTime - record->pollTime) / 1e6;
+        presentMsec[std::min((int)present, (int)MSEC_BUCKETS)] ++;
+        maxPresent = std::max(maxPresent, present);
+    }
+}
+
+void InputLatencyStats::printHistogram(FILE *fp, const char *title, const unsigned long *histogram, int buckets, const char *unit)
+{
+    unsigned long total = 0;
+    for (int i=0; i<=buckets; i++) {
+        total += histogram[i];
+    }
+    fprintf(fp, "%s:\n", title);
+    if (total == 0) {
+        fprintf(fp, "  no samples\n");
+        return;
+    }
+
+    // percentiles at bucket resolution
+    const int percents[] = {50, 90, 99};
+    unsigned long seen = 0;
+    size_t next = 0;
+    fprintf(fp, " ");
+    for (int i=0; i<=buckets && next < sizeof(percents)/sizeof(percents[0]); i++) {
+        seen += histogram[i];
+        while (next < sizeof(percents)/sizeof(percents[0]) && seen * 100 >= total * percents[next]) {
+            fprintf(fp, " p%d %s%d %s", percents[next], i == buckets ? ">=" : "<", i == buckets ? i : i + 1, unit);
+            next ++;
+        }
+    }
+    fprintf(fp, "\n");
+
+    for (int i=0; i<=buckets; i++) {
+        if (histogram[i] == 0) {
+            continue;
+        }
+        fprintf(fp, "  %3d%s %-6s %6lu ", i, i == buckets ? "+" : " ", unit, histogram[i]);
+        for (unsigned long j=0; j<histogram[i] * 60 / total; j++) {
+            fprintf(fp, "#");
+        }
+        fprintf(fp, "\n");
+    }
+}
+
+void InputLatencyStats::print(FILE *fp)
+{
+    fprintf(fp, "%lu events, %lu without visible effect\n", numEvents, numNoEffect);
+    printHistogram(fp, "poll -> state change", effectMsec, MSEC_BUCKETS, "ms");
+    fprintf(fp, "  max %.2f ms\n", maxEffect);
+    printHistogram(fp, "poll -> SDL_Flip returned", presentMsec, MSEC_BUCKETS, "ms");
+    fprintf(fp, "  max %.2f ms\n", maxPresent);
+    printHistogram(fp, "consume -> state change", frames, FRAME_BUCKETS, "frames");
+}
+
+
+InputTrace::InputTrace(AsyncWriter *writer) :
+    writer(writer),
+    stats()
+{
+    numPending[0] = 0;
+    numPending[1] = 0;
+    numEffective[0] = 0;
+    numEffective[1] = 0;
+}
+
+InputTrace::~InputTrace()
+{
+    finish();
+}
+
+void InputTrace::finish()
+{
+    // whatever is left was never presented
+    for (int player = 1; player <= 2; player++) {
+        if (numPending[player - 1] > 0) {
+            flush(player, numPending[player - 1]);
+        }
+    }
+}
+
+Uint64 InputTrace::now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (Uint64)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// write the first count pending records of player and drop them
+void InputTrace::flush(int player, int count)
+{
+    struct InputTraceRecord *records = pending[player - 1];
+    for (int i=0; i<count; i++) {
+        stats.add(&records[i]);
+    }
+    if (writer != NULL) {
+        writer->writeRecord(records, sizeof(struct InputTraceRecord) * count);
+    }
+    numPending[player - 1] -= count;
+    numEffective[player - 1] = std::max(numEffective[player - 1] - count, 0);
+    memmove(records, records + count, sizeof(struct InputTraceRecord) * numPending[player - 1]);
+}
+
+void InputTrace::recordEvent(const SDL_Event *event, Uint64 pollTime, int player, unsigned char ctrlKey, Uint32 consumedFrame)
+{
+    assert(player == 1 || player == 2);
+    if (numPending[player - 1] == MAX_PENDING) {
+        // a long burst of keys, give up waiting on the oldest
+        if (numEffective[player - 1] == 0) {
+            pending[player - 1][0].effectFrame = INPUT_TRACE_NO_EFFECT;
+            pending[player - 1][0].effectTime = 0;
+        }
+        pending[player - 1][0].presentTime = 0;
+        flush(player, 1);
+    }
+
+    struct InputTraceRecord *record = &pending[player - 1][numPending[player - 1]++];
+    memset(record, 0, sizeof(*record));
+    record->pollTime = pollTime;
+    record->consumedFrame = consumedFrame;
+    record->effectFrame = INPUT_TRACE_NO_EFFECT;
+    record->sdlKey = event->key.keysym.sym;
+    record->sdlType = event->type;
+    record->player = player;
+    record->ctrlKey = ctrlKey;
+}
+
+void InputTrace::stateChanged(int player, Uint32 frame)
+{
+    assert(player == 1 || player == 2);
+    struct InputTraceRecord *records = pending[player - 1];
+    int count = numEffective[player - 1];
+    Uint64 t = now();
+    while (count < numPending[player - 1] && records[count].consumedFrame <= frame) {
+        records[count].effectFrame = frame;
+        records[count].effectTime = t;
+        count ++;
+    }
+    // written once the frame is on screen
+    numEffective[player - 1] = count;
+}
+
+void InputTrace::endFrame(Uint32 frame)
+{
+    for (int player = 1; player <= 2; player++) {
+        struct InputTraceRecord *records = pending[player - 1];
+        int count = 0;
+        while (count < numPending[player - 1] && records[count].effectFrame == INPUT_TRACE_NO_EFFECT
+                && records[count].consumedFrame + EXPIRE_FRAMES < frame) {
+            count ++;
+        }
+        if (count > 0) {
+            flush(player, count);
+        }
+    }
+}
+
+void InputTrace::framePresented(Uint32 frame)
+{
+    Uint64 t = now();
+    for (int player = 1; player <= 2; player++) {
+        struct InputTraceRecord *records = pending[player - 1];
+        int count = 0;
+        while (count < numEffective[player - 1] && records[count].effectFrame <= frame) {
+            records[count].presentTime = t;
+            count ++;
+        }
+        if (count > 0) {
+            flush(player, count);
+        }
+    }
+}
+
+InputLatencyStats *InputTrace::getStats()
+{
+    return &stats;
+}
+
+}
+
+
+#ifdef FTG_TEST
+
+using namespace dragonfighting;
+
+// Summarize a trace written with --trace-input
+int main(int argc, char **argv)
+{
+    if (argc < 2) {
+        printf("usage: %s <tracefile>\n", argv[0]);
+        return 1;
+    }
+    FILE *fp = fopen(argv[1], "rb");
+    if (fp == NULL) {
+        printf("Unable to open %s\n", argv[1]);
+        return 1;
+    }
+
+    InputLatencyStats stats;
+    struct InputTraceRecord record;
+    while (fread(&record, sizeof(record), 1, fp) == 1) {
+        stats.add(&record);
+    }
+    fclose(fp);
+
+    stats.print(stdout);
+    return 0;
+}
+
+#endif
@@ -0,0 +1,94 @@
+#ifndef _INPUT_TRACE_H_
+#define _INPUT_TRACE_H_
+
+#include <stdio.h>
+#include <SDL/SDL.h>
+#include "asyncwriter.h"
+
+namespace dragonfighting {
+
+const Uint32 INPUT_TRACE_NO_EFFECT = 0xFFFFFFFF;
+
+/*
+ * One raw SDL key event and when the simulation reacted to it.
+ * Written when the frame showing the effect was presented, or after
+ * InputTrace::EXPIRE_FRAMES with effectFrame = INPUT_TRACE_NO_EFFECT.
+ */
+struct InputTraceRecord {
+    Uint64 pollTime;        // monotonic nsec, right after SDL_PollEvent returned it
+    Uint64 effectTime;      // monotonic nsec, end of the simulation step of effectFrame
+    Uint64 presentTime;     // monotonic nsec, SDL_Flip of effectFrame returned
+    Uint32 consumedFrame;   // frame the event was fed to Character::update
+    Uint32 effectFrame;     // first frame Character::state changed after that
+    Uint16 sdlKey;
+    Uint8 sdlType;          // SDL_KEYDOWN or SDL_KEYUP
+    Uint8 player;           // 1 or 2
+    Uint8 ctrlKey;
+    Uint8 reserved[3];
+};
+
+/*
+ * Histograms of input latency, in msec (1 msec buckets) and in frames.
+ * Fed by InputTrace in game, or from a trace file offline.
+ */
+class InputLatencyStats
+{
+public:
+    static const int MSEC_BUCKETS = 100;
+    static const int FRAME_BUCKETS = 16;
+
+protected:
+    unsigned long effectMsec[MSEC_BUCKETS + 1];     // poll -> state change
+    unsigned long presentMsec[MSEC_BUCKETS + 1];    // poll -> SDL_Flip returned
+    unsigned long frames[FRAME_BUCKETS + 1];        // consumed -> state change
+    unsigned long numEvents;
+    unsigned long numNoEffect;
+    double maxEffect;
+    double maxPresent;
+
+    void printHistogram(FILE *fp, const char *title, const unsigned long *histogram, int buckets, const char *unit);
+
+public:
+    InputLatencyStats();
+
+    void add(const struct InputTraceRecord *record);
+    void print(FILE *fp);
+};
+
+class InputTrace
+{
+public:
+    static const int MAX_PENDING = 32;
+    static const Uint32 EXPIRE_FRAMES = 120;
+
+protected:
+    AsyncWriter *writer;
+    InputLatencyStats stats;
+    struct InputTraceRecord pending[2][MAX_PENDING];
+    int numPending[2];
+    int numEffective[2];   // pending records with an effect, waiting for the flip
+
+    void flush(int player, int count);
+
+public:
+    // writer may be NULL to only keep the statistics
+    InputTrace(AsyncWriter *writer);
+    ~InputTrace();
+
+    static Uint64 now();
+
+    void recordEvent(const SDL_Event *event, Uint64 pollTime, int player, unsigned char ctrlKey, Uint32 consumedFrame);
+    // call after the simulation step of frame
+    void stateChanged(int player, Uint32 frame);
+    void endFrame(Uint32 frame);
+    // call when SDL_Flip showing frame returned
+    void framePresented(Uint32 frame);
+    // write out everything still pending
+    void finish();
+
+    InputLatencyStats *getStats();
+};
+
+}
+
+#endif
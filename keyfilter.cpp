@@ -1,10 +1,12 @@
 #include <assert.h>
+#include <algorithm>
 #include "keyfilter.h"
 #include "ftgkeys.h"
+#include "logger.h"
 
 namespace dragonfighting {
 
-Command::Command(const char *name, const unsigned char *cmd, size_t length)
+Command::Command(const char *name, const unsigned char *cmd, size_t length, int id)
 {
     assert(length <= 16);
     unsigned int i=0;
@@ -16,6 +18,7 @@ Command::Command(const char *name, const unsigned char *cmd, size_t length)
         this->ftgKeyArray[i] = cmd[i];
     }
     this->length = length;
+    this->id = id;
 }
 
 static bool commandCompare(Command *c1, Command *c2)
@@ -28,157 +31,326 @@ static bool commandCompare(Command *c1, Command *c2)
     }
 }
 
-KeyFilter::KeyFilter() :
-    commandTable(),
-    ftgKeyCurIndex(0),
-    ftgKeyPreIndex(sizeof(ftgKeyStateBuffer) - 1),
-    beginIndex(0)
+static inline int prevIndex(int index)
 {
-    memset(ftgKeyStateBuffer, 0, sizeof(ftgKeyStateBuffer));
-    memset(curCommandName, 0, sizeof(curCommandName));
+    return (index + KEY_BUFFER_LEN - 1) % KEY_BUFFER_LEN;
 }
 
-KeyFilter::~KeyFilter()
+CommandTable::CommandTable() :
+    commands(),
+    commandsById(),
+    nodes(),
+    compiled(false)
 {
-    for (list<Command*>::iterator i = commandTable.begin(); i != commandTable.end(); ++i ){
+}
+
+CommandTable::~CommandTable()
+{
+    for (vector<Command*>::iterator i = commands.begin(); i != commands.end(); ++i ){
         delete *i;
     }
 }
 
-void KeyFilter::addCommand(const char *name, const unsigned char *cmd, size_t length)
+int CommandTable::addCommand(const char *name, const unsigned char *cmd, size_t length)
 {
     if (length < 2) {
         throw "command length must at lest 2";
     }
-    Command *command = new Command(name, cmd, length);
-    commandTable.push_back(command);
-    commandTable.sort(commandCompare);
-
-    //debug
-    /*
-    for (list<Command*>::iterator i = commandTable.begin(); i != commandTable.end(); ++i ){
-        printf("%s\n", (*i)->name);
+    if (length > sizeof(((Command *)NULL)->ftgKeyArray)) {
+        throw "command too long";
     }
-    printf("--------------\n");
-    */
+    Command *command = new Command(name, cmd, length, commandsById.size());
+    commands.push_back(command);
+    commandsById.push_back(command);
+    compiled = false;
+    return command->id;
 }
 
-void KeyFilter::updateKeys(unsigned char currentFtgKeyState)
+int CommandTable::newNode(unsigned char ftgkey)
 {
-    // save key in buffer
-    if (ftgKeyStateBuffer[ftgKeyCurIndex].ftgkey == currentFtgKeyState) {
-        ftgKeyStateBuffer[ftgKeyCurIndex].numFrames += 1;
-    } else {
-        ftgKeyPreIndex = ftgKeyCurIndex;
-        ftgKeyCurIndex = (ftgKeyCurIndex + 1) % KEY_BUFFER_LEN;
-        ftgKeyStateBuffer[ftgKeyCurIndex].ftgkey = currentFtgKeyState;
-        ftgKeyStateBuffer[ftgKeyCurIndex].numFrames = 1;
+    struct TrieNode node;
+    node.ftgkey = ftgkey;
+    node.command = -1;
+    node.bestRank = commands.size();
+    node.firstChild = -1;
+    node.nextSibling = -1;
+    nodes.push_back(node);
+    return nodes.size() - 1;
+}
+
+void CommandTable::compile()
+{
+    // the rank of a command is its position in this order, the lowest rank wins
+    std::stable_sort(commands.begin(), commands.end(), commandCompare);
+
+    nodes.clear();
+    newNode(0); // root
+    for (size_t rank=0; rank<commands.size(); rank++) {
+        Command *command = commands[rank];
+        int node = 0;
+        for (int j=command->length-1; j>=0; j--) {
+            if (nodes[node].bestRank > (int)rank) {
+                nodes[node].bestRank = rank;
+            }
+            int child;
+            for (child = nodes[node].firstChild; child != -1; child = nodes[child].nextSibling) {
+                if (nodes[child].ftgkey == command->ftgKeyArray[j]) {
+                    break;
+                }
+            }
+            if (child == -1) {
+                child = newNode(command->ftgKeyArray[j]);
+                nodes[child].nextSibling = nodes[node].firstChild;
+                nodes[node].firstChild = child;
+            }
+            node = child;
+        }
+        if (nodes[node].bestRank > (int)rank) {
+            nodes[node].bestRank = rank;
+        }
+        // the same keys twice: the first one shadows the second, as it always did
+        if (nodes[node].command == -1) {
+            nodes[node].command = rank;
+        }
     }
+    compiled = true;
+}
 
-    // if not a 'command end', skip parse
-    // A 'command end' is: current is a button key and pre is not the same button key
-    if ((ftgKeyStateBuffer[ftgKeyCurIndex].ftgkey & FTG_BUTTON_KEYS) == 0) {
-        return;
-    } else if ((ftgKeyStateBuffer[ftgKeyPreIndex].ftgkey & ftgKeyStateBuffer[ftgKeyCurIndex].ftgkey & FTG_BUTTON_KEYS) != 0) {
-        return;
+bool CommandTable::isCompiled() const
+{
+    return compiled;
+}
+
+int CommandTable::getNumCommands() const
+{
+    return commandsById.size();
+}
+
+int CommandTable::findCommand(const char *name) const
+{
+    for (size_t i=0; i<commandsById.size(); i++) {
+        if (strcmp(commandsById[i]->name, name) == 0) {
+            return i;
+        }
     }
+    return -1;
+}
 
-    // parse command
-    list<Command*>::iterator i;
-    for (i = commandTable.begin(); i != commandTable.end(); ++i ){
-        int j;
-        int temp_p_cur = ftgKeyCurIndex;
-        for (j=(*i)->length-1; j>=0; j--) {
-            if (temp_p_cur == beginIndex) {
-                break;
-            }
+const char *CommandTable::getCommandName(int id) const
+{
+    if (id < 0 || id >= (int)commandsById.size()) {
+        return "";
+    }
+    return commandsById[id]->name;
+}
 
-            // faulttolerant
-            if (ftgKeyStateBuffer[temp_p_cur].ftgkey == 0 && ftgKeyStateBuffer[temp_p_cur].numFrames < 8) {
-                temp_p_cur--;
-                if (temp_p_cur == -1)
-                    temp_p_cur += KEY_BUFFER_LEN;
-            }
+size_t CommandTable::parseKeys(const char *text, unsigned char *keys, size_t maxlength)
+{
+    static const unsigned char numpad[10] = {
+        0, FTGKEY_1, FTGKEY_2, FTGKEY_3, FTGKEY_4, FTGKEY_5, FTGKEY_6, FTGKEY_7, FTGKEY_8, FTGKEY_9
+    };
+    size_t length = 0;
+    bool together = false;
+
+    for (; *text != '\0'; text++) {
+        unsigned char key;
+        if (*text >= '1' && *text <= '9') {
+            key = numpad[*text - '0'];
+        } else if (*text >= 'A' && *text <= 'D') {
+            key = FTGKEY_A >> (*text - 'A');
+        } else if (*text == '+') {
+            together = true;
+            continue;
+        } else if (*text == ' ') {
+            continue;
+        } else {
+            throw "unknown key in command";
+        }
 
-            // if interval too long
-            if (j != 0 && ftgKeyStateBuffer[temp_p_cur].numFrames > 8) {
-                break;
+        if (together && length > 0) {
+            keys[length - 1] |= key;
+            together = false;
+        } else {
+            if (length == maxlength) {
+                throw "command too long";
             }
+            keys[length++] = key;
+        }
+    }
+    return length;
+}
 
-            if (j == (int)(*i)->length-1) {
-                // if 'command end' mismatch
-                if ( (ftgKeyStateBuffer[temp_p_cur].ftgkey & FTG_BUTTON_KEYS) != (*i)->ftgKeyArray[j] ) {
-                    break;
-                }
-            } else {
-                bool passed = true;
-                int loop = 2;
-                // test if mismatch
-                while ( loop > 0 && (ftgKeyStateBuffer[temp_p_cur].ftgkey != (*i)->ftgKeyArray[j]) ) {
-                    // faulttolerant
-                    unsigned char keytest = (*i)->ftgKeyArray[j] & ftgKeyStateBuffer[temp_p_cur].ftgkey;
-                    if ( keytest != 0 && (keytest == ftgKeyStateBuffer[temp_p_cur].ftgkey || keytest == (*i)->ftgKeyArray[j]) ) {
-                        // skip one key and test again
-                        temp_p_cur--;
-                        if (temp_p_cur == -1) {
-                            temp_p_cur += KEY_BUFFER_LEN;
-                        }
-                        loop --;
-                    } else {
-                        passed = false;
-                        break;
-                    }
-                }
-                if (!passed) {
+/*
+ * Try every child of node against the element at p, the same leniency
+ * as matching one command at a time:
+ *  - a short run of released keys is skipped
+ *  - a key held too long breaks the command, unless it is the first key
+ *  - the last key must have exactly the button part of the command end
+ *  - other keys may skip up to 2 overlapping key states
+ */
+void CommandTable::matchChildren(int node, const unsigned char *keys, const Uint32 *numFrames, int p, int begin,
+        int *best, Uint64 *all) const
+{
+    if (p == begin) {
+        return;
+    }
+
+    // faulttolerant
+    if (keys[p] == 0 && numFrames[p] < 8) {
+        p = prevIndex(p);
+    }
+
+    // if interval too long, only commands starting here can still match
+    bool tooLong = numFrames[p] > 8;
+
+    for (int c = nodes[node].firstChild; c != -1; c = nodes[c].nextSibling) {
+        const struct TrieNode *child = &nodes[c];
+        if (all == NULL && child->bestRank >= *best) {
+            continue;
+        }
+        if (tooLong && child->command == -1) {
+            continue;
+        }
+
+        int q = p;
+        if (node == 0) {
+            // if 'command end' mismatch
+            if ((keys[q] & FTG_BUTTON_KEYS) != child->ftgkey) {
+                continue;
+            }
+        } else {
+            bool passed = true;
+            int loop = 2;
+            // test if mismatch
+            while ( loop > 0 && keys[q] != child->ftgkey ) {
+                // faulttolerant
+                unsigned char keytest = child->ftgkey & keys[q];
+                if ( keytest != 0 && (keytest == keys[q] || keytest == child->ftgkey) ) {
+                    // skip one key and test again
+                    q = prevIndex(q);
+                    loop --;
+                } else {
+                    passed = false;
                     break;
                 }
             }
+            if (!passed) {
+                continue;
+            }
+        }
 
-            temp_p_cur--;
-            if (temp_p_cur == -1) {
-                temp_p_cur += KEY_BUFFER_LEN;
+        if (child->command != -1) {
+            if (child->command < *best) {
+                *best = child->command;
+            }
+            if (all != NULL && commands[child->command]->id < 64) {
+                *all |= (Uint64)1 << commands[child->command]->id;
             }
         }
-        if (j < 0) {
-            break;
+        if (!tooLong && child->firstChild != -1) {
+            matchChildren(c, keys, numFrames, prevIndex(q), begin, best, all);
         }
     }
-    if (i != commandTable.end()) {
-        strncpy(curCommandName, (*i)->name, sizeof(curCommandName));
+}
+
+const Command *CommandTable::match(const unsigned char *keys, const Uint32 *numFrames, int cur, int begin) const
+{
+    assert(compiled);
+    int best = commands.size();
+    matchChildren(0, keys, numFrames, cur, begin, &best, NULL);
+    if (best < (int)commands.size()) {
+        return commands[best];
+    }
+    return NULL;
+}
+
+Uint64 CommandTable::matchAll(const unsigned char *keys, const Uint32 *numFrames, int cur, int begin) const
+{
+    assert(compiled);
+    int best = commands.size();
+    Uint64 all = 0;
+    matchChildren(0, keys, numFrames, cur, begin, &best, &all);
+    return all;
+}
+
+
+KeyFilter::KeyFilter() :
+    commandTable(NULL),
+    ftgKeyCurIndex(0),
+    ftgKeyPreIndex(KEY_BUFFER_LEN - 1),
+    beginIndex(0),
+    curCommand(-1)
+{
+    memset(ftgKeyBuffer, 0, sizeof(ftgKeyBuffer));
+    memset(numFramesBuffer, 0, sizeof(numFramesBuffer));
+}
+
+KeyFilter::~KeyFilter()
+{
+}
+
+void KeyFilter::setCommandTable(const CommandTable *table)
+{
+    assert(table == NULL || table->isCompiled());
+    this->commandTable = table;
+}
+
+void KeyFilter::updateKeys(unsigned char currentFtgKeyState)
+{
+    // save key in buffer
+    if (ftgKeyBuffer[ftgKeyCurIndex] == currentFtgKeyState) {
+        numFramesBuffer[ftgKeyCurIndex] += 1;
+    } else {
+        ftgKeyPreIndex = ftgKeyCurIndex;
+        ftgKeyCurIndex = (ftgKeyCurIndex + 1) % KEY_BUFFER_LEN;
+        ftgKeyBuffer[ftgKeyCurIndex] = currentFtgKeyState;
+        numFramesBuffer[ftgKeyCurIndex] = 1;
+    }
+
+    // if not a 'command end', skip parse
+    // A 'command end' is: current is a button key and pre is not the same button key
+    if ((ftgKeyBuffer[ftgKeyCurIndex] & FTG_BUTTON_KEYS) == 0) {
+        return;
+    } else if ((ftgKeyBuffer[ftgKeyPreIndex] & ftgKeyBuffer[ftgKeyCurIndex] & FTG_BUTTON_KEYS) != 0) {
+        return;
+    }
+
+    // parse command
+    if (commandTable == NULL) {
+        return;
+    }
+    const Command *command = commandTable->match(ftgKeyBuffer, numFramesBuffer, ftgKeyCurIndex, beginIndex);
+    if (command != NULL) {
+        curCommand = command->id;
         beginIndex = ftgKeyCurIndex;
 
         //debug
         
         static int hitnumber = 0;
-        printf("%s hit   %d\n", (*i)->name, hitnumber++);
+        LOG_DEBUG("%s hit   %d", command->name, hitnumber++);
         /*int i;
         for (i=0; i<KEY_BUFFER_LEN; i++) {
             if (i == ftgKeyCurIndex) {
                 printf("*");
             }
-            printf("%d,", ftgKeyStateBuffer[i].ftgkey);
+            printf("%d,", ftgKeyBuffer[i]);
         }
         printf("\n");
 */ 
     }
 }
 
-bool KeyFilter::pollCurrentCommandName(char *cmdname, size_t bufflen)
+int KeyFilter::pollCurrentCommand()
 {
-    assert(cmdname != NULL && bufflen > 0);
-    if (curCommandName[0] != '\0') {
-        strncpy(cmdname, curCommandName, bufflen);
-        memset(curCommandName, 0, sizeof(curCommandName));
-        return true;
-    } else {
-        return false;
-    }
+    int command = curCommand;
+    curCommand = -1;
+    return command;
 }
 
 Uint32 KeyFilter::getKeyState(unsigned char key)
 {
-    if ( (ftgKeyStateBuffer[ftgKeyCurIndex].ftgkey & key) != 0 ) {
-        return ftgKeyStateBuffer[ftgKeyCurIndex].numFrames;
+    if ( (ftgKeyBuffer[ftgKeyCurIndex] & key) != 0 ) {
+        return numFramesBuffer[ftgKeyCurIndex];
     }
     return 0;
 }
@@ -186,22 +358,22 @@ Uint32 KeyFilter::getKeyState(unsigned char key)
 void KeyFilter::flipHorizontal()
 {
     bool key1down = false, key2down = false;
-    if ( (ftgKeyStateBuffer[ftgKeyCurIndex].ftgkey & FTGKEY_6) != 0 ) {
+    if ( (ftgKeyBuffer[ftgKeyCurIndex] & FTGKEY_6) != 0 ) {
         key1down = true;
     }
-    if ( (ftgKeyStateBuffer[ftgKeyCurIndex].ftgkey & FTGKEY_4) != 0 ) {
+    if ( (ftgKeyBuffer[ftgKeyCurIndex] & FTGKEY_4) != 0 ) {
         key2down = true;
     }
 
     if (key1down) {
-        ftgKeyStateBuffer[ftgKeyCurIndex].ftgkey |= FTGKEY_4;
+        ftgKeyBuffer[ftgKeyCurIndex] |= FTGKEY_4;
     } else {
-        ftgKeyStateBuffer[ftgKeyCurIndex].ftgkey &= ~FTGKEY_4;
+        ftgKeyBuffer[ftgKeyCurIndex] &= ~FTGKEY_4;
     }
     if (key2down) {
-        ftgKeyStateBuffer[ftgKeyCurIndex].ftgkey |= FTGKEY_6;
+        ftgKeyBuffer[ftgKeyCurIndex] |= FTGKEY_6;
     } else {
-        ftgKeyStateBuffer[ftgKeyCurIndex].ftgkey &= ~FTGKEY_6;
+        ftgKeyBuffer[ftgKeyCurIndex] &= ~FTGKEY_6;
     }
 }
 
@@ -252,6 +424,7 @@ int main(int argc, char **argv)
     key_map[SDLK_i] = FTGKEY_D;
 
     // Init key filter
+    CommandTable commandTable;
     KeyFilter keyFilter;
     unsigned char cmd[][8] = {
         {FTGKEY_6, FTGKEY_3, FTGKEY_2, FTGKEY_3, FTGKEY_A},
@@ -263,14 +436,16 @@ int main(int argc, char **argv)
         {FTGKEY_6, FTGKEY_3, FTGKEY_2, FTGKEY_3, FTGKEY_6, FTGKEY_A},
         {FTGKEY_6, FTGKEY_2, FTGKEY_3, FTGKEY_A},
     };
-    //keyFilter.addCommand("63236A", cmd[6], 6);
-    keyFilter.addCommand("6323A", cmd[0], 5);
-    //keyFilter.addCommand("623A", cmd[7], 4);
-    keyFilter.addCommand("236A", cmd[1], 4);
-    keyFilter.addCommand("236B", cmd[2], 4);
-    keyFilter.addCommand("22A", cmd[3], 3);
-    keyFilter.addCommand("6A", cmd[4], 2);
-    keyFilter.addCommand("2A", cmd[5], 2);
+    //commandTable.addCommand("63236A", cmd[6], 6);
+    commandTable.addCommand("6323A", cmd[0], 5);
+    //commandTable.addCommand("623A", cmd[7], 4);
+    commandTable.addCommand("236A", cmd[1], 4);
+    commandTable.addCommand("236B", cmd[2], 4);
+    commandTable.addCommand("22A", cmd[3], 3);
+    commandTable.addCommand("6A", cmd[4], 2);
+    commandTable.addCommand("2A", cmd[5], 2);
+    commandTable.compile();
+    keyFilter.setCommandTable(&commandTable);
 
     unsigned char current_key_state = 0;
     while(exited==0)
@@ -1,10 +1,10 @@
 #ifndef _KEYFILTER_H_
 #define _KEYFILTER_H_
 
-#include <list>
+#include <vector>
 #include <SDL/SDL.h>
 
-using std::list;
+using std::vector;
 
 namespace dragonfighting {
 
@@ -16,33 +16,88 @@ public:
     char name[16];
     unsigned char ftgKeyArray[16];
     size_t length;
+    int id;     // order of addCommand, what the state machine sees
 
-    Command(const char *name, const unsigned char *cmd, size_t length);
+    Command(const char *name, const unsigned char *cmd, size_t length, int id);
 };
 
 
-class KeyFilter {
+/*
+ * All commands of a character compiled into one trie over the reversed
+ * key sequences, so commands ending the same way are matched together
+ * while walking back through the key buffer. Matching cost depends on
+ * how the commands branch, not on how many there are.
+ */
+class CommandTable {
 
-    struct FTGKeyNode {
+    struct TrieNode {
         unsigned char ftgkey;
-        Uint32 numFrames;
+        int command;    // rank of the command ending here, -1 if none
+        int bestRank;   // lowest rank in this subtree
+        int firstChild;
+        int nextSibling;
     };
 protected:
-    list<Command*> commandTable;
-    struct FTGKeyNode ftgKeyStateBuffer[KEY_BUFFER_LEN];
+    vector<Command*> commands;  // sorted by priority once compiled
+    vector<Command*> commandsById;
+    vector<struct TrieNode> nodes;
+    bool compiled;
+
+    int newNode(unsigned char ftgkey);
+    void matchChildren(int node, const unsigned char *keys, const Uint32 *numFrames, int p, int begin,
+            int *best, Uint64 *all) const;
+
+public:
+    CommandTable();
+    ~CommandTable();
+
+    // returns the command id
+    int addCommand(const char *name, const unsigned char *cmd, size_t length);
+    void compile();
+    bool isCompiled() const;
+
+    int getNumCommands() const;
+    // -1 if there is no such command
+    int findCommand(const char *name) const;
+    // "" for -1
+    const char *getCommandName(int id) const;
+
+    // numpad notation, "236A", "6+A" for keys pressed together
+    static size_t parseKeys(const char *text, unsigned char *keys, size_t maxlength);
+
+    /*
+     * keys and numFrames are a KEY_BUFFER_LEN ring of key states and how
+     * long each was held. Walk back from cur, never starting an element
+     * at begin.
+     */
+    // the command with the highest priority
+    const Command *match(const unsigned char *keys, const Uint32 *numFrames, int cur, int begin) const;
+    // every command that matches, bit id set (ids of 64 and up are never reported)
+    Uint64 matchAll(const unsigned char *keys, const Uint32 *numFrames, int cur, int begin) const;
+};
+
+
+class KeyFilter {
+
+protected:
+    const CommandTable *commandTable;
+    unsigned char ftgKeyBuffer[KEY_BUFFER_LEN];
+    Uint32 numFramesBuffer[KEY_BUFFER_LEN];
     int ftgKeyCurIndex;
     int ftgKeyPreIndex;
     int beginIndex;
-    char curCommandName[16];
+    int curCommand;
 
 public:
     KeyFilter();
     ~KeyFilter();
 
-    void addCommand(const char *name, const unsigned char *cmd, size_t length);
+    // compiled, usually shared by all instances of a character
+    void setCommandTable(const CommandTable *table);
 
     void updateKeys(unsigned char currentFtgKeyState);//every frame
-    bool pollCurrentCommandName(char *cmdname, size_t bufflen);
+    // id of the command completed this frame, -1 if none
+    int pollCurrentCommand();
     Uint32 getKeyState(unsigned char key);
 
     // ugly way to handle charactor direction change
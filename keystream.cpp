@@ -6,7 +6,11 @@
 namespace dragonfighting {
 
 
-CtrlKeyReaderWriter::CtrlKeyReaderWriter()
+CtrlKeyReaderWriter::CtrlKeyReaderWriter() :
+    keyEventRing(),
+    droppedEvents(0),
+    recorder(NULL),
+    recorderControler(0)
 {
 }
 
@@ -16,32 +20,39 @@ CtrlKeyReaderWriter::~CtrlKeyReaderWriter()
 
 void CtrlKeyReaderWriter::writeEvent(struct Ctrl_KeyEvent *event)
 {
-    this->keyEventList.push_back(*event);
+    if (!keyEventRing.push(*event)) {
+        droppedEvents ++;
+    }
 }
 
 int CtrlKeyReaderWriter::readEvent(struct Ctrl_KeyEvent *event, Uint32 frameStamp)
 {
-    if (keyEventList.size() == 0) return 0;
-
-    if (frameStamp == this->keyEventList.front().frameStamp) {
-        *event = this->keyEventList.front();
-        this->keyEventList.pop_front();
+    struct Ctrl_KeyEvent *next = keyEventRing.peek();
+    if (next == NULL) return 0;
+
+    if (next->frameStamp <= frameStamp) {
+        *event = *next;
+        keyEventRing.pop();
+        if (recorder != NULL) {
+            struct Ctrl_KeyEvent recorded = *event;
+            recorded.controler = recorderControler;
+            recorder->writeEvent(&recorded);
+        }
         return 1;
     }
 
     return 0;
 }
 
-
-ReplayWriter::ReplayWriter() :
-    index(0)
+unsigned long CtrlKeyReaderWriter::getDroppedEvents()
 {
-    buffer = (struct Ctrl_KeyEvent *)malloc(4096);
+    return droppedEvents;
 }
 
-void ReplayWriter::writeEvent(struct Ctrl_KeyEvent *event)
+void CtrlKeyReaderWriter::setRecorder(CtrlKeyWriter *recorder, char controler)
 {
-    buffer[index++] = *event;
+    this->recorder = recorder;
+    this->recorderControler = controler;
 }
 
 
@@ -2,9 +2,9 @@
 #define _KEY_STREAM_H_
 
 #include <stdio.h>
-#include <list>
 #include <SDL/SDL.h>
 #include "ftgkeys.h"
+#include "spscring.h"
 
 namespace dragonfighting {
 
@@ -48,20 +48,36 @@ public:
     CtrlKeyReader() {}
     virtual ~CtrlKeyReader() {}
 
+    // returns 1 and the next event due at frameStamp, call until it returns 0
     virtual int readEvent(struct Ctrl_KeyEvent *event, Uint32 frameStamp) = 0;
 };
 
+/*
+ * The writer may run on another thread than the reader (e.g. an input
+ * thread feeding the game loop), events go through a lock-free ring.
+ */
 class CtrlKeyReaderWriter : public CtrlKeyReader, public CtrlKeyWriter
 {
+public:
+    static const size_t CAPACITY = 256;
+
 protected:
-    std::list<struct Ctrl_KeyEvent> keyEventList;
+    SPSCRing<struct Ctrl_KeyEvent, CAPACITY> keyEventRing;
+    unsigned long droppedEvents;
+    CtrlKeyWriter *recorder;
+    char recorderControler;
 
 public:
     CtrlKeyReaderWriter();
     virtual ~CtrlKeyReaderWriter();
 
     virtual void writeEvent(struct Ctrl_KeyEvent *event);
+    // events stamped up to frameStamp are due, late ones are not lost
     virtual int readEvent(struct Ctrl_KeyEvent *event, Uint32 frameStamp);
+    unsigned long getDroppedEvents();
+
+    // every event handed to the reader is copied to recorder, tagged with controler
+    void setRecorder(CtrlKeyWriter *recorder, char controler);
 };
 
 class NetReader : public CtrlKeyReader
@@ -79,26 +95,6 @@ public:
     virtual void writeEvent(struct Ctrl_KeyEvent *event);
 };
 
-class ReplayReader : public CtrlKeyReader
-{
-public:
-    ReplayReader();
-    virtual ~ReplayReader();
-
-    virtual int readEvent(struct Ctrl_KeyEvent *event);
-};
-
-class ReplayWriter : public CtrlKeyWriter
-{
-protected:
-    struct Ctrl_KeyEvent *buffer;
-    unsigned long index;
-
-public:
-    ReplayWriter();
-    virtual void writeEvent(struct Ctrl_KeyEvent *event);
-};
-
 class DebugReader : public CtrlKeyReader
 {
 protected:
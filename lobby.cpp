@@ -0,0 +1,504 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "lobby.h"
+
+namespace dragonfighting {
+
+LobbyServer::LobbyServer() :
+    NetIOServer(),
+    epollfd(-1),
+    connections(),
+    waitingfd(-1),
+    numConnections(0),
+    numMatches(0),
+    tokenState(0)
+{
+    // players tend to arrive in bursts
+    listenBacklog = 1024;
+    tokenState = (Uint32)time(NULL) ^ ((Uint32)getpid() << 16);
+    if (tokenState == 0) {
+        tokenState = 0x12345678;
+    }
+}
+
+LobbyServer::~LobbyServer()
+{
+    for (int fd = 0; fd < (int)connections.size(); fd++) {
+        if (connections[fd].state != CONN_FREE) {
+            closeConnection(fd);
+        }
+    }
+    if (epollfd != -1) {
+        close(epollfd);
+    }
+    if (sockfd != -1) {
+        disconnectSocket();
+    }
+}
+
+void LobbyServer::start(int port)
+{
+    bindAndListenSocket(port);
+
+    epollfd = epoll_create1(0);
+    if (epollfd == -1) {
+        throw "epoll_create failed";
+    }
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.fd = sockfd;
+    if (epoll_ctl(epollfd, EPOLL_CTL_ADD, sockfd, &ev) == -1) {
+        throw "epoll_ctl failed";
+    }
+}
+
+void LobbyServer::poll(int timeout)
+{
+    struct epoll_event events[256];
+    int n = epoll_wait(epollfd, events, sizeof(events) / sizeof(events[0]), timeout);
+    for (int i=0; i<n; i++) {
+        if (events[i].data.fd == sockfd) {
+            acceptConnections();
+        } else {
+            // an earlier event of this batch may have closed it
+            readHello(events[i].data.fd);
+        }
+    }
+}
+
+void LobbyServer::acceptConnections()
+{
+    while (true) {
+        struct sockaddr_in addr;
+        socklen_t addrlen = sizeof(addr);
+        int fd = accept4(sockfd, (struct sockaddr *)&addr, &addrlen, SOCK_NONBLOCK);
+        if (fd == -1) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            // EAGAIN, or out of fds: retry on the next poll
+            return;
+        }
+
+        if (fd >= (int)connections.size()) {
+            struct Connection empty;
+            memset(&empty, 0, sizeof(empty));
+            connections.resize(fd + 1, empty);
+        }
+        struct Connection *conn = &connections[fd];
+        memset(conn, 0, sizeof(*conn));
+        conn->address = ntohl(addr.sin_addr.s_addr);
+        conn->state = CONN_HELLO;
+
+        struct epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN;
+        ev.data.fd = fd;
+        if (epoll_ctl(epollfd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+            close(fd);
+            conn->state = CONN_FREE;
+            continue;
+        }
+        numConnections ++;
+    }
+}
+
+void LobbyServer::readHello(int fd)
+{
+    if (fd >= (int)connections.size() || connections[fd].state == CONN_FREE) {
+        return;
+    }
+    struct Connection *conn = &connections[fd];
+    ssize_t n;
+
+    if (conn->state == CONN_WAITING) {
+        // nothing more is expected, only notice the client leaving
+        unsigned char discard[64];
+        n = read(fd, discard, sizeof(discard));
+        if (n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR)) {
+            closeConnection(fd);
+        }
+        return;
+    }
+
+    n = read(fd, conn->buffer + conn->received, sizeof(conn->buffer) - conn->received);
+    if (n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR)) {
+        closeConnection(fd);
+        return;
+    }
+    if (n < 0) {
+        return;
+    }
+    conn->received += n;
+    if (conn->received < sizeof(struct LobbyHello)) {
+        return;
+    }
+
+    struct LobbyHello hello;
+    memcpy(&hello, conn->buffer, sizeof(hello));
+    if (ntohl(hello.magic) != LOBBY_MAGIC) {
+        closeConnection(fd);
+        return;
+    }
+    conn->udpPort = ntohs(hello.udpPort);
+    conn->state = CONN_WAITING;
+
+    if (waitingfd != -1 && waitingfd != fd) {
+        int opponentfd = waitingfd;
+        waitingfd = -1;
+        pair(opponentfd, fd);
+    } else {
+        waitingfd = fd;
+    }
+}
+
+void LobbyServer::closeConnection(int fd)
+{
+    if (connections[fd].state == CONN_FREE) {
+        return;
+    }
+    epoll_ctl(epollfd, EPOLL_CTL_DEL, fd, NULL);
+    close(fd);
+    connections[fd].state = CONN_FREE;
+    if (waitingfd == fd) {
+        waitingfd = -1;
+    }
+    numConnections --;
+}
+
+// xorshift32, tokens only need to differ between sessions
+Uint32 LobbyServer::nextToken()
+{
+    tokenState ^= tokenState << 13;
+    tokenState ^= tokenState >> 17;
+    tokenState ^= tokenState << 5;
+    return tokenState;
+}
+
+void LobbyServer::pair(int fd1, int fd2)
+{
+    struct Connection *conn1 = &connections[fd1];
+    struct Connection *conn2 = &connections[fd2];
+    struct LobbyMatch match;
+    Uint32 token = nextToken();
+
+    memset(&match, 0, sizeof(match));
+    match.magic = htonl(LOBBY_MAGIC);
+    match.token = htonl(token);
+    match.peerAddress = htonl(conn2->address);
+    match.peerPort = htons(conn2->udpPort);
+    match.role = LOBBY_ROLE_SERVER;
+    send(fd1, &match, sizeof(match), MSG_NOSIGNAL);
+
+    match.peerAddress = htonl(conn1->address);
+    match.peerPort = htons(conn1->udpPort);
+    match.role = LOBBY_ROLE_CLIENT;
+    send(fd2, &match, sizeof(match), MSG_NOSIGNAL);
+
+    // out of the match path from here on
+    closeConnection(fd1);
+    closeConnection(fd2);
+    numMatches ++;
+}
+
+unsigned long LobbyServer::getNumConnections()
+{
+    return numConnections;
+}
+
+unsigned long LobbyServer::getNumMatches()
+{
+    return numMatches;
+}
+
+size_t LobbyServer::getConnectionCost()
+{
+    return sizeof(struct Connection);
+}
+
+
+LobbyClient::LobbyClient() :
+    NetIOClient(),
+    received(0)
+{
+    memset(&match, 0, sizeof(match));
+}
+
+LobbyClient::~LobbyClient()
+{
+}
+
+bool LobbyClient::sendHello(Uint16 udpPort)
+{
+    struct LobbyHello hello;
+    memset(&hello, 0, sizeof(hello));
+    hello.magic = htonl(LOBBY_MAGIC);
+    hello.udpPort = htons(udpPort);
+    received = 0;
+    return send(sockfd, &hello, sizeof(hello), MSG_NOSIGNAL) == sizeof(hello);
+}
+
+int LobbyClient::pollMatch(struct LobbyMatch *match)
+{
+    int n = recvSocket((unsigned char *)&this->match + received, sizeof(this->match) - received);
+    if (n == 0) {
+        return -1;
+    }
+    if (n < 0) {
+        return (errno == EAGAIN || errno == EINTR) ? 0 : -1;
+    }
+    received += n;
+    if (received < sizeof(this->match)) {
+        return 0;
+    }
+    if (ntohl(this->match.magic) != LOBBY_MAGIC) {
+        return -1;
+    }
+    match->magic = LOBBY_MAGIC;
+    match->token = ntohl(this->match.token);
+    match->peerAddress = ntohl(this->match.peerAddress);
+    match->peerPort = ntohs(this->match.peerPort);
+    match->role = this->match.role;
+    match->reserved = 0;
+    return 1;
+}
+
+}
+
+
+#ifdef FTG_TEST
+
+#include <stdlib.h>
+#include <map>
+
+using namespace dragonfighting;
+
+static double nowMilliseconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+static volatile bool serverRunning = true;
+
+static int serverThread(void *data)
+{
+    LobbyServer *lobby = (LobbyServer *)data;
+    while (serverRunning) {
+        lobby->poll(10);
+    }
+    return 0;
+}
+
+// idle connections that never say hello, then pairs of players
+static int generateLoad(const char *host, int port, int numIdle, int numPairs)
+{
+    vector<LobbyClient *> idle;
+    vector<LobbyClient *> players;
+
+    double t0 = nowMilliseconds();
+    try {
+        for (int i=0; i<numIdle; i++) {
+            LobbyClient *client = new LobbyClient();
+            client->connectSocket(host, port);
+            idle.push_back(client);
+        }
+    } catch (const char *e) {
+        printf("idle connection %lu: %s\n", (unsigned long)idle.size(), e);
+        return 1;
+    }
+    double t1 = nowMilliseconds();
+    printf("%d idle connections opened in %.1f ms\n", numIdle, t1 - t0);
+
+    try {
+        for (int i=0; i<numPairs * 2; i++) {
+            LobbyClient *client = new LobbyClient();
+            client->connectSocket(host, port);
+            if (!client->sendHello(30000 + i % 30000)) {
+                printf("send hello failed\n");
+                return 1;
+            }
+            players.push_back(client);
+        }
+    } catch (const char *e) {
+        printf("player connection %lu: %s\n", (unsigned long)players.size(), e);
+        return 1;
+    }
+
+    vector<struct LobbyMatch> matches(players.size());
+    vector<bool> done(players.size(), false);
+    size_t numDone = 0;
+    while (numDone < players.size() && nowMilliseconds() - t1 < 10000) {
+        for (size_t i=0; i<players.size(); i++) {
+            if (done[i]) {
+                continue;
+            }
+            int ret = players[i]->pollMatch(&matches[i]);
+            if (ret != 0) {
+                if (ret < 0) {
+                    printf("player %lu: lobby closed the connection\n", (unsigned long)i);
+                    return 1;
+                }
+                done[i] = true;
+                numDone ++;
+            }
+        }
+    }
+    double t2 = nowMilliseconds();
+    if (numDone < players.size()) {
+        printf("timeout: %lu of %lu players matched\n", (unsigned long)numDone, (unsigned long)players.size());
+        return 1;
+    }
+
+    // every token must belong to exactly one server and one client
+    std::map<Uint32, int> roles;
+    for (size_t i=0; i<matches.size(); i++) {
+        roles[matches[i].token] += matches[i].role;
+    }
+    for (std::map<Uint32, int>::iterator i = roles.begin(); i != roles.end(); ++i) {
+        if (i->second != LOBBY_ROLE_SERVER + LOBBY_ROLE_CLIENT) {
+            printf("token %08x is not a proper pair\n", i->first);
+            return 1;
+        }
+    }
+    printf("%d pairs matched in %.1f ms (%.0f matches/s) with %d idle connections open\n",
+            numPairs, t2 - t1, numPairs / ((t2 - t1) / 1000.0), numIdle);
+
+    for (size_t i=0; i<idle.size(); i++) {
+        idle[i]->disconnectSocket();
+        delete idle[i];
+    }
+    for (size_t i=0; i<players.size(); i++) {
+        players[i]->disconnectSocket();
+        delete players[i];
+    }
+    return 0;
+}
+
+/*
+ * A waiting player's event and the hello that pairs it off in one epoll
+ * batch. Whichever comes first, the other must not touch the closed fd.
+ */
+static int samePoll(int port, int rounds)
+{
+    LobbyServer lobby;
+    try {
+        lobby.start(port);
+        for (int r=0; r<rounds; r++) {
+            LobbyClient first;
+            LobbyClient second;
+            first.connectSocket("127.0.0.1", port);
+            first.sendHello(30000);
+            // accept and read the hello, first is waiting after this
+            for (int i=0; i<100 && lobby.getNumConnections() == 0; i++) {
+                lobby.poll(10);
+            }
+            lobby.poll(10);
+            second.connectSocket("127.0.0.1", port);
+            for (int i=0; i<100 && lobby.getNumConnections() < 2; i++) {
+                lobby.poll(10);
+            }
+
+            // queue both, then a single poll sees them together; epoll
+            // reports them in the order they got ready, the pairing first
+            second.sendHello(30001);
+            usleep(5000);
+            unsigned char extra = 0;
+            first.sendSocket(&extra, 1);
+            usleep(20000);
+            lobby.poll(10);
+
+            if (lobby.getNumMatches() != (unsigned long)r + 1 || lobby.getNumConnections() != 0) {
+                printf("round %d: %lu matches, %lu connections\n", r, lobby.getNumMatches(), lobby.getNumConnections());
+                return 1;
+            }
+            struct LobbyMatch match1, match2;
+            int ret1 = 0, ret2 = 0;
+            for (int i=0; i<100 && (ret1 == 0 || ret2 == 0); i++) {
+                if (ret1 == 0) {
+                    ret1 = first.pollMatch(&match1);
+                }
+                if (ret2 == 0) {
+                    ret2 = second.pollMatch(&match2);
+                }
+                usleep(1000);
+            }
+            if (ret1 != 1 || ret2 != 1 || match1.token != match2.token) {
+                printf("round %d: the pair did not get its match\n", r);
+                return 1;
+            }
+            first.disconnectSocket();
+            second.disconnectSocket();
+        }
+    } catch (const char *e) {
+        printf("%s\n", e);
+        return 1;
+    }
+    printf("%d rounds with both events in one poll: ok\n", rounds);
+    return 0;
+}
+
+static void usage(const char *name)
+{
+    printf("usage: %s server <port>\n", name);
+    printf("       %s load <host> <port> <idle connections> <pairs>\n", name);
+    printf("       %s loopback <port> <idle connections> <pairs>\n", name);
+    printf("       %s samepoll <port> <rounds>\n", name);
+}
+
+int main(int argc, char **argv)
+{
+    if (argc >= 3 && strcmp(argv[1], "server") == 0) {
+        try {
+            LobbyServer lobby;
+            lobby.start(atoi(argv[2]));
+            printf("lobby listening on %s, %lu bytes per connection\n", argv[2], (unsigned long)LobbyServer::getConnectionCost());
+            double last = nowMilliseconds();
+            while (1) {
+                lobby.poll(1000);
+                if (nowMilliseconds() - last >= 1000) {
+                    printf("connections: %lu  matches: %lu\n", lobby.getNumConnections(), lobby.getNumMatches());
+                    last = nowMilliseconds();
+                }
+            }
+        } catch (const char *e) {
+            printf("%s\n", e);
+            return 1;
+        }
+    } else if (argc >= 6 && strcmp(argv[1], "load") == 0) {
+        return generateLoad(argv[2], atoi(argv[3]), atoi(argv[4]), atoi(argv[5]));
+    } else if (argc >= 5 && strcmp(argv[1], "loopback") == 0) {
+        int port = atoi(argv[2]);
+        LobbyServer lobby;
+        try {
+            lobby.start(port);
+        } catch (const char *e) {
+            printf("%s\n", e);
+            return 1;
+        }
+        SDL_Thread *thread = SDL_CreateThread(serverThread, &lobby);
+        int ret = generateLoad("127.0.0.1", port, atoi(argv[3]), atoi(argv[4]));
+        serverRunning = false;
+        SDL_WaitThread(thread, NULL);
+        printf("lobby: %lu matches, %lu bytes per connection\n", lobby.getNumMatches(), (unsigned long)LobbyServer::getConnectionCost());
+        return ret;
+    } else if (argc >= 4 && strcmp(argv[1], "samepoll") == 0) {
+        return samePoll(atoi(argv[2]), atoi(argv[3]));
+    } else {
+        usage(argv[0]);
+        return 1;
+    }
+    return 0;
+}
+
+#endif
@@ -0,0 +1,104 @@
+#ifndef _LOBBY_H_
+#define _LOBBY_H_
+
+#include <vector>
+#include <SDL/SDL.h>
+#include "nettcp.h"
+
+using std::vector;
+
+namespace dragonfighting {
+
+/*
+ * Lobby protocol, all fields in network byte order.
+ *
+ * A client connects and sends LobbyHello with the UDP port its
+ * ReliableConnection will listen on. When two clients are waiting the
+ * lobby sends each of them a LobbyMatch and closes both connections: it
+ * never sees the match traffic. The token is used as the ReliableConnection
+ * protocol id, so packets of other sessions are ignored.
+ */
+const Uint32 LOBBY_MAGIC = 0x4446544C; // "DFTL"
+
+enum LobbyRole {
+    LOBBY_ROLE_SERVER = 1,
+    LOBBY_ROLE_CLIENT = 2,
+};
+
+struct LobbyHello {
+    Uint32 magic;
+    Uint16 udpPort;
+    Uint16 reserved;
+};
+
+struct LobbyMatch {
+    Uint32 magic;
+    Uint32 token;
+    Uint32 peerAddress;
+    Uint16 peerPort;
+    Uint8 role;
+    Uint8 reserved;
+};
+
+class LobbyServer : public NetIOServer
+{
+protected:
+    enum ConnectionState {
+        CONN_FREE,
+        CONN_HELLO,     // connected, hello not complete yet
+        CONN_WAITING,   // hello received, waiting for an opponent
+    };
+
+    // indexed by fd, the only per connection cost besides the kernel socket
+    struct Connection {
+        Uint32 address;
+        Uint16 udpPort;
+        Uint8 state;
+        Uint8 received;
+        unsigned char buffer[sizeof(struct LobbyHello)];
+    };
+
+    int epollfd;
+    vector<struct Connection> connections;
+    int waitingfd;
+    unsigned long numConnections;
+    unsigned long numMatches;
+    Uint32 tokenState;
+
+    void acceptConnections();
+    void readHello(int fd);
+    void closeConnection(int fd);
+    void pair(int fd1, int fd2);
+    Uint32 nextToken();
+
+public:
+    LobbyServer();
+    ~LobbyServer();
+
+    void start(int port);
+    // wait up to timeout msec for activity and handle it
+    void poll(int timeout);
+
+    unsigned long getNumConnections();
+    unsigned long getNumMatches();
+    static size_t getConnectionCost();
+};
+
+class LobbyClient : public NetIOClient
+{
+protected:
+    struct LobbyMatch match;
+    size_t received;
+
+public:
+    LobbyClient();
+    ~LobbyClient();
+
+    bool sendHello(Uint16 udpPort);
+    // 1 when the match arrived, 0 not yet, -1 if the lobby closed or failed
+    int pollMatch(struct LobbyMatch *match /*out*/);
+};
+
+}
+
+#endif
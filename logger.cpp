@@ -0,0 +1,259 @@
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "logger.h"
+
+namespace dragonfighting {
+
+AsyncWriter *Logger::writer = NULL;
+std::vector<struct Logger::Format> Logger::formats;
+
+Uint64 Logger::now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (Uint64)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void Logger::open(AsyncWriter *writer)
+{
+    Logger::writer = writer;
+    // call sites seen before go to the new file too
+    for (size_t i=0; i<formats.size(); i++) {
+        writeFormat(i);
+    }
+}
+
+void Logger::close()
+{
+    writer = NULL;
+}
+
+Uint32 Logger::registerFormat(int level, const char *file, int line, const char *format)
+{
+    struct Format f;
+    f.level = level;
+    f.file = file;
+    f.line = line;
+    f.format = format;
+    formats.push_back(f);
+    if (writer != NULL) {
+        writeFormat(formats.size() - 1);
+    }
+    return formats.size() - 1;
+}
+
+void Logger::writeFormat(Uint32 id)
+{
+    unsigned char buffer[1024];
+    struct LogRecordHeader header;
+    int length = snprintf((char *)buffer + sizeof(header), sizeof(buffer) - sizeof(header), "%s:%d%c%s",
+            formats[id].file, formats[id].line, '\0', formats[id].format);
+    if (length < 0 || length >= (int)(sizeof(buffer) - sizeof(header))) {
+        length = sizeof(buffer) - sizeof(header) - 1;
+    }
+    buffer[sizeof(header) + length] = '\0';
+
+    header.time = now();
+    header.format = id;
+    header.length = length + 1;
+    header.type = LOG_RECORD_FORMAT;
+    header.level = formats[id].level;
+    memcpy(buffer, &header, sizeof(header));
+    writer->writeRecord(buffer, sizeof(header) + header.length);
+}
+
+}
+
+
+#ifdef FTG_TEST
+
+#include <stdlib.h>
+#include <map>
+#include <string>
+
+using namespace dragonfighting;
+
+struct DecodedFormat {
+    std::string location;
+    std::string format;
+};
+
+// printf the tagged arguments in args into out following format
+static void formatMessage(const char *format, const unsigned char *args, size_t length, std::string &out)
+{
+    size_t pos = 0;
+    const char *p = format;
+    while (*p != '\0') {
+        if (*p != '%') {
+            out += *p++;
+            continue;
+        }
+        if (p[1] == '%') {
+            out += '%';
+            p += 2;
+            continue;
+        }
+
+        // copy flags, width and precision, drop length modifiers
+        char spec[32];
+        size_t n = 0;
+        spec[n++] = *p++;
+        while (*p != '\0' && strchr("-+ #0123456789.", *p) != NULL && n < sizeof(spec) - 8) {
+            spec[n++] = *p++;
+        }
+        while (*p != '\0' && strchr("hlLqjzt", *p) != NULL) {
+            p++;
+        }
+        char conversion = *p;
+        if (conversion == '\0') {
+            break;
+        }
+        p++;
+
+        char text[512];
+        if (pos >= length) {
+            snprintf(text, sizeof(text), "<missing>");
+        } else if (args[pos] == LOG_ARG_STRING && pos + 2 + args[pos + 1] <= length) {
+            std::string value((const char *)args + pos + 2, args[pos + 1]);
+            spec[n++] = 's';
+            spec[n] = '\0';
+            snprintf(text, sizeof(text), spec, value.c_str());
+            pos += 2 + args[pos + 1];
+        } else if (args[pos] == LOG_ARG_DOUBLE && pos + 9 <= length) {
+            double value;
+            memcpy(&value, args + pos + 1, sizeof(value));
+            spec[n++] = strchr("eEfFgGaA", conversion) ? conversion : 'g';
+            spec[n] = '\0';
+            snprintf(text, sizeof(text), spec, value);
+            pos += 9;
+        } else if ((args[pos] == LOG_ARG_INT || args[pos] == LOG_ARG_UINT) && pos + 9 <= length) {
+            long long value;
+            memcpy(&value, args + pos + 1, sizeof(value));
+            spec[n++] = 'l';
+            spec[n++] = 'l';
+            if (strchr("diouxXc", conversion) != NULL) {
+                spec[n++] = (conversion == 'c') ? 'd' : conversion;
+            } else {
+                spec[n++] = (args[pos] == LOG_ARG_INT) ? 'd' : 'u';
+            }
+            spec[n] = '\0';
+            if (conversion == 'c') {
+                snprintf(text, sizeof(text), "%c", (char)value);
+            } else {
+                snprintf(text, sizeof(text), spec, value);
+            }
+            pos += 9;
+        } else {
+            snprintf(text, sizeof(text), "<corrupt>");
+            pos = length;
+        }
+        out += text;
+    }
+}
+
+static int decode(const char *filename)
+{
+    static const char *levelNames[] = {"DEBUG", "INFO", "WARN", "ERROR"};
+    FILE *fp = fopen(filename, "rb");
+    if (fp == NULL) {
+        printf("Unable to open %s\n", filename);
+        return 1;
+    }
+
+    std::map<Uint32, struct DecodedFormat> formats;
+    struct LogRecordHeader header;
+    unsigned char payload[65536];
+    Uint64 firstTime = 0;
+    bool first = true;
+    while (fread(&header, sizeof(header), 1, fp) == 1) {
+        if (fread(payload, 1, header.length, fp) != header.length) {
+            printf("truncated record\n");
+            break;
+        }
+        if (first) {
+            firstTime = header.time;
+            first = false;
+        }
+
+        if (header.type == LOG_RECORD_FORMAT) {
+            struct DecodedFormat f;
+            payload[header.length - 1] = '\0';
+            f.location = (const char *)payload;
+            size_t split = f.location.size() + 1;
+            f.format = (split < header.length) ? (const char *)payload + split : "";
+            formats[header.format] = f;
+        } else if (header.type == LOG_RECORD_MESSAGE) {
+            std::map<Uint32, struct DecodedFormat>::iterator f = formats.find(header.format);
+            std::string message;
+            if (f == formats.end()) {
+                message = "<unknown format>";
+            } else {
+                formatMessage(f->second.format.c_str(), payload, header.length, message);
+            }
+            printf("%12.3f %-5s %s %s\n", (header.time - firstTime) / 1e6,
+                    header.level < 4 ? levelNames[header.level] : "?",
+                    f == formats.end() ? "?" : f->second.location.c_str(),
+                    message.c_str());
+        }
+    }
+    fclose(fp);
+    return 0;
+}
+
+static Uint64 nowNanoseconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (Uint64)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int bench(const char *filename)
+{
+    AsyncWriter file;
+    try {
+        file.open(filename);
+    } catch (const char *e) {
+        printf("%s\n", e);
+        return 1;
+    }
+    Logger::open(&file);
+
+    const int N = 100000;
+    const char *name = "236A";
+    Uint64 logging = 0;
+    for (int i=0; i<N; i+=1000) {
+        Uint64 t0 = nowNanoseconds();
+        for (int j=i; j<i+1000; j++) {
+            LOG_INFO("%s hit %d at %.2f", name, j, j * 0.5);
+        }
+        logging += nowNanoseconds() - t0;
+        SDL_Delay(1);   // let the writer keep up, as a frame would
+    }
+    Uint64 t1 = nowNanoseconds();
+    for (int i=0; i<N; i++) {
+        LOG_DEBUG("compiled out %d", i);
+    }
+    Uint64 t2 = nowNanoseconds();
+
+    Logger::close();
+    unsigned long dropped = file.getDroppedRecords();
+    file.close();
+    printf("LOG_INFO: %.1f ns per call, %lu dropped\n", (double)logging / N, dropped);
+    printf("LOG_DEBUG below FTG_LOG_LEVEL: %.1f ns per call\n", (double)(t2 - t1) / N);
+    return 0;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc >= 3 && strcmp(argv[1], "decode") == 0) {
+        return decode(argv[2]);
+    } else if (argc >= 3 && strcmp(argv[1], "bench") == 0) {
+        return bench(argv[2]);
+    }
+    printf("usage: %s decode <logfile>\n", argv[0]);
+    printf("       %s bench <logfile>\n", argv[0]);
+    return 1;
+}
+
+#endif
@@ -0,0 +1,162 @@
+#ifndef _LOGGER_H_
+#define _LOGGER_H_
+
+#include <string.h>
+#include <vector>
+#include <SDL/SDL.h>
+#include "asyncwriter.h"
+
+namespace dragonfighting {
+
+enum LogLevel {
+    LOG_LEVEL_DEBUG,
+    LOG_LEVEL_INFO,
+    LOG_LEVEL_WARN,
+    LOG_LEVEL_ERROR,
+};
+
+// calls below this level are compiled out, build with -DFTG_LOG_LEVEL=0 for debug logs
+#ifndef FTG_LOG_LEVEL
+#define FTG_LOG_LEVEL LOG_LEVEL_INFO
+#endif
+
+/*
+ * Binary log file. The format string of a call site is written once, as a
+ * LOG_RECORD_FORMAT record; after that every message is only the format id,
+ * a timestamp and the raw arguments, formatted by the offline decoder
+ * (logger.cpp built with FTG_TEST).
+ *
+ * Records go through an AsyncWriter, so logging never waits for the disk or
+ * a terminal. It is single producer: log from the main loop thread only.
+ */
+enum LogRecordType {
+    LOG_RECORD_FORMAT = 1,  // payload: "file:line\0format\0"
+    LOG_RECORD_MESSAGE,     // payload: tagged arguments
+};
+
+struct LogRecordHeader {
+    Uint64 time;        // monotonic nsec
+    Uint32 format;
+    Uint16 length;      // payload bytes following the header
+    Uint8 type;
+    Uint8 level;
+};
+
+// argument tags, each followed by the value (strings: 1 byte length + bytes)
+const unsigned char LOG_ARG_INT = 'i';
+const unsigned char LOG_ARG_UINT = 'u';
+const unsigned char LOG_ARG_DOUBLE = 'd';
+const unsigned char LOG_ARG_STRING = 's';
+
+const size_t LOG_MAX_RECORD = 256;
+
+class Logger
+{
+protected:
+    struct Format {
+        Uint8 level;
+        const char *file;
+        int line;
+        const char *format;
+    };
+
+    static AsyncWriter *writer;
+    static std::vector<struct Format> formats;
+
+    static void writeFormat(Uint32 id);
+
+    static void pack(unsigned char *buffer, size_t *length, unsigned char tag, const void *value, size_t size)
+    {
+        if (*length + 1 + size > LOG_MAX_RECORD) {
+            return;
+        }
+        buffer[(*length)++] = tag;
+        memcpy(buffer + *length, value, size);
+        *length += size;
+    }
+    static void packArg(unsigned char *buffer, size_t *length, long long value)
+    {
+        pack(buffer, length, LOG_ARG_INT, &value, sizeof(value));
+    }
+    static void packArg(unsigned char *buffer, size_t *length, unsigned long long value)
+    {
+        pack(buffer, length, LOG_ARG_UINT, &value, sizeof(value));
+    }
+    static void packArg(unsigned char *buffer, size_t *length, int value) { packArg(buffer, length, (long long)value); }
+    static void packArg(unsigned char *buffer, size_t *length, long value) { packArg(buffer, length, (long long)value); }
+    static void packArg(unsigned char *buffer, size_t *length, unsigned int value) { packArg(buffer, length, (unsigned long long)value); }
+    static void packArg(unsigned char *buffer, size_t *length, unsigned long value) { packArg(buffer, length, (unsigned long long)value); }
+    static void packArg(unsigned char *buffer, size_t *length, double value)
+    {
+        pack(buffer, length, LOG_ARG_DOUBLE, &value, sizeof(value));
+    }
+    static void packArg(unsigned char *buffer, size_t *length, const char *value)
+    {
+        size_t size = strnlen(value, 255);
+        if (*length + 2 + size > LOG_MAX_RECORD) {
+            return;
+        }
+        buffer[(*length)++] = LOG_ARG_STRING;
+        buffer[(*length)++] = size;
+        memcpy(buffer + *length, value, size);
+        *length += size;
+    }
+
+    static void packArgs(unsigned char *buffer, size_t *length)
+    {
+    }
+    template <typename T, typename... Args>
+    static void packArgs(unsigned char *buffer, size_t *length, T value, Args... args)
+    {
+        packArg(buffer, length, value);
+        packArgs(buffer, length, args...);
+    }
+
+    static Uint64 now();
+
+public:
+    // the logger writes to writer until close(), writer must be open
+    static void open(AsyncWriter *writer);
+    static void close();
+    static bool isEnabled()
+    {
+        return writer != NULL;
+    }
+
+    // once per call site, returns the format id
+    static Uint32 registerFormat(int level, const char *file, int line, const char *format);
+
+    template <typename... Args>
+    static void write(Uint32 format, Args... args)
+    {
+        unsigned char buffer[LOG_MAX_RECORD];
+        size_t length = sizeof(struct LogRecordHeader);
+        packArgs(buffer, &length, args...);
+
+        struct LogRecordHeader header;
+        header.time = now();
+        header.format = format;
+        header.length = length - sizeof(header);
+        header.type = LOG_RECORD_MESSAGE;
+        header.level = formats[format].level;
+        memcpy(buffer, &header, sizeof(header));
+        writer->writeRecord(buffer, length);
+    }
+};
+
+}
+
+#define FTG_LOG(level, format, ...) \
+    do { \
+        if ((level) >= FTG_LOG_LEVEL && dragonfighting::Logger::isEnabled()) { \
+            static Uint32 ftgLogFormat = dragonfighting::Logger::registerFormat(level, __FILE__, __LINE__, format); \
+            dragonfighting::Logger::write(ftgLogFormat, ##__VA_ARGS__); \
+        } \
+    } while (0)
+
+#define LOG_DEBUG(format, ...)  FTG_LOG(dragonfighting::LOG_LEVEL_DEBUG, format, ##__VA_ARGS__)
+#define LOG_INFO(format, ...)   FTG_LOG(dragonfighting::LOG_LEVEL_INFO, format, ##__VA_ARGS__)
+#define LOG_WARN(format, ...)   FTG_LOG(dragonfighting::LOG_LEVEL_WARN, format, ##__VA_ARGS__)
+#define LOG_ERROR(format, ...)  FTG_LOG(dragonfighting::LOG_LEVEL_ERROR, format, ##__VA_ARGS__)
+
+#endif
@@ -26,7 +26,7 @@ void MainMenu::update(Uint32 frameStamp)
     assert(keyInputer != NULL);
 
     struct Ctrl_KeyEvent event;
-    if (this->keyInputer->readEvent(&event, frameStamp) == 1) {
+    while (this->keyInputer->readEvent(&event, frameStamp) == 1) {
         if (event.type == Ctrl_KEYDOWN) {
             current_key_state |= event.key;
         } else if (event.type == Ctrl_KEYUP) {
@@ -40,10 +40,11 @@ void MainMenu::update(Uint32 frameStamp)
     }
 }
 
-void MainMenu::draw(SDL_Surface *dst)
+void MainMenu::render(RenderList *list)
 {
     SDL_Rect screenposition = getPositionScreenCoor();
-    SDL_BlitSurface(bkImage, NULL, dst, &screenposition);
+    SDL_Rect srcrect = {0, 0, (Uint16)bkImage->w, (Uint16)bkImage->h};
+    list->blit(bkImage, srcrect, screenposition.x, screenposition.y);
 }
 
 void MainMenu::setInputer(CtrlKeyReader *inputer)
@@ -14,7 +14,7 @@ class MainMenu : public Widget
         ~MainMenu();
 
         void update(Uint32 frameStamp);
-        void draw(SDL_Surface *dst);
+        void render(RenderList *list);
         void setInputer(CtrlKeyReader *inputer);
 
     private:
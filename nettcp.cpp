@@ -166,6 +166,12 @@ void NetIOClient::connectSocket(const char *straddr, int port)
     freeaddrinfo(result);
 }
 
+void NetIOClient::disconnectSocket()
+{
+    close(sockfd);
+    sockfd = -1;
+}
+
 int NetIOClient::recvSocket(void *buffer, size_t length)
 {
     return read(sockfd, buffer, length);
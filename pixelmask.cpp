@@ -0,0 +1,204 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <math.h>
+#include <algorithm>
+#include "animation.h"
+#include "pixelmask.h"
+
+namespace dragonfighting {
+
+PixelMask::PixelMask(SDL_Surface *img, SDL_Rect rect, Uint32 colorkey, bool flip) :
+    w(rect.w),
+    h(rect.h),
+    wordsPerRow((rect.w + 63) / 64),
+    bits(NULL)
+{
+    if (rect.x < 0 || rect.y < 0 || rect.x + rect.w > img->w || rect.y + rect.h > img->h) {
+        throw "PixelMask: frame outside of the image";
+    }
+    bits = (Uint64 *)calloc(wordsPerRow * h + 1, sizeof(Uint64));
+    if (bits == NULL) {
+        throw "PixelMask: out of memory";
+    }
+
+    SDL_LockSurface(img);
+    for (int y=0; y<h; y++) {
+        Uint64 *row = bits + y * wordsPerRow;
+        for (int x=0; x<w; x++) {
+            int srcx = flip ? rect.x + w - 1 - x : rect.x + x;
+            if (getpixel(img, srcx, rect.y + y) != colorkey) {
+                row[x >> 6] |= 0x8000000000000000ULL >> (x & 63);
+            }
+        }
+    }
+    SDL_UnlockSurface(img);
+}
+
+PixelMask::~PixelMask()
+{
+    free(bits);
+}
+
+int PixelMask::getWidth() const
+{
+    return w;
+}
+
+int PixelMask::getHeight() const
+{
+    return h;
+}
+
+bool PixelMask::getPixel(int x, int y) const
+{
+    if (x < 0 || y < 0 || x >= w || y >= h) {
+        return false;
+    }
+    return (bits[y * wordsPerRow + (x >> 6)] & (0x8000000000000000ULL >> (x & 63))) != 0;
+}
+
+int PixelMask::countPixels() const
+{
+    int count = 0;
+    for (int i=0; i<wordsPerRow * h; i++) {
+        count += __builtin_popcountll(bits[i]);
+    }
+    return count;
+}
+
+// the 64 pixels of row y from x on, clear outside of the mask
+Uint64 PixelMask::rowWindow(int y, int x) const
+{
+    if (y < 0 || y >= h || x >= w || x <= -64) {
+        return 0;
+    }
+    const Uint64 *row = bits + y * wordsPerRow;
+    if (x < 0) {
+        return row[0] >> -x;
+    }
+    int k = x >> 6;
+    int s = x & 63;
+    Uint64 window = row[k] << s;
+    if (s != 0 && k + 1 < wordsPerRow) {
+        window |= row[k + 1] >> (64 - s);
+    }
+    return window;
+}
+
+bool PixelMask::overlap(const PixelMask *mask1, int x1, int y1,
+        const PixelMask *mask2, int x2, int y2, const struct CollisionRect &clip)
+{
+    // clip edges are inclusive like rectCollide
+    int left = std::max(std::max(x1, x2), (int)floorf(clip.x));
+    int right = std::min(std::min(x1 + mask1->w, x2 + mask2->w), (int)floorf(clip.x + clip.w) + 1);
+    int top = std::max(std::max(y1, y2), (int)floorf(clip.y));
+    int bottom = std::min(std::min(y1 + mask1->h, y2 + mask2->h), (int)floorf(clip.y + clip.h) + 1);
+
+    for (int y=top; y<bottom; y++) {
+        for (int x=left; x<right; x+=64) {
+            Uint64 columns = (right - x >= 64) ? ~0ULL : ~(~0ULL >> (right - x));
+            if (mask1->rowWindow(y - y1, x - x1) & mask2->rowWindow(y - y2, x - x2) & columns) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+}
+
+
+#ifdef FTG_TEST
+
+#include <stdio.h>
+#include <time.h>
+
+using namespace dragonfighting;
+
+static Uint64 nowNanoseconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (Uint64)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static bool pixelOverlap(const PixelMask *mask1, int x1, int y1,
+        const PixelMask *mask2, int x2, int y2, const struct CollisionRect &clip)
+{
+    for (int y=(int)floorf(clip.y); y<=(int)floorf(clip.y + clip.h); y++) {
+        for (int x=(int)floorf(clip.x); x<=(int)floorf(clip.x + clip.w); x++) {
+            if (mask1->getPixel(x - x1, y - y1) && mask2->getPixel(x - x2, y - y2)) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+// random blobs on a sheet, word test against a per pixel test
+int main(int argc, char **argv)
+{
+    int numTests = (argc >= 2) ? atoi(argv[1]) : 100000;
+    const Uint32 colorkey = 0xFF00FF;
+    SDL_Surface *sheet = SDL_CreateRGBSurface(SDL_SWSURFACE, 512, 256, 32, 0xFF0000, 0xFF00, 0xFF, 0);
+    SDL_LockSurface(sheet);
+    for (int y=0; y<sheet->h; y++) {
+        for (int x=0; x<sheet->w; x++) {
+            ((Uint32 *)((Uint8 *)sheet->pixels + y * sheet->pitch))[x] = colorkey;
+        }
+    }
+    for (int i=0; i<200; i++) {
+        int cx = rand() % sheet->w, cy = rand() % sheet->h, r = 2 + rand() % 20;
+        for (int y=std::max(cy - r, 0); y<std::min(cy + r, sheet->h); y++) {
+            for (int x=std::max(cx - r, 0); x<std::min(cx + r, sheet->w); x++) {
+                if ((x - cx) * (x - cx) + (y - cy) * (y - cy) < r * r) {
+                    ((Uint32 *)((Uint8 *)sheet->pixels + y * sheet->pitch))[x] = 0x808080;
+                }
+            }
+        }
+    }
+    SDL_UnlockSurface(sheet);
+
+    SDL_Rect frame1 = {10, 20, 150, 120};
+    SDL_Rect frame2 = {300, 100, 97, 140};
+    PixelMask *masks[4] = {
+        new PixelMask(sheet, frame1, colorkey, false), new PixelMask(sheet, frame1, colorkey, true),
+        new PixelMask(sheet, frame2, colorkey, false), new PixelMask(sheet, frame2, colorkey, true),
+    };
+    int flipErrors = 0;
+    for (int y=0; y<masks[0]->getHeight(); y++) {
+        for (int x=0; x<masks[0]->getWidth(); x++) {
+            flipErrors += masks[0]->getPixel(x, y) != masks[1]->getPixel(masks[1]->getWidth() - 1 - x, y);
+        }
+    }
+
+    int mismatches = 0, hits = 0;
+    Uint64 wordTime = 0, pixelTime = 0;
+    for (int t=0; t<numTests; t++) {
+        const PixelMask *mask1 = masks[rand() % 4];
+        const PixelMask *mask2 = masks[rand() % 4];
+        int x2 = rand() % 300 - 150, y2 = rand() % 240 - 120;
+        struct CollisionRect clip = {(float)(rand() % 300 - 150) + 0.5f, (float)(rand() % 240 - 120),
+            (float)(rand() % 160), (float)(rand() % 160)};
+
+        Uint64 t0 = nowNanoseconds();
+        bool word = PixelMask::overlap(mask1, 0, 0, mask2, x2, y2, clip);
+        Uint64 t1 = nowNanoseconds();
+        bool pixel = pixelOverlap(mask1, 0, 0, mask2, x2, y2, clip);
+        Uint64 t2 = nowNanoseconds();
+        wordTime += t1 - t0;
+        pixelTime += t2 - t1;
+        mismatches += word != pixel;
+        hits += word;
+    }
+    printf("%d tests, %d hit, %d mismatches, %d flip errors\n", numTests, hits, mismatches, flipErrors);
+    printf("word test %.1f ns, per pixel test %.1f ns\n", (double)wordTime / numTests, (double)pixelTime / numTests);
+
+    for (int i=0; i<4; i++) {
+        delete masks[i];
+    }
+    SDL_FreeSurface(sheet);
+    return mismatches != 0 || flipErrors != 0;
+}
+
+#endif
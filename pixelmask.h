@@ -0,0 +1,45 @@
+#ifndef _PIXEL_MASK_H_
+#define _PIXEL_MASK_H_
+
+#include <SDL/SDL.h>
+#include "collisiondetect.h"
+
+namespace dragonfighting {
+
+/*
+ * 1-bit opacity mask of one animation frame, built once at load from the
+ * sheet's colorkey. A row is packed into 64-bit words, the leftmost pixel
+ * in the highest bit, so two masks are tested a word (64 pixels) at a time
+ * with a shift and an AND.
+ */
+class PixelMask
+{
+protected:
+    int w;
+    int h;
+    int wordsPerRow;
+    Uint64 *bits;
+
+    Uint64 rowWindow(int y, int x) const;
+
+public:
+    // rect of img, mirrored if flip; pixels equal to colorkey are clear
+    PixelMask(SDL_Surface *img, SDL_Rect rect, Uint32 colorkey, bool flip);
+    ~PixelMask();
+
+    int getWidth() const;
+    int getHeight() const;
+    bool getPixel(int x, int y) const;
+    int countPixels() const;
+
+    /*
+     * true if a set pixel of mask1 with its top left at (x1, y1) covers a
+     * set pixel of mask2 at (x2, y2), looking only inside clip.
+     */
+    static bool overlap(const PixelMask *mask1, int x1, int y1,
+            const PixelMask *mask2, int x2, int y2, const struct CollisionRect &clip);
+};
+
+}
+
+#endif
@@ -0,0 +1,443 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+#include <algorithm>
+#include "render.h"
+#include "animation.h"
+
+namespace dragonfighting {
+
+static bool rectsOverlap(const SDL_Rect &rect1, const SDL_Rect &rect2)
+{
+    return rect1.x < rect2.x + rect2.w && rect2.x < rect1.x + rect1.w
+        && rect1.y < rect2.y + rect2.h && rect2.y < rect1.y + rect1.h;
+}
+
+static bool commandBefore(const struct RenderCommand &command1, const struct RenderCommand &command2)
+{
+    if (command1.level != command2.level) {
+        return command1.level < command2.level;
+    }
+    return command1.src < command2.src;
+}
+
+RenderList::RenderList() :
+    level(0)
+{
+}
+
+void RenderList::clear()
+{
+    commands.clear();
+    level = 0;
+}
+
+void RenderList::setLevel(Sint16 level)
+{
+    this->level = level;
+}
+
+Sint16 RenderList::getLevel()
+{
+    return level;
+}
+
+struct RenderCommand *RenderList::add(Uint8 type, const SDL_Rect &dstrect)
+{
+    commands.resize(commands.size() + 1);
+    struct RenderCommand *command = &commands.back();
+    command->type = type;
+    command->alpha = 255;
+    command->level = level;
+    command->src = NULL;
+    command->srcRect = {0, 0, 0, 0};
+    command->dstRect = dstrect;
+    command->color = 0;
+    command->text[0] = '\0';
+    return command;
+}
+
+void RenderList::blit(SDL_Surface *src, const SDL_Rect &srcrect, Sint16 x, Sint16 y)
+{
+    SDL_Rect dstrect = {x, y, srcrect.w, srcrect.h};
+    struct RenderCommand *command = add(RENDER_BLIT, dstrect);
+    command->src = src;
+    command->srcRect = srcrect;
+}
+
+void RenderList::fill(const SDL_Rect &rect, Uint8 r, Uint8 g, Uint8 b, Uint8 alpha)
+{
+    struct RenderCommand *command = add(RENDER_FILL, rect);
+    command->color = (r << 16) | (g << 8) | b;
+    command->alpha = alpha;
+}
+
+void RenderList::text(Sint16 x, Sint16 y, const char *text, Uint8 r, Uint8 g, Uint8 b)
+{
+    int length = std::min((int)strlen(text), MAX_RENDER_TEXT - 1);
+    SDL_Rect dstrect = {x, y, (Uint16)(length * FONT_ADVANCE), (Uint16)FONT_HEIGHT};
+    struct RenderCommand *command = add(RENDER_TEXT, dstrect);
+    command->color = (r << 16) | (g << 8) | b;
+    memcpy(command->text, text, length);
+    command->text[length] = '\0';
+}
+
+void RenderList::sort()
+{
+    std::stable_sort(commands.begin(), commands.end(), commandBefore);
+}
+
+const struct RenderCommand *RenderList::getCommand(int index) const
+{
+    return &commands[index];
+}
+
+int RenderList::getNumCommands() const
+{
+    return commands.size();
+}
+
+/*
+ * 3x5 glyphs, one octal digit a row from the top, 4 is the left column.
+ * ' ' to 'Z', lower case is drawn as upper case.
+ */
+static const Uint16 fontGlyphs[] = {
+    000000, 022202, 000000, 000000, 000000, 051245, 000000, 022000,   //  !"#$%&'
+    012221, 042224, 005250, 002720, 000024, 000700, 000002, 011244,   // ()*+,-./
+    075557, 026227, 071747, 071317, 055711, 074717, 074757, 071111,   // 01234567
+    075757, 075717, 002020, 002024, 012421, 007070, 042124, 061202,   // 89:;<=>?
+    000000, 025755, 065656, 034443, 065556, 074647, 074644, 034553,   // @ABCDEFG
+    055755, 072227, 011152, 055655, 044447, 057755, 065555, 025552,   // HIJKLMNO
+    065644, 025563, 065655, 034216, 072222, 055557, 055552, 055775,   // PQRSTUVW
+    055255, 055222, 071247,                                           // XYZ
+};
+
+Uint16 fontGlyph(char c)
+{
+    if (c >= 'a' && c <= 'z') {
+        c = c - 'a' + 'A';
+    }
+    if (c < ' ' || c > 'Z') {
+        return 0;
+    }
+    return fontGlyphs[c - ' '];
+}
+
+static bool glyphPixel(Uint16 glyph, int x, int y)
+{
+    return (glyph >> ((FONT_HEIGHT - 1 - y) * FONT_WIDTH + (FONT_WIDTH - 1 - x))) & 1;
+}
+
+SurfaceBackend::SurfaceBackend(SDL_Surface *dst) :
+    dst(dst)
+{
+}
+
+void SurfaceBackend::setTarget(SDL_Surface *dst)
+{
+    this->dst = dst;
+}
+
+void SurfaceBackend::fillAlpha(SDL_Rect rect, Uint32 color, Uint8 alpha)
+{
+    SDL_Surface *surface = SDL_CreateRGBSurface(SDL_SWSURFACE, rect.w, rect.h, dst->format->BitsPerPixel,
+        dst->format->Rmask, dst->format->Gmask, dst->format->Bmask, 0);
+    if (surface == NULL) {
+        return;
+    }
+    SDL_SetAlpha(surface, SDL_SRCALPHA, alpha);
+    SDL_FillRect(surface, NULL, color);
+    SDL_BlitSurface(surface, NULL, dst, &rect);
+    SDL_FreeSurface(surface);
+}
+
+// a pixel at a time, it is only for a few short labels; the clip rect cuts it
+void SurfaceBackend::drawText(const struct RenderCommand *command)
+{
+    Uint32 color = SDL_MapRGB(dst->format, command->color >> 16, command->color >> 8, command->color);
+    for (int i=0; command->text[i]!='\0'; i++) {
+        Uint16 glyph = fontGlyph(command->text[i]);
+        for (int y=0; y<FONT_HEIGHT; y++) {
+            for (int x=0; x<FONT_WIDTH; x++) {
+                if (glyphPixel(glyph, x, y)) {
+                    SDL_Rect dot = {(Sint16)(command->dstRect.x + i * FONT_ADVANCE + x),
+                        (Sint16)(command->dstRect.y + y), 1, 1};
+                    SDL_FillRect(dst, &dot, color);
+                }
+            }
+        }
+    }
+}
+
+void SurfaceBackend::execute(const RenderList &list, const SDL_Rect *clip)
+{
+    // SDL cuts the clip rect to the surface
+    SDL_SetClipRect(dst, clip);
+    SDL_Rect area = dst->clip_rect;
+    for (int i=0; i<list.getNumCommands(); i++) {
+        const struct RenderCommand *command = list.getCommand(i);
+        if (!rectsOverlap(command->dstRect, area)) {
+            continue;
+        }
+        // SDL writes the clipped result back into the rects
+        SDL_Rect srcrect = command->srcRect;
+        SDL_Rect dstrect = command->dstRect;
+        if (command->type == RENDER_BLIT) {
+            SDL_BlitSurface(command->src, &srcrect, dst, &dstrect);
+        } else if (command->type == RENDER_FILL) {
+            Uint32 color = SDL_MapRGB(dst->format, command->color >> 16, command->color >> 8, command->color);
+            if (command->alpha == 255) {
+                SDL_FillRect(dst, &dstrect, color);
+            } else {
+                fillAlpha(dstrect, color, command->alpha);
+            }
+        } else if (command->type == RENDER_TEXT) {
+            drawText(command);
+        }
+    }
+    SDL_SetClipRect(dst, NULL);
+}
+
+MemoryBackend::MemoryBackend(int width, int height) :
+    pixels(NULL),
+    width(width),
+    height(height)
+{
+    pixels = (Uint32 *)malloc(sizeof(Uint32) * width * height);
+    assert(pixels != NULL);
+    clear(0);
+}
+
+MemoryBackend::~MemoryBackend()
+{
+    free(pixels);
+}
+
+int MemoryBackend::getWidth()
+{
+    return width;
+}
+
+int MemoryBackend::getHeight()
+{
+    return height;
+}
+
+const Uint32 *MemoryBackend::getPixels()
+{
+    return pixels;
+}
+
+void MemoryBackend::clear(Uint32 color)
+{
+    for (int i=0; i<width*height; i++) {
+        pixels[i] = color;
+    }
+}
+
+// rect cut to clip, false if nothing is left
+static bool clipRect(SDL_Rect &rect, const SDL_Rect &clip)
+{
+    int left = std::max(rect.x, clip.x);
+    int top = std::max(rect.y, clip.y);
+    int right = std::min(rect.x + rect.w, clip.x + clip.w);
+    int bottom = std::min(rect.y + rect.h, clip.y + clip.h);
+    if (left >= right || top >= bottom) {
+        return false;
+    }
+    rect.x = left;
+    rect.y = top;
+    rect.w = right - left;
+    rect.h = bottom - top;
+    return true;
+}
+
+void MemoryBackend::blit(const struct RenderCommand *command, const SDL_Rect &clip)
+{
+    SDL_Surface *src = command->src;
+    // the source rect may reach out of the image, cut both the same way
+    SDL_Rect srcrect = command->srcRect;
+    SDL_Rect image = {0, 0, (Uint16)src->w, (Uint16)src->h};
+    if (!clipRect(srcrect, image)) {
+        return;
+    }
+    SDL_Rect dstrect = {(Sint16)(command->dstRect.x + srcrect.x - command->srcRect.x),
+        (Sint16)(command->dstRect.y + srcrect.y - command->srcRect.y), srcrect.w, srcrect.h};
+    if (!clipRect(dstrect, clip)) {
+        return;
+    }
+    int dx = command->srcRect.x - command->dstRect.x;
+    int dy = command->srcRect.y - command->dstRect.y;
+    bool colorkey = (src->flags & SDL_SRCCOLORKEY) != 0;
+
+    SDL_LockSurface(src);
+    for (int y=dstrect.y; y<dstrect.y+dstrect.h; y++) {
+        Uint32 *line = pixels + y * width;
+        for (int x=dstrect.x; x<dstrect.x+dstrect.w; x++) {
+            Uint32 pixel = getpixel(src, x + dx, y + dy);
+            if (colorkey && pixel == src->format->colorkey) {
+                continue;
+            }
+            Uint8 r, g, b;
+            SDL_GetRGB(pixel, src->format, &r, &g, &b);
+            line[x] = (r << 16) | (g << 8) | b;
+        }
+    }
+    SDL_UnlockSurface(src);
+}
+
+void MemoryBackend::fill(const struct RenderCommand *command, const SDL_Rect &clip)
+{
+    SDL_Rect rect = command->dstRect;
+    if (!clipRect(rect, clip)) {
+        return;
+    }
+    int alpha = command->alpha;
+    for (int y=rect.y; y<rect.y+rect.h; y++) {
+        Uint32 *line = pixels + y * width;
+        for (int x=rect.x; x<rect.x+rect.w; x++) {
+            if (alpha == 255) {
+                line[x] = command->color;
+                continue;
+            }
+            Uint32 blended = 0;
+            for (int shift=0; shift<24; shift+=8) {
+                int s = (command->color >> shift) & 0xFF;
+                int d = (line[x] >> shift) & 0xFF;
+                blended |= (Uint32)(((s - d) * alpha >> 8) + d) << shift;
+            }
+            line[x] = blended;
+        }
+    }
+}
+
+void MemoryBackend::drawText(const struct RenderCommand *command, const SDL_Rect &clip)
+{
+    for (int i=0; command->text[i]!='\0'; i++) {
+        Uint16 glyph = fontGlyph(command->text[i]);
+        for (int y=0; y<FONT_HEIGHT; y++) {
+            for (int x=0; x<FONT_WIDTH; x++) {
+                int px = command->dstRect.x + i * FONT_ADVANCE + x;
+                int py = command->dstRect.y + y;
+                if (glyphPixel(glyph, x, y) && px >= clip.x && px < clip.x + clip.w
+                        && py >= clip.y && py < clip.y + clip.h) {
+                    pixels[py * width + px] = command->color;
+                }
+            }
+        }
+    }
+}
+
+void MemoryBackend::execute(const RenderList &list, const SDL_Rect *clip)
+{
+    SDL_Rect area = {0, 0, (Uint16)width, (Uint16)height};
+    if (clip != NULL && !clipRect(area, *clip)) {
+        return;
+    }
+    for (int i=0; i<list.getNumCommands(); i++) {
+        const struct RenderCommand *command = list.getCommand(i);
+        if (!rectsOverlap(command->dstRect, area)) {
+            continue;
+        }
+        if (command->type == RENDER_BLIT) {
+            blit(command, area);
+        } else if (command->type == RENDER_FILL) {
+            fill(command, area);
+        } else if (command->type == RENDER_TEXT) {
+            drawText(command, area);
+        }
+    }
+}
+
+void MemoryBackend::save(const char *filename)
+{
+    FILE *fp = fopen(filename, "wb");
+    if (fp == NULL) {
+        fprintf(stderr, "Unable to open %s: %s\n", filename, strerror(errno));
+        throw "Unable to open image file";
+    }
+    fprintf(fp, "P6\n%d %d\n255\n", width, height);
+    for (int i=0; i<width*height; i++) {
+        unsigned char rgb[3] = {(unsigned char)(pixels[i] >> 16), (unsigned char)(pixels[i] >> 8), (unsigned char)pixels[i]};
+        if (fwrite(rgb, 1, 3, fp) != 3) {
+            fclose(fp);
+            throw "Write image failed";
+        }
+    }
+    fclose(fp);
+}
+
+RenderThread::RenderThread(RenderBackend *backend) :
+    backend(backend),
+    thread(NULL),
+    running(false),
+    pending(NULL)
+{
+}
+
+RenderThread::~RenderThread()
+{
+    stop();
+}
+
+void RenderThread::start()
+{
+    if (thread != NULL) {
+        return;
+    }
+    running.store(true);
+    thread = SDL_CreateThread(threadMain, this);
+    if (thread == NULL) {
+        running.store(false);
+        throw "Unable to create render thread";
+    }
+}
+
+void RenderThread::stop()
+{
+    if (thread == NULL) {
+        return;
+    }
+    wait();
+    running.store(false);
+    SDL_WaitThread(thread, NULL);
+    thread = NULL;
+}
+
+void RenderThread::submit(const RenderList *list)
+{
+    assert(pending.load() == NULL);
+    if (thread == NULL) {
+        // not started, draw right here
+        backend->execute(*list, NULL);
+        return;
+    }
+    pending.store(list, std::memory_order_release);
+}
+
+void RenderThread::wait()
+{
+    while (pending.load(std::memory_order_acquire) != NULL) {
+        SDL_Delay(1);
+    }
+}
+
+int RenderThread::threadMain(void *data)
+{
+    RenderThread *renderer = (RenderThread *)data;
+
+    while (renderer->running.load(std::memory_order_acquire)) {
+        const RenderList *list = renderer->pending.load(std::memory_order_acquire);
+        if (list == NULL) {
+            SDL_Delay(1);
+            continue;
+        }
+        renderer->backend->execute(*list, NULL);
+        renderer->pending.store(NULL, std::memory_order_release);
+    }
+    return 0;
+}
+
+}
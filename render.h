@@ -0,0 +1,148 @@
+#ifndef _RENDER_H_
+#define _RENDER_H_
+
+#include <atomic>
+#include <vector>
+#include <SDL/SDL.h>
+
+using std::vector;
+
+namespace dragonfighting {
+
+enum RenderCommandType {
+    RENDER_BLIT,
+    RENDER_FILL,
+    RENDER_TEXT,
+};
+
+const int MAX_RENDER_TEXT = 32;
+
+struct RenderCommand {
+    Uint8 type;
+    Uint8 alpha;                // fills only, 255 is opaque
+    Sint16 level;               // draw order, lower first
+    SDL_Surface *src;           // blits only
+    SDL_Rect srcRect;
+    SDL_Rect dstRect;           // blit destination, fill area, text bounds
+    Uint32 color;               // 0xRRGGBB, mapped by the backend
+    char text[MAX_RENDER_TEXT];
+};
+
+/*
+ * What a frame draws, as a list of commands a backend executes later,
+ * possibly on another thread. The source surfaces have to outlive the
+ * execution.
+ */
+class RenderList
+{
+    private:
+        vector<struct RenderCommand> commands;
+        Sint16 level;
+
+        struct RenderCommand *add(Uint8 type, const SDL_Rect &dstrect);
+
+    public:
+        RenderList();
+
+        void clear();
+        // level of the commands added from now on
+        void setLevel(Sint16 level);
+        Sint16 getLevel();
+        void blit(SDL_Surface *src, const SDL_Rect &srcrect, Sint16 x, Sint16 y);
+        void fill(const SDL_Rect &rect, Uint8 r, Uint8 g, Uint8 b, Uint8 alpha = 255);
+        void text(Sint16 x, Sint16 y, const char *text, Uint8 r, Uint8 g, Uint8 b);
+        /*
+         * Order by level, then by source surface so blits from one image
+         * run together. Equal keys keep the order they were added in, so
+         * commands of one level may only rely on order when they share the
+         * source.
+         */
+        void sort();
+        const struct RenderCommand *getCommand(int index) const;
+        int getNumCommands() const;
+};
+
+// the tiny built in font, upper case, digits and some punctuation
+const int FONT_WIDTH = 3;
+const int FONT_HEIGHT = 5;
+const int FONT_ADVANCE = FONT_WIDTH + 1;
+// FONT_WIDTH * FONT_HEIGHT bits, row by row from the top left, 0 if unknown
+Uint16 fontGlyph(char c);
+
+class RenderBackend
+{
+    public:
+        virtual ~RenderBackend() {};
+        // clip NULL draws the whole target
+        virtual void execute(const RenderList &list, const SDL_Rect *clip) = 0;
+};
+
+// the SDL 1.2 surface path, a software screen or any other surface
+class SurfaceBackend : public RenderBackend
+{
+    private:
+        SDL_Surface *dst;
+
+        void fillAlpha(SDL_Rect rect, Uint32 color, Uint8 alpha);
+        void drawText(const struct RenderCommand *command);
+
+    public:
+        SurfaceBackend(SDL_Surface *dst);
+        void setTarget(SDL_Surface *dst);
+        virtual void execute(const RenderList &list, const SDL_Rect *clip);
+};
+
+// offscreen 0xRRGGBB framebuffer in plain memory, needs no video mode
+class MemoryBackend : public RenderBackend
+{
+    private:
+        Uint32 *pixels;
+        int width;
+        int height;
+
+        void blit(const struct RenderCommand *command, const SDL_Rect &clip);
+        void fill(const struct RenderCommand *command, const SDL_Rect &clip);
+        void drawText(const struct RenderCommand *command, const SDL_Rect &clip);
+
+    public:
+        MemoryBackend(int width, int height);
+        ~MemoryBackend();
+        int getWidth();
+        int getHeight();
+        const Uint32 *getPixels();
+        void clear(Uint32 color);
+        virtual void execute(const RenderList &list, const SDL_Rect *clip);
+        // binary ppm
+        void save(const char *filename);
+};
+
+/*
+ * Executes submitted lists on a backend from a thread of its own. The
+ * producer submits a list, keeps building the next one in another list
+ * and waits before it touches the target or reuses the submitted list.
+ */
+class RenderThread
+{
+    private:
+        RenderBackend *backend;
+        SDL_Thread *thread;
+        std::atomic<bool> running;
+        std::atomic<const RenderList *> pending;
+
+        static int threadMain(void *data);
+
+    public:
+        RenderThread(RenderBackend *backend);
+        ~RenderThread();
+
+        void start();
+        void stop();
+        // the previous list must be done, see wait
+        void submit(const RenderList *list);
+        // until the last submitted list is executed
+        void wait();
+};
+
+}
+
+#endif
@@ -0,0 +1,242 @@
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <algorithm>
+#include "replay.h"
+#include "inputcodec.h"
+
+namespace dragonfighting {
+
+static bool eventFrameCompare(const struct Ctrl_KeyEvent &e1, const struct Ctrl_KeyEvent &e2)
+{
+    return e1.frameStamp < e2.frameStamp;
+}
+
+ReplayWriter::ReplayWriter(AsyncWriter *writer) :
+    writer(writer),
+    chunkFirstFrame(0)
+{
+    assert(writer != NULL);
+    heldState[0] = 0;
+    heldState[1] = 0;
+}
+
+ReplayWriter::~ReplayWriter()
+{
+}
+
+void ReplayWriter::writeRecordHeader(Uint32 type, Uint32 frame, Uint32 count, Uint32 length)
+{
+    struct ReplayRecordHeader header = {type, frame, count, length};
+    chunkBuffer.insert(chunkBuffer.end(), (unsigned char *)&header, (unsigned char *)&header + sizeof(header));
+}
+
+void ReplayWriter::begin(Uint32 matchId, const char *character1, const char *character2, Uint32 firstFrame)
+{
+    struct ReplayHeader header;
+    memset(&header, 0, sizeof(header));
+    header.magic = REPLAY_MAGIC;
+    header.version = REPLAY_VERSION;
+    header.matchId = matchId;
+    strncpy(header.characters[0], character1, sizeof(header.characters[0]) - 1);
+    strncpy(header.characters[1], character2, sizeof(header.characters[1]) - 1);
+    writer->writeRecord(&header, sizeof(header));
+
+    chunkEvents.clear();
+    chunkFirstFrame = firstFrame;
+    heldState[0] = 0;
+    heldState[1] = 0;
+}
+
+void ReplayWriter::writeEvent(struct Ctrl_KeyEvent *event)
+{
+    chunkEvents.push_back(*event);
+}
+
+void ReplayWriter::writeCommand(Uint32 frame, int player, const char *name)
+{
+    struct ReplayCommandRecord record;
+    memset(&record, 0, sizeof(record));
+    record.player = player;
+    strncpy(record.name, name, sizeof(record.name) - 1);
+
+    chunkBuffer.clear();
+    writeRecordHeader(REPLAY_COMMAND, frame, 1, sizeof(record));
+    chunkBuffer.insert(chunkBuffer.end(), (unsigned char *)&record, (unsigned char *)&record + sizeof(record));
+    writer->writeRecord(&chunkBuffer[0], chunkBuffer.size());
+}
+
+void ReplayWriter::writeHit(Uint32 frame, int attacker, int defender, int attackerState, const char *command)
+{
+    struct ReplayHitRecord record;
+    memset(&record, 0, sizeof(record));
+    record.attacker = attacker;
+    record.defender = defender;
+    record.attackerState = attackerState;
+    if (command != NULL) {
+        strncpy(record.command, command, sizeof(record.command) - 1);
+    }
+
+    chunkBuffer.clear();
+    writeRecordHeader(REPLAY_HIT, frame, 1, sizeof(record));
+    chunkBuffer.insert(chunkBuffer.end(), (unsigned char *)&record, (unsigned char *)&record + sizeof(record));
+    writer->writeRecord(&chunkBuffer[0], chunkBuffer.size());
+}
+
+void ReplayWriter::flushInput(Uint32 endFrame)
+{
+    if (endFrame <= chunkFirstFrame) {
+        return;
+    }
+    Uint32 count = endFrame - chunkFirstFrame;
+
+    // states are absolute per frame, so every chunk decodes on its own
+    vector<unsigned char> payload;
+    chunkStates.resize(count);
+    for (char controler = 1; controler <= 2; controler++) {
+        // keys still held at the end of the previous chunk
+        InputCodec::eventsToFrames(chunkEvents.data(), chunkEvents.size(), controler,
+                chunkFirstFrame, count, &chunkStates[0], heldState[controler - 1]);
+        heldState[controler - 1] = chunkStates[count - 1];
+        InputCodec::encode(&chunkStates[0], count, true, payload);
+    }
+
+    chunkBuffer.clear();
+    writeRecordHeader(REPLAY_INPUT, chunkFirstFrame, count, payload.size());
+    chunkBuffer.insert(chunkBuffer.end(), payload.begin(), payload.end());
+    writer->writeRecord(&chunkBuffer[0], chunkBuffer.size());
+
+    chunkEvents.clear();
+    chunkFirstFrame = endFrame;
+}
+
+void ReplayWriter::endFrame(Uint32 frame)
+{
+    if (frame + 1 - chunkFirstFrame >= REPLAY_CHUNK_FRAMES) {
+        flushInput(frame + 1);
+    }
+}
+
+void ReplayWriter::end(Uint32 numFrames)
+{
+    flushInput(numFrames);
+
+    chunkBuffer.clear();
+    writeRecordHeader(REPLAY_END, numFrames, 0, 0);
+    writer->writeRecord(&chunkBuffer[0], chunkBuffer.size());
+}
+
+
+ReplayFile::ReplayFile() :
+    numFrames(0)
+{
+    memset(&header, 0, sizeof(header));
+}
+
+void ReplayFile::load(const char *filename, bool withInputs)
+{
+    FILE *fp = fopen(filename, "rb");
+    if (fp == NULL) {
+        fprintf(stderr, "Unable to open %s\n", filename);
+        throw "Unable to open";
+    }
+    vector<unsigned char> data;
+    unsigned char buffer[4096];
+    size_t n;
+    while ((n = fread(buffer, 1, sizeof(buffer), fp)) > 0) {
+        data.insert(data.end(), buffer, buffer + n);
+    }
+    fclose(fp);
+
+    if (data.size() < sizeof(header)) {
+        throw "Replay too short";
+    }
+    memcpy(&header, &data[0], sizeof(header));
+    if (header.magic != REPLAY_MAGIC || header.version != REPLAY_VERSION) {
+        throw "Not a replay file";
+    }
+
+    events.clear();
+    commands.clear();
+    hits.clear();
+    numFrames = 0;
+
+    unsigned char heldState[2] = {0, 0};
+    vector<unsigned char> states;
+    size_t pos = sizeof(header);
+    while (pos + sizeof(struct ReplayRecordHeader) <= data.size()) {
+        struct ReplayRecordHeader record;
+        memcpy(&record, &data[pos], sizeof(record));
+        pos += sizeof(record);
+        if (record.length > data.size() - pos) {
+            throw "Truncated replay record";
+        }
+        const unsigned char *payload = &data[pos];
+        pos += record.length;
+
+        if (record.type == REPLAY_INPUT) {
+            if (!withInputs) {
+                continue;
+            }
+            size_t chunkStart = events.size();
+            size_t consumed = 0;
+            for (char controler = 1; controler <= 2; controler++) {
+                states.clear();
+                size_t ret = InputCodec::decode(payload + consumed, record.length - consumed, states);
+                if (ret == 0 || record.count == 0 || states.size() != record.count) {
+                    throw "Corrupt replay input";
+                }
+                consumed += ret;
+                InputCodec::framesToEvents(&states[0], record.count, record.frame, controler, events,
+                        heldState[controler - 1]);
+                heldState[controler - 1] = states[record.count - 1];
+            }
+            std::stable_sort(events.begin() + chunkStart, events.end(), eventFrameCompare);
+        } else if (record.type == REPLAY_COMMAND) {
+            struct Command command;
+            command.frame = record.frame;
+            memcpy(&command.record, payload, std::min((size_t)record.length, sizeof(command.record)));
+            command.record.name[sizeof(command.record.name) - 1] = '\0';
+            commands.push_back(command);
+        } else if (record.type == REPLAY_HIT) {
+            struct Hit hit;
+            hit.frame = record.frame;
+            memcpy(&hit.record, payload, std::min((size_t)record.length, sizeof(hit.record)));
+            hit.record.command[sizeof(hit.record.command) - 1] = '\0';
+            hits.push_back(hit);
+        } else if (record.type == REPLAY_END) {
+            numFrames = record.frame;
+        }
+    }
+}
+
+
+ReplayReader::ReplayReader(const ReplayFile *replay, char controler) :
+    replay(replay),
+    controler(controler),
+    index(0)
+{
+    assert(replay != NULL);
+}
+
+ReplayReader::~ReplayReader()
+{
+}
+
+int ReplayReader::readEvent(struct Ctrl_KeyEvent *event, Uint32 frameStamp)
+{
+    while (index < replay->events.size()) {
+        const struct Ctrl_KeyEvent *next = &replay->events[index];
+        if (next->frameStamp > frameStamp) {
+            return 0;
+        }
+        index++;
+        if (next->controler == controler && next->frameStamp == frameStamp) {
+            *event = *next;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+}
@@ -0,0 +1,129 @@
+#ifndef _REPLAY_H_
+#define _REPLAY_H_
+
+#include <vector>
+#include <SDL/SDL.h>
+#include "keystream.h"
+#include "asyncwriter.h"
+
+using std::vector;
+
+namespace dragonfighting {
+
+/*
+ * Replay file: a ReplayHeader followed by records. Each record is a
+ * ReplayRecordHeader and `length` bytes of payload:
+ *
+ *   REPLAY_INPUT    InputCodec blob of controler 1, then of controler 2,
+ *                   covering `count` frames starting at `frame`
+ *   REPLAY_COMMAND  ReplayCommandRecord, a command recognized by a KeyFilter
+ *   REPLAY_HIT      ReplayHitRecord, a hit that landed
+ *   REPLAY_END      no payload, `frame` is the match length in frames
+ */
+const Uint32 REPLAY_MAGIC = 0x50524644; // "DFRP"
+const Uint32 REPLAY_VERSION = 1;
+const Uint32 REPLAY_CHUNK_FRAMES = 600;
+
+enum ReplayRecordType {
+    REPLAY_INPUT = 1,
+    REPLAY_COMMAND,
+    REPLAY_HIT,
+    REPLAY_END,
+};
+
+struct ReplayHeader {
+    Uint32 magic;
+    Uint32 version;
+    Uint32 matchId;
+    char characters[2][16];
+};
+
+struct ReplayRecordHeader {
+    Uint32 type;
+    Uint32 frame;
+    Uint32 count;
+    Uint32 length;
+};
+
+struct ReplayCommandRecord {
+    Uint8 player;   // fighter number, 1 based
+    char name[16];
+};
+
+struct ReplayHitRecord {
+    Uint8 attacker; // fighter number, 1 based
+    Uint8 defender;
+    Uint8 attackerState;
+    char command[16];   // command that started the attacker's state, may be empty
+};
+
+class ReplayWriter : public CtrlKeyWriter
+{
+protected:
+    AsyncWriter *writer;
+    vector<struct Ctrl_KeyEvent> chunkEvents;
+    vector<unsigned char> chunkStates;
+    vector<unsigned char> chunkBuffer;
+    Uint32 chunkFirstFrame;
+    unsigned char heldState[2];
+
+    void writeRecordHeader(Uint32 type, Uint32 frame, Uint32 count, Uint32 length);
+    void flushInput(Uint32 endFrame);
+
+public:
+    ReplayWriter(AsyncWriter *writer);
+    virtual ~ReplayWriter();
+
+    void begin(Uint32 matchId, const char *character1, const char *character2, Uint32 firstFrame);
+    virtual void writeEvent(struct Ctrl_KeyEvent *event);
+    void writeCommand(Uint32 frame, int player, const char *name);
+    void writeHit(Uint32 frame, int attacker, int defender, int attackerState, const char *command);
+    void endFrame(Uint32 frame);
+    void end(Uint32 numFrames);
+};
+
+/*
+ * Whole replay parsed into memory.
+ */
+class ReplayFile
+{
+public:
+    struct Command {
+        Uint32 frame;
+        struct ReplayCommandRecord record;
+    };
+    struct Hit {
+        Uint32 frame;
+        struct ReplayHitRecord record;
+    };
+
+    struct ReplayHeader header;
+    Uint32 numFrames;
+    vector<struct Ctrl_KeyEvent> events;    // both controlers, frame ordered
+    vector<struct Command> commands;
+    vector<struct Hit> hits;
+
+    ReplayFile();
+
+    // throw const char * on malformed file; skip inputs when only the
+    // metadata is wanted
+    void load(const char *filename, bool withInputs = true);
+};
+
+class ReplayReader : public CtrlKeyReader
+{
+protected:
+    const ReplayFile *replay;
+    char controler;
+    size_t index;
+
+public:
+    ReplayReader(const ReplayFile *replay, char controler);
+    virtual ~ReplayReader();
+
+    virtual int readEvent(struct Ctrl_KeyEvent *event, Uint32 frameStamp);
+};
+
+}
+
+#endif
@@ -0,0 +1,454 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <map>
+#include <string>
+#include <algorithm>
+#include "replayindex.h"
+#include "replay.h"
+
+using std::map;
+using std::string;
+
+namespace dragonfighting {
+
+struct MatchStats {
+    Uint32 matchId;
+    Uint32 duration;
+    Uint32 characters[2];
+    Uint32 hits[2];
+    map<string, Uint32> commandUses;
+    map<string, Uint32> commandHits;
+};
+
+static Uint16 saturate16(Uint32 value)
+{
+    return value > 0xFFFF ? 0xFFFF : (Uint16)value;
+}
+
+static Uint32 lookupName(map<string, Uint32> &dictionary, const char *name)
+{
+    map<string, Uint32>::iterator i = dictionary.find(name);
+    if (i == dictionary.end()) {
+        Uint32 index = dictionary.size();
+        dictionary[name] = index;
+        return index;
+    }
+    return i->second;
+}
+
+int ReplayIndex::build(const char *replayDir, const char *indexFilename)
+{
+    DIR *dir = opendir(replayDir);
+    if (dir == NULL) {
+        fprintf(stderr, "Unable to open %s: %s\n", replayDir, strerror(errno));
+        throw "Unable to open replay directory";
+    }
+    vector<string> filenames;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] == '.') {
+            continue;
+        }
+        filenames.push_back(string(replayDir) + "/" + entry->d_name);
+    }
+    closedir(dir);
+    std::sort(filenames.begin(), filenames.end());
+
+    // pass 1: pull the metadata out of every replay
+    vector<struct MatchStats> matches;
+    map<string, Uint32> characterDict;
+    map<string, Uint32> commandDict;
+    ReplayFile replay;
+    for (vector<string>::iterator f = filenames.begin(); f != filenames.end(); ++f) {
+        try {
+            replay.load(f->c_str(), false);
+        } catch (const char *e) {
+            fprintf(stderr, "Skip %s: %s\n", f->c_str(), e);
+            continue;
+        }
+
+        struct MatchStats stats;
+        stats.matchId = replay.header.matchId;
+        stats.duration = replay.numFrames;
+        for (int p=0; p<2; p++) {
+            replay.header.characters[p][sizeof(replay.header.characters[p]) - 1] = '\0';
+            stats.characters[p] = lookupName(characterDict, replay.header.characters[p]);
+            stats.hits[p] = 0;
+        }
+        for (vector<ReplayFile::Command>::iterator c = replay.commands.begin(); c != replay.commands.end(); ++c) {
+            lookupName(commandDict, c->record.name);
+            stats.commandUses[c->record.name] ++;
+        }
+        for (vector<ReplayFile::Hit>::iterator h = replay.hits.begin(); h != replay.hits.end(); ++h) {
+            if (h->record.attacker >= 1 && h->record.attacker <= 2) {
+                stats.hits[h->record.attacker - 1] ++;
+            }
+            if (h->record.command[0] != '\0') {
+                lookupName(commandDict, h->record.command);
+                stats.commandHits[h->record.command] ++;
+            }
+        }
+        matches.push_back(stats);
+    }
+
+    // pass 2: lay out the columns
+    Uint32 numRows = matches.size();
+    vector<struct ReplayIndexColumn> columns;
+    struct ReplayIndexColumn column;
+    const char *fixedColumns[] = {"match_id", "duration", "character1", "character2", "hits_p1", "hits_p2"};
+    const Uint32 fixedTypes[] = {COLUMN_U32, COLUMN_U32, COLUMN_U16, COLUMN_U16, COLUMN_U16, COLUMN_U16};
+    for (unsigned int i=0; i<sizeof(fixedColumns)/sizeof(fixedColumns[0]); i++) {
+        memset(&column, 0, sizeof(column));
+        strncpy(column.name, fixedColumns[i], sizeof(column.name) - 1);
+        column.type = fixedTypes[i];
+        columns.push_back(column);
+    }
+    vector<string> commandNames(commandDict.size());
+    for (map<string, Uint32>::iterator i = commandDict.begin(); i != commandDict.end(); ++i) {
+        commandNames[i->second] = i->first;
+    }
+    for (vector<string>::iterator i = commandNames.begin(); i != commandNames.end(); ++i) {
+        memset(&column, 0, sizeof(column));
+        snprintf(column.name, sizeof(column.name), "uses:%s", i->c_str());
+        column.type = COLUMN_U16;
+        columns.push_back(column);
+        memset(&column, 0, sizeof(column));
+        snprintf(column.name, sizeof(column.name), "hits:%s", i->c_str());
+        column.type = COLUMN_U16;
+        columns.push_back(column);
+    }
+
+    size_t offset = sizeof(struct ReplayIndexHeader)
+        + sizeof(struct ReplayIndexColumn) * columns.size()
+        + 16 * characterDict.size();
+    for (vector<struct ReplayIndexColumn>::iterator i = columns.begin(); i != columns.end(); ++i) {
+        offset = (offset + 7) & ~(size_t)7;
+        i->offset = offset;
+        offset += (size_t)i->type * numRows;
+    }
+
+    vector<unsigned char> data((offset + 7) & ~(size_t)7, 0);
+    struct ReplayIndexHeader header = {REPLAY_INDEX_MAGIC, REPLAY_INDEX_VERSION, numRows,
+        (Uint32)columns.size(), (Uint32)characterDict.size(), 0};
+    memcpy(&data[0], &header, sizeof(header));
+    memcpy(&data[sizeof(header)], &columns[0], sizeof(struct ReplayIndexColumn) * columns.size());
+    char *characterTable = (char *)&data[sizeof(header) + sizeof(struct ReplayIndexColumn) * columns.size()];
+    for (map<string, Uint32>::iterator i = characterDict.begin(); i != characterDict.end(); ++i) {
+        strncpy(characterTable + 16 * i->second, i->first.c_str(), 15);
+    }
+
+    for (Uint32 row=0; row<numRows; row++) {
+        struct MatchStats &stats = matches[row];
+        ((Uint32 *)&data[columns[0].offset])[row] = stats.matchId;
+        ((Uint32 *)&data[columns[1].offset])[row] = stats.duration;
+        ((Uint16 *)&data[columns[2].offset])[row] = saturate16(stats.characters[0]);
+        ((Uint16 *)&data[columns[3].offset])[row] = saturate16(stats.characters[1]);
+        ((Uint16 *)&data[columns[4].offset])[row] = saturate16(stats.hits[0]);
+        ((Uint16 *)&data[columns[5].offset])[row] = saturate16(stats.hits[1]);
+        for (Uint32 c=0; c<commandNames.size(); c++) {
+            ((Uint16 *)&data[columns[6 + 2 * c].offset])[row] = saturate16(stats.commandUses[commandNames[c]]);
+            ((Uint16 *)&data[columns[7 + 2 * c].offset])[row] = saturate16(stats.commandHits[commandNames[c]]);
+        }
+    }
+
+    FILE *fp = fopen(indexFilename, "wb");
+    if (fp == NULL) {
+        fprintf(stderr, "Unable to open %s: %s\n", indexFilename, strerror(errno));
+        throw "Unable to open index file";
+    }
+    if (fwrite(&data[0], 1, data.size(), fp) != data.size()) {
+        fclose(fp);
+        throw "Write index failed";
+    }
+    fclose(fp);
+
+    return numRows;
+}
+
+
+ReplayIndex::ReplayIndex() :
+    fd(-1),
+    base(NULL),
+    size(0),
+    header(NULL),
+    columns(NULL),
+    characters(NULL)
+{
+}
+
+ReplayIndex::~ReplayIndex()
+{
+    close();
+}
+
+void ReplayIndex::open(const char *indexFilename)
+{
+    struct stat st;
+
+    close();
+    fd = ::open(indexFilename, O_RDONLY);
+    if (fd == -1) {
+        fprintf(stderr, "Unable to open %s: %s\n", indexFilename, strerror(errno));
+        throw "Unable to open";
+    }
+    if (fstat(fd, &st) == -1 || (size_t)st.st_size < sizeof(struct ReplayIndexHeader)) {
+        close();
+        throw "Index file too short";
+    }
+    size = st.st_size;
+    void *addr = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (addr == MAP_FAILED) {
+        close();
+        throw "mmap failed";
+    }
+    base = (const unsigned char *)addr;
+
+    header = (const struct ReplayIndexHeader *)base;
+    if (header->magic != REPLAY_INDEX_MAGIC || header->version != REPLAY_INDEX_VERSION) {
+        close();
+        throw "Not a replay index";
+    }
+    size_t tableEnd = sizeof(struct ReplayIndexHeader)
+        + sizeof(struct ReplayIndexColumn) * header->numColumns
+        + 16 * header->numCharacters;
+    if (tableEnd > size) {
+        close();
+        throw "Corrupt replay index";
+    }
+    columns = (const struct ReplayIndexColumn *)(base + sizeof(struct ReplayIndexHeader));
+    characters = (const char (*)[16])(columns + header->numColumns);
+    for (Uint32 i=0; i<header->numColumns; i++) {
+        if (columns[i].offset + (size_t)columns[i].type * header->numRows > size) {
+            close();
+            throw "Corrupt replay index";
+        }
+    }
+}
+
+void ReplayIndex::close()
+{
+    if (base != NULL) {
+        munmap((void *)base, size);
+        base = NULL;
+    }
+    if (fd != -1) {
+        ::close(fd);
+        fd = -1;
+    }
+    header = NULL;
+    columns = NULL;
+    characters = NULL;
+    size = 0;
+}
+
+Uint32 ReplayIndex::getNumRows()
+{
+    return header != NULL ? header->numRows : 0;
+}
+
+int ReplayIndex::getNumColumns()
+{
+    return header != NULL ? header->numColumns : 0;
+}
+
+const char *ReplayIndex::getColumnName(int column)
+{
+    return columns[column].name;
+}
+
+int ReplayIndex::findColumn(const char *name)
+{
+    for (int i=0; i<getNumColumns(); i++) {
+        if (strncmp(columns[i].name, name, sizeof(columns[i].name)) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+int ReplayIndex::findCharacter(const char *name)
+{
+    for (Uint32 i=0; header != NULL && i<header->numCharacters; i++) {
+        if (strncmp(characters[i], name, 16) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+const char *ReplayIndex::getCharacterName(Uint32 index)
+{
+    if (header == NULL || index >= header->numCharacters) {
+        return "";
+    }
+    return characters[index];
+}
+
+Uint32 ReplayIndex::getValue(int column, Uint32 row)
+{
+    const unsigned char *data = base + columns[column].offset;
+    if (columns[column].type == COLUMN_U16) {
+        return ((const Uint16 *)data)[row];
+    }
+    return ((const Uint32 *)data)[row];
+}
+
+template <typename T>
+static void filterColumn(const T *data, Uint32 n, enum ReplayIndex::Op op, Uint32 value, unsigned char *selection)
+{
+    switch (op) {
+        case ReplayIndex::OP_EQ:
+            for (Uint32 i=0; i<n; i++) selection[i] &= (data[i] == value);
+            break;
+        case ReplayIndex::OP_NE:
+            for (Uint32 i=0; i<n; i++) selection[i] &= (data[i] != value);
+            break;
+        case ReplayIndex::OP_LT:
+            for (Uint32 i=0; i<n; i++) selection[i] &= (data[i] < value);
+            break;
+        case ReplayIndex::OP_LE:
+            for (Uint32 i=0; i<n; i++) selection[i] &= (data[i] <= value);
+            break;
+        case ReplayIndex::OP_GT:
+            for (Uint32 i=0; i<n; i++) selection[i] &= (data[i] > value);
+            break;
+        case ReplayIndex::OP_GE:
+            for (Uint32 i=0; i<n; i++) selection[i] &= (data[i] >= value);
+            break;
+        default:
+            break;
+    }
+}
+
+void ReplayIndex::select(int column, enum Op op, Uint32 value, vector<unsigned char> &selection)
+{
+    Uint32 n = getNumRows();
+    selection.resize(n, 1);
+    if (n == 0) {
+        return;
+    }
+    const unsigned char *data = base + columns[column].offset;
+    if (columns[column].type == COLUMN_U16) {
+        filterColumn((const Uint16 *)data, n, op, value, &selection[0]);
+    } else {
+        filterColumn((const Uint32 *)data, n, op, value, &selection[0]);
+    }
+}
+
+}
+
+
+#ifdef FTG_TEST
+
+#include <stdlib.h>
+#include <time.h>
+
+using namespace dragonfighting;
+
+static double nowMilliseconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+
+static bool parseOp(const char *text, enum ReplayIndex::Op &op)
+{
+    const char *names[] = {"=", "!=", "<", "<=", ">", ">="};
+    for (int i=0; i<6; i++) {
+        if (strcmp(text, names[i]) == 0) {
+            op = (enum ReplayIndex::Op)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+static void usage(const char *name)
+{
+    printf("usage: %s index <replaydir> <indexfile>\n", name);
+    printf("       %s query <indexfile> [<column> <op> <value>]...\n", name);
+    printf("       e.g. %s query corpus.idx hits:6323A '>' 5 character1 = minotaur\n", name);
+}
+
+int main(int argc, char **argv)
+{
+    if (argc >= 4 && strcmp(argv[1], "index") == 0) {
+        try {
+            double t0 = nowMilliseconds();
+            int rows = ReplayIndex::build(argv[2], argv[3]);
+            printf("indexed %d replays in %.1f ms\n", rows, nowMilliseconds() - t0);
+        } catch (const char *e) {
+            fprintf(stderr, "Error: %s\n", e);
+            return 1;
+        }
+        return 0;
+    }
+
+    if (argc < 3 || strcmp(argv[1], "query") != 0 || (argc - 3) % 3 != 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    ReplayIndex index;
+    try {
+        index.open(argv[2]);
+    } catch (const char *e) {
+        fprintf(stderr, "Error: %s\n", e);
+        return 1;
+    }
+
+    double t0 = nowMilliseconds();
+    vector<unsigned char> selection(index.getNumRows(), 1);
+    for (int i=3; i<argc; i+=3) {
+        int column = index.findColumn(argv[i]);
+        enum ReplayIndex::Op op;
+        if (column < 0) {
+            fprintf(stderr, "Unknown column %s\n", argv[i]);
+            return 1;
+        }
+        if (!parseOp(argv[i + 1], op)) {
+            fprintf(stderr, "Unknown operator %s\n", argv[i + 1]);
+            return 1;
+        }
+        Uint32 value;
+        if (strncmp(argv[i], "character", 9) == 0) {
+            int character = index.findCharacter(argv[i + 2]);
+            if (character < 0) {
+                // no such character: every row differs from it, none
+                // equals it, and ids have no order to compare it by
+                if (op != ReplayIndex::OP_NE) {
+                    std::fill(selection.begin(), selection.end(), 0);
+                }
+                continue;
+            }
+            value = character;
+        } else {
+            value = strtoul(argv[i + 2], NULL, 10);
+        }
+        index.select(column, op, value, selection);
+    }
+    double t1 = nowMilliseconds();
+
+    Uint32 matched = 0;
+    printf("%10s %8s %-16s %-16s\n", "match_id", "frames", "character1", "character2");
+    for (Uint32 row=0; row<index.getNumRows(); row++) {
+        if (!selection[row]) {
+            continue;
+        }
+        matched ++;
+        printf("%10u %8u %-16s %-16s\n", index.getValue(0, row), index.getValue(1, row),
+                index.getCharacterName(index.getValue(2, row)), index.getCharacterName(index.getValue(3, row)));
+    }
+    printf("%u of %u matches, query took %.3f ms\n", matched, index.getNumRows(), t1 - t0);
+
+    return 0;
+}
+
+#endif
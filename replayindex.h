@@ -0,0 +1,90 @@
+#ifndef _REPLAY_INDEX_H_
+#define _REPLAY_INDEX_H_
+
+#include <vector>
+#include <SDL/SDL.h>
+
+using std::vector;
+
+namespace dragonfighting {
+
+/*
+ * Columnar index over a directory of replays, one row per match.
+ *
+ * File layout: ReplayIndexHeader, numColumns ReplayIndexColumn, the
+ * character name dictionary (numCharacters x 16 bytes), then every column
+ * as a plain array of numRows values, 8-byte aligned.
+ *
+ * Columns: match_id, duration (frames), character1, character2 (index in
+ * the dictionary), hits_p1, hits_p2, and for every command seen in the
+ * corpus uses:<command> (times recognized by KeyFilter, both players) and
+ * hits:<command> (hits landed from a state that command started).
+ */
+const Uint32 REPLAY_INDEX_MAGIC = 0x49524644; // "DFRI"
+const Uint32 REPLAY_INDEX_VERSION = 1;
+
+struct ReplayIndexHeader {
+    Uint32 magic;
+    Uint32 version;
+    Uint32 numRows;
+    Uint32 numColumns;
+    Uint32 numCharacters;
+    Uint32 reserved;
+};
+
+struct ReplayIndexColumn {
+    char name[32];
+    Uint32 type;
+    Uint32 offset;  // from the beginning of file
+};
+
+class ReplayIndex
+{
+public:
+    enum ColumnType {
+        COLUMN_U16 = 2,
+        COLUMN_U32 = 4,
+    };
+
+    enum Op {
+        OP_EQ,
+        OP_NE,
+        OP_LT,
+        OP_LE,
+        OP_GT,
+        OP_GE,
+    };
+
+protected:
+    int fd;
+    const unsigned char *base;
+    size_t size;
+    const struct ReplayIndexHeader *header;
+    const struct ReplayIndexColumn *columns;
+    const char (*characters)[16];
+
+public:
+    ReplayIndex();
+    ~ReplayIndex();
+
+    // scan replayDir and write the index, return the number of replays indexed
+    static int build(const char *replayDir, const char *indexFilename);
+
+    void open(const char *indexFilename);
+    void close();
+
+    Uint32 getNumRows();
+    int getNumColumns();
+    const char *getColumnName(int column);
+    int findColumn(const char *name);
+    int findCharacter(const char *name);
+    const char *getCharacterName(Uint32 index);
+    Uint32 getValue(int column, Uint32 row);
+
+    // selection[row] &= (column[row] op value)
+    void select(int column, enum Op op, Uint32 value, vector<unsigned char> &selection);
+};
+
+}
+
+#endif
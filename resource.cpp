@@ -5,10 +5,15 @@
 
 namespace dragonfighting {
 
+std::map<std::string, struct SpriteFactory::SharedCommandTable> SpriteFactory::commandTables;
+std::map<std::string, struct SpriteFactory::SharedStateTable> SpriteFactory::stateTables;
+
 Sprite *SpriteFactory::loadSprite(const char *basedir, const char *spritename)
 {
     char animationFilename[256];
     char collisionFilename[256];
+    char commandFilename[256];
+    char stateFilename[256];
     Sprite *sprite = new Sprite();
     if (sprite == NULL) {
         return NULL;
@@ -16,9 +21,13 @@ Sprite *SpriteFactory::loadSprite(const char *basedir, const char *spritename)
 
     snprintf(animationFilename, sizeof(animationFilename), "%s.xml", spritename);
     snprintf(collisionFilename, sizeof(collisionFilename), "%s_c.xml", spritename);
+    snprintf(commandFilename, sizeof(commandFilename), "%s_cmd.xml", spritename);
+    snprintf(stateFilename, sizeof(stateFilename), "%s_state.xml", spritename);
     try {
         loadSpriteAnimation(sprite, basedir, animationFilename);
         loadSpriteCollision(sprite, basedir, collisionFilename);
+        sprite->setCommandTable(loadCommandTable(basedir, commandFilename));
+        sprite->setStateTable(loadStateTable(basedir, stateFilename));
     } catch (const char *e) {
         fprintf(stderr, "Error: %s\n", e);
         freeSprite(sprite);
@@ -33,6 +42,12 @@ void SpriteFactory::freeSprite(Sprite *sprite)
     if (sprite->getFullImage() != NULL) {
         SDL_FreeSurface(sprite->getFullImage());
     }
+    if (sprite->getCommandTable() != NULL) {
+        releaseCommandTable(sprite->getCommandTable());
+    }
+    if (sprite->getStateTable() != NULL) {
+        releaseStateTable(sprite->getStateTable());
+    }
     delete sprite;
 }
 
@@ -306,5 +321,290 @@ void SpriteFactory::loadSpriteCollision(Sprite *sprite, const char *basedir, con
     xmlCleanupParser();
 }
 
+const CommandTable *SpriteFactory::loadCommandTable(const char *basedir, const char *filename)
+{
+    char filepathbuff[2048];
+
+    xmlDoc         *doc = NULL;
+    xmlNode        *rootnode = NULL;
+    xmlNode        *curcmd = NULL;
+    xmlChar        *text = NULL;
+
+    snprintf(filepathbuff, sizeof(filepathbuff), "%s/%s", basedir, filename);
+    std::map<std::string, struct SharedCommandTable>::iterator cached = commandTables.find(filepathbuff);
+    if (cached != commandTables.end()) {
+        cached->second.refCount ++;
+        return cached->second.table;
+    }
+
+    doc = xmlReadFile(filepathbuff, NULL, 0);
+    if (doc == NULL) {
+        fprintf(stderr, "Unable to open %s\n", filepathbuff);
+        throw "Unable to open";
+    }
+
+    rootnode = xmlDocGetRootElement(doc);
+
+    CommandTable *table = new CommandTable();
+    try {
+        curcmd = rootnode->xmlChildrenNode;
+        while (curcmd != NULL) {
+            char name[16];
+            unsigned char keys[16];
+            size_t length = 0;
+            if (xmlStrcmp(curcmd->name, BAD_CAST "command") != 0) {
+                curcmd = curcmd->next;
+                continue;
+            }
+
+            text = xmlGetProp(curcmd, BAD_CAST "name");
+            if (text == NULL) {
+                throw "Node command missing attribute: name";
+            }
+            strncpy(name, (const char *)text, sizeof(name));
+            name[sizeof(name) - 1] = '\0';
+            xmlFree(text);
+
+            text = xmlGetProp(curcmd, BAD_CAST "keys");
+            if (text == NULL) {
+                throw "Node command missing attribute: keys";
+            }
+            try {
+                length = CommandTable::parseKeys((const char *)text, keys, sizeof(keys));
+            } catch (const char *e) {
+                fprintf(stderr, "Command %s: %s\n", name, text);
+                xmlFree(text);
+                throw;
+            }
+            xmlFree(text);
+
+            table->addCommand(name, keys, length);
+            curcmd = curcmd->next;
+        }
+    } catch (const char *e) {
+        delete table;
+        xmlFreeDoc(doc);
+        throw;
+    }
+
+    xmlFreeDoc(doc);
+
+    xmlCleanupParser();
+
+    table->compile();
+    struct SharedCommandTable shared = {table, 1};
+    commandTables[filepathbuff] = shared;
+    return table;
+}
+
+void SpriteFactory::releaseCommandTable(const CommandTable *table)
+{
+    std::map<std::string, struct SharedCommandTable>::iterator i;
+    for (i = commandTables.begin(); i != commandTables.end(); ++i) {
+        if (i->second.table == table) {
+            if (--i->second.refCount == 0) {
+                delete i->second.table;
+                commandTables.erase(i);
+            }
+            return;
+        }
+    }
+}
+
+static void copyName(char *dst, size_t size, const xmlChar *text)
+{
+    strncpy(dst, (const char *)text, size);
+    dst[size - 1] = '\0';
+}
+
+const StateTable *SpriteFactory::loadStateTable(const char *basedir, const char *filename)
+{
+    char filepathbuff[2048];
+
+    xmlDoc         *doc = NULL;
+    xmlNode        *rootnode = NULL;
+    xmlNode        *curnode = NULL;
+    xmlChar        *text = NULL;
+
+    snprintf(filepathbuff, sizeof(filepathbuff), "%s/%s", basedir, filename);
+    std::map<std::string, struct SharedStateTable>::iterator cached = stateTables.find(filepathbuff);
+    if (cached != stateTables.end()) {
+        cached->second.refCount ++;
+        return cached->second.table;
+    }
+
+    doc = xmlReadFile(filepathbuff, NULL, 0);
+    if (doc == NULL) {
+        fprintf(stderr, "Unable to open %s\n", filepathbuff);
+        throw "Unable to open";
+    }
+
+    rootnode = xmlDocGetRootElement(doc);
+
+    StateTable *table = new StateTable();
+    try {
+        curnode = rootnode->xmlChildrenNode;
+        while (curnode != NULL) {
+            if (xmlStrcmp(curnode->name, BAD_CAST "state") == 0) {
+                text = xmlGetProp(curnode, BAD_CAST "name");
+                if (text == NULL) {
+                    throw "Node state missing attribute: name";
+                }
+                int state = StateTable::findState((const char *)text);
+                xmlFree(text);
+                if (state < 0) {
+                    throw "Unknown state name";
+                }
+                struct StateRow row = *table->getRow(state);
+
+                text = xmlGetProp(curnode, BAD_CAST "animation");
+                if (text) {
+                    copyName(row.animation, sizeof(row.animation), text);
+                    xmlFree(text);
+                }
+                text = xmlGetProp(curnode, BAD_CAST "collision");
+                if (text) {
+                    copyName(row.collision, sizeof(row.collision), text);
+                    xmlFree(text);
+                }
+                text = xmlGetProp(curnode, BAD_CAST "duration");
+                if (text) {
+                    if (xmlStrcmp(text, BAD_CAST "keep") == 0) {
+                        row.keepTimer = true;
+                    } else {
+                        row.duration = atoi((const char *)text);
+                    }
+                    xmlFree(text);
+                }
+                text = xmlGetProp(curnode, BAD_CAST "movetime");
+                if (text) {
+                    row.moveTime = atoi((const char *)text);
+                    xmlFree(text);
+                }
+                text = xmlGetProp(curnode, BAD_CAST "invincible");
+                if (text) {
+                    row.invincible = (xmlStrcmp(text, BAD_CAST "true") == 0) ? 1 : 0;
+                    xmlFree(text);
+                }
+                text = xmlGetProp(curnode, BAD_CAST "reset");
+                if (text) {
+                    row.resetPhysics = (xmlStrcmp(text, BAD_CAST "true") == 0);
+                    xmlFree(text);
+                }
+                text = xmlGetProp(curnode, BAD_CAST "backorder");
+                if (text) {
+                    row.backorder = (xmlStrcmp(text, BAD_CAST "true") == 0);
+                    xmlFree(text);
+                }
+                text = xmlGetProp(curnode, BAD_CAST "direction");
+                if (text) {
+                    if (xmlStrcmp(text, BAD_CAST "forward") == 0) {
+                        row.direction = STATE_DIR_FORWARD;
+                    } else if (xmlStrcmp(text, BAD_CAST "back") == 0) {
+                        row.direction = STATE_DIR_BACK;
+                    } else if (xmlStrcmp(text, BAD_CAST "jump") == 0) {
+                        row.direction = STATE_DIR_JUMP;
+                    } else {
+                        row.direction = STATE_DIR_NONE;
+                    }
+                    xmlFree(text);
+                }
+
+                // the rest can be malformed, free the text before rethrowing
+                try {
+                    text = xmlGetProp(curnode, BAD_CAST "allow");
+                    if (text) {
+                        row.allow = StateTable::parseAllow((const char *)text);
+                        xmlFree(text);
+                    }
+                    text = xmlGetProp(curnode, BAD_CAST "next");
+                    if (text) {
+                        row.next = StateTable::findState((const char *)text);
+                        if (row.next < 0) {
+                            throw "Unknown state name";
+                        }
+                        xmlFree(text);
+                    }
+                    text = xmlGetProp(curnode, BAD_CAST "vx");
+                    if (text) {
+                        row.vx = StateTable::parseFactor((const char *)text);
+                        xmlFree(text);
+                    }
+                    text = xmlGetProp(curnode, BAD_CAST "vy");
+                    if (text) {
+                        row.vy = StateTable::parseFactor((const char *)text);
+                        xmlFree(text);
+                    }
+                    text = xmlGetProp(curnode, BAD_CAST "accy");
+                    if (text) {
+                        row.accy = StateTable::parseFactor((const char *)text);
+                        xmlFree(text);
+                    }
+                } catch (const char *e) {
+                    fprintf(stderr, "State %s: %s\n", StateTable::getStateName(state), text);
+                    xmlFree(text);
+                    throw;
+                }
+
+                table->setRow(state, row);
+            } else if (xmlStrcmp(curnode->name, BAD_CAST "command") == 0) {
+                struct StateCommand command;
+
+                text = xmlGetProp(curnode, BAD_CAST "name");
+                if (text == NULL) {
+                    throw "Node command missing attribute: name";
+                }
+                copyName(command.command, sizeof(command.command), text);
+                xmlFree(text);
+
+                text = xmlGetProp(curnode, BAD_CAST "state");
+                if (text == NULL) {
+                    throw "Node command missing attribute: state";
+                }
+                command.state = StateTable::findState((const char *)text);
+                xmlFree(text);
+                if (command.state < 0) {
+                    throw "Unknown state name";
+                }
+
+                command.projectile = false;
+                text = xmlGetProp(curnode, BAD_CAST "projectile");
+                if (text) {
+                    command.projectile = (xmlStrcmp(text, BAD_CAST "true") == 0);
+                    xmlFree(text);
+                }
+
+                table->addCommand(command);
+            }
+            curnode = curnode->next;
+        }
+    } catch (const char *e) {
+        delete table;
+        xmlFreeDoc(doc);
+        throw;
+    }
+
+    xmlFreeDoc(doc);
+
+    xmlCleanupParser();
+
+    struct SharedStateTable shared = {table, 1};
+    stateTables[filepathbuff] = shared;
+    return table;
+}
+
+void SpriteFactory::releaseStateTable(const StateTable *table)
+{
+    std::map<std::string, struct SharedStateTable>::iterator i;
+    for (i = stateTables.begin(); i != stateTables.end(); ++i) {
+        if (i->second.table == table) {
+            if (--i->second.refCount == 0) {
+                delete i->second.table;
+                stateTables.erase(i);
+            }
+            return;
+        }
+    }
 }
 
+}
@@ -1,6 +1,8 @@
 #ifndef _RESOURCE_
 #define _RESOURCE_
 
+#include <map>
+#include <string>
 #include "sprite.h"
 
 namespace dragonfighting {
@@ -12,8 +14,24 @@ public:
     static void freeSprite(Sprite *sprite);
 
 private:
+    struct SharedCommandTable {
+        CommandTable *table;
+        int refCount;
+    };
+    // compiled command tables by file path, shared by every sprite of a character
+    static std::map<std::string, struct SharedCommandTable> commandTables;
+    struct SharedStateTable {
+        StateTable *table;
+        int refCount;
+    };
+    static std::map<std::string, struct SharedStateTable> stateTables;
+
     static void loadSpriteAnimation(Sprite *sprite, const char *basedir, const char *filename);
     static void loadSpriteCollision(Sprite *sprite, const char *basedir, const char *filename);
+    static const CommandTable *loadCommandTable(const char *basedir, const char *filename);
+    static void releaseCommandTable(const CommandTable *table);
+    static const StateTable *loadStateTable(const char *basedir, const char *filename);
+    static void releaseStateTable(const StateTable *table);
 };
 
 }
@@ -1,4 +1,5 @@
 #include <assert.h>
+#include <math.h>
 #include "sprite.h"
 
 namespace dragonfighting {
@@ -19,22 +20,35 @@ Sprite::Sprite() :
     oldforward(-1),
     curAreaSequence(NULL),
     curAreaIndex(0),
-    oldFrameStamp(0)
+    oldFrameStamp(0),
+    realHitSize(0),
+    realAttackSize(0)
 {
-    realHitRectArray = (SDL_Rect *)malloc(sizeof(SDL_Rect) * MAX_COLLISION_RECT_ARRAY_LEN);
-    realAttackRectArray = (SDL_Rect *)malloc(sizeof(SDL_Rect) * MAX_COLLISION_RECT_ARRAY_LEN);
+    realHitRectArray = (struct CollisionRect *)malloc(sizeof(struct CollisionRect) * MAX_COLLISION_RECT_ARRAY_LEN);
+    realAttackRectArray = (struct CollisionRect *)malloc(sizeof(struct CollisionRect) * MAX_COLLISION_RECT_ARRAY_LEN);
+    realHitBounds = realAttackBounds = rectsBounds((struct CollisionRect *)NULL, 0);
+    rectLanesInit(&realHitLanes, MAX_COLLISION_RECT_ARRAY_LEN);
+    rectLanesInit(&realAttackLanes, MAX_COLLISION_RECT_ARRAY_LEN);
+    for (int i=0; i<MAX_STATES; i++) {
+        stateAnimations[i] = -1;
+        stateCollisions[i] = -1;
+    }
 }
 
 Sprite::~Sprite()
 {
     free(realHitRectArray);
     free(realAttackRectArray);
+    rectLanesFree(&realHitLanes);
+    rectLanesFree(&realAttackLanes);
     for (vector<struct CollisionArea>::iterator i = collisionAreas.begin(); i != collisionAreas.end(); ++i ) {
         if ( (*i).hitRectArray) {
             free( (*i).hitRectArray );
+            free( (*i).flipedHitRectArray );
         }
         if ( (*i).attackRectArray) {
             free( (*i).attackRectArray );
+            free( (*i).flipedAttackRectArray );
         }
     }
 
@@ -113,25 +127,50 @@ void Sprite::setVelocity(float vx, float vy)
     this->velocity_y = vy;
 }
 
+struct CollisionRect *Sprite::copyRects(const SDL_Rect *rects, int size, bool flip)
+{
+    struct CollisionRect *copy = (struct CollisionRect *)malloc(sizeof(struct CollisionRect) * size);
+    assert(copy != NULL);
+    for (int i=0; i<size; i++) {
+        // flipped image: x runs leftward from the anchor
+        copy[i].x = flip ? -rects[i].x - rects[i].w : rects[i].x;
+        copy[i].y = rects[i].y;
+        copy[i].w = rects[i].w;
+        copy[i].h = rects[i].h;
+    }
+    return copy;
+}
+
 void Sprite::addCollisionRects(SDL_Rect *hitrects, int hitsize, SDL_Rect *attackrects, int attacksize)
 {
     struct CollisionArea area;
 
+    assert(hitsize <= MAX_COLLISION_RECT_ARRAY_LEN);
+    assert(attacksize <= MAX_COLLISION_RECT_ARRAY_LEN);
+
     if (hitrects != NULL && hitsize > 0) {
-        area.hitRectArray = (SDL_Rect *)malloc(sizeof(struct SDL_Rect) * hitsize);
-        assert(area.hitRectArray != NULL);
-        memcpy(area.hitRectArray, hitrects, sizeof(struct SDL_Rect) * hitsize);
+        area.hitRectArray = copyRects(hitrects, hitsize, false);
+        area.flipedHitRectArray = copyRects(hitrects, hitsize, true);
+        area.hitBounds = rectsBounds(area.hitRectArray, hitsize);
+        area.flipedHitBounds = rectsBounds(area.flipedHitRectArray, hitsize);
     } else {
         area.hitRectArray = NULL;
+        area.flipedHitRectArray = NULL;
+        area.hitBounds = area.flipedHitBounds = rectsBounds((struct CollisionRect *)NULL, 0);
+        hitsize = 0;
     }
     area.sizeHit = hitsize;
 
     if (attackrects != NULL && attacksize > 0) {
-        area.attackRectArray = (SDL_Rect *)malloc(sizeof(struct SDL_Rect) * attacksize);
-        assert(area.attackRectArray != NULL);
-        memcpy(area.attackRectArray, attackrects, sizeof(struct SDL_Rect) * attacksize);
+        area.attackRectArray = copyRects(attackrects, attacksize, false);
+        area.flipedAttackRectArray = copyRects(attackrects, attacksize, true);
+        area.attackBounds = rectsBounds(area.attackRectArray, attacksize);
+        area.flipedAttackBounds = rectsBounds(area.flipedAttackRectArray, attacksize);
     } else {
         area.attackRectArray = NULL;
+        area.flipedAttackRectArray = NULL;
+        area.attackBounds = area.flipedAttackBounds = rectsBounds((struct CollisionRect *)NULL, 0);
+        attacksize = 0;
     }
     area.sizeAttack = attacksize;
 
@@ -153,242 +192,151 @@ void Sprite::addCollisionSequence(const char *name, Uint32 framerate, int indexa
     this->collisionAreaSequences.push_back(sequence);
 }
 
-void Sprite::useCollisionSequence(const char *name)
+int Sprite::findCollisionSequence(const char *name)
 {
+    int index = 0;
     for (vector<struct CollisionAreaSequence *>::iterator i = collisionAreaSequences.begin(); i != collisionAreaSequences.end(); i++) {
         if ( (*i)->name.compare(name) == 0 ) {
-            curAreaSequence = *i;
-            curAreaSequence->reset();
-            curAreaIndex = curAreaSequence->getCurrentAreaIndex();
-            oldFrameStamp = 0;
-            break;
+            return index;
         }
+        index ++;
     }
+    return -1;
 }
 
-const SDL_Rect *Sprite::getCurRealHitCollisionRects(int &size)
+void Sprite::useCollisionSequence(const char *name)
 {
-    if (collisionAreas.size() == 0) {
-        return NULL;
-    }
-
-    struct CollisionArea *curarea = &collisionAreas.at(curAreaIndex);
-    size = curarea->sizeHit;
-    assert(size <= MAX_COLLISION_RECT_ARRAY_LEN);
-
-    SDL_Rect screenposition = getPositionScreenCoor();
-    SDL_Rect realrect;
-    for (int i=0; i<curarea->sizeHit; i++) {
-        if (flipHorizontal) {
-            realrect = {(Sint16)(screenposition.x + frameAnchorPoints[currentFrame].x - curarea->hitRectArray[i].w - curarea->hitRectArray[i].x),
-                (Sint16)(screenposition.y + curarea->hitRectArray[i].y - frameAnchorPoints[currentFrame].y),
-                curarea->hitRectArray[i].w, curarea->hitRectArray[i].h};
-        } else {
-            realrect = {(Sint16)(screenposition.x - frameAnchorPoints[currentFrame].x + curarea->hitRectArray[i].x),
-                (Sint16)(screenposition.y + curarea->hitRectArray[i].y - frameAnchorPoints[currentFrame].y),
-                curarea->hitRectArray[i].w, curarea->hitRectArray[i].h};
-        }
-        realHitRectArray[i] = realrect;
-    }
-    return realHitRectArray;
+    useCollisionSequenceIndex(findCollisionSequence(name));
 }
 
-const SDL_Rect *Sprite::getCurRealAttackCollisionRects(int &size)
+void Sprite::useCollisionSequenceIndex(int index)
 {
-    if (collisionAreas.size() == 0) {
-        return NULL;
+    if (index < 0 || index >= (int)collisionAreaSequences.size()) {
+        return;
     }
+    curAreaSequence = collisionAreaSequences[index];
+    curAreaSequence->reset();
+    curAreaIndex = curAreaSequence->getCurrentAreaIndex();
+    oldFrameStamp = 0;
+}
 
-    struct CollisionArea *curarea = &collisionAreas.at(curAreaIndex);
-    size = curarea->sizeAttack;
-    assert(size <= MAX_COLLISION_RECT_ARRAY_LEN);
-
-    SDL_Rect screenposition = getPositionScreenCoor();
-    SDL_Rect realrect;
-    for (int i=0; i<curarea->sizeAttack; i++) {
-        if (flipHorizontal) {
-            realrect = {(Sint16)(screenposition.x + frameAnchorPoints[currentFrame].x - curarea->attackRectArray[i].w - curarea->attackRectArray[i].x),
-                (Sint16)(screenposition.y + curarea->attackRectArray[i].y - frameAnchorPoints[currentFrame].y),
-                curarea->attackRectArray[i].w, curarea->attackRectArray[i].h};
-        } else {
-            realrect = {(Sint16)(screenposition.x + curarea->attackRectArray[i].x - frameAnchorPoints[currentFrame].x),
-                (Sint16)(screenposition.y + curarea->attackRectArray[i].y - frameAnchorPoints[currentFrame].y),
-                curarea->attackRectArray[i].w, curarea->attackRectArray[i].h};
+void Sprite::setStateTable(const StateTable *table)
+{
+    Character::setStateTable(table);
+    for (int i=0; i<MAX_STATES; i++) {
+        stateAnimations[i] = -1;
+        stateCollisions[i] = -1;
+        if (table != NULL) {
+            stateAnimations[i] = findSequence(table->getRow(i)->animation);
+            stateCollisions[i] = findCollisionSequence(table->getRow(i)->collision);
         }
-        realAttackRectArray[i] = realrect;
     }
-    return realAttackRectArray;
 }
 
-void Sprite::update(Uint32 frameStamp)
+void Sprite::translateRects(struct CollisionRect *dst, const struct CollisionRect *src, int size, float dx, float dy)
 {
-    Character::update(frameStamp);
-    Animation::update(frameStamp);
-    updateCollisionArea(frameStamp);
-
-    if (state == WALK) {
-        if (oldstate != state || oldforward != forward) {
-            if (forward) {
-                playSequence("walk");
-                useCollisionSequence("walk");
-            } else {
-                playSequenceBackorder("walk");
-                useCollisionSequence("walk");
-            }
-            resetPhysic();
-            velocity_x = speed;
-            if (facing == LEFT && forward) {
-                velocity_x = -velocity_x;
-            } else if (facing == RIGHT && !forward) {
-                velocity_x = -velocity_x;
-            }
-        }
+    for (int i=0; i<size; i++) {
+        dst[i].x = src[i].x + dx;
+        dst[i].y = src[i].y + dy;
+        dst[i].w = src[i].w;
+        dst[i].h = src[i].h;
     }
+}
 
-    if (state == ATTACK) {
-        if (oldstate != state) {
-            playSequence("attack");
-            useCollisionSequence("attack");
-            resetPhysic();
-        }
+void Sprite::updateRealCollisionRects()
+{
+    if (collisionAreas.size() == 0) {
+        realHitSize = 0;
+        realAttackSize = 0;
+        realHitLanes.size = 0;
+        realAttackLanes.size = 0;
+        return;
     }
 
-    if (state == ATTACK3) {
-        if (oldstate != state) {
-            playSequence("rush");
-            useCollisionSequence("rush");
-            velocity_x = speed * 3;
-            if (facing == LEFT && forward) {
-                velocity_x = -velocity_x;
-            } else if (facing == RIGHT && !forward) {
-                velocity_x = -velocity_x;
-            }
-        }
+    struct CollisionArea *curarea = &collisionAreas.at(curAreaIndex);
+    float dx, dy;
+    dy = y - frameAnchorPoints[currentFrame].y;
+    if (flipHorizontal) {
+        dx = x + frameAnchorPoints[currentFrame].x;
+        translateRects(realHitRectArray, curarea->flipedHitRectArray, curarea->sizeHit, dx, dy);
+        translateRects(realAttackRectArray, curarea->flipedAttackRectArray, curarea->sizeAttack, dx, dy);
+        translateRects(&realHitBounds, &curarea->flipedHitBounds, 1, dx, dy);
+        translateRects(&realAttackBounds, &curarea->flipedAttackBounds, 1, dx, dy);
+    } else {
+        dx = x - frameAnchorPoints[currentFrame].x;
+        translateRects(realHitRectArray, curarea->hitRectArray, curarea->sizeHit, dx, dy);
+        translateRects(realAttackRectArray, curarea->attackRectArray, curarea->sizeAttack, dx, dy);
+        translateRects(&realHitBounds, &curarea->hitBounds, 1, dx, dy);
+        translateRects(&realAttackBounds, &curarea->attackBounds, 1, dx, dy);
     }
+    realHitSize = curarea->sizeHit;
+    realAttackSize = curarea->sizeAttack;
+    rectLanesSet(&realHitLanes, realHitRectArray, realHitSize);
+    rectLanesSet(&realAttackLanes, realAttackRectArray, realAttackSize);
+}
 
-    if (state == STAND) {
-        if (oldstate != state) {
-            playSequence("stand");
-            useCollisionSequence("stand");
-            resetPhysic();
-        }
-    }
+const struct CollisionRect *Sprite::getCurRealHitCollisionRects(int &size)
+{
+    size = realHitSize;
+    return (realHitSize > 0) ? realHitRectArray : NULL;
+}
 
-    if (state == GUARD) {
-        if (oldstate != state) {
-            playSequence("guard");
-            useCollisionSequence("guard");
-            resetPhysic();
-            velocity_x = speed * 1.5;
-            if (facing == RIGHT) {
-                velocity_x = -velocity_x;
-            }
-        }
+const struct CollisionRect *Sprite::getCurRealAttackCollisionRects(int &size)
+{
+    size = realAttackSize;
+    return (realAttackSize > 0) ? realAttackRectArray : NULL;
+}
 
-        if (moveTimer == 0) {
-            resetPhysic();
-        }
-    }
+const struct CollisionRect &Sprite::getCurRealHitBounds()
+{
+    return realHitBounds;
+}
 
-    if (state == SQUATGUARD) {
-        if (oldstate != state) {
-            playSequence("guardsquat");
-            useCollisionSequence("guardsquat");
-            resetPhysic();
-            velocity_x = speed * 1.5;
-            if (facing == RIGHT) {
-                velocity_x = -velocity_x;
-            }
-        }
-        if (moveTimer == 0) {
-            resetPhysic();
-        }
-    }
+const struct CollisionRect &Sprite::getCurRealAttackBounds()
+{
+    return realAttackBounds;
+}
 
-    if (state == HIT) {
-        if (oldstate != state) {
-            playSequence("hit");
-            useCollisionSequence("hit");
-            resetPhysic();
-            velocity_x = speed * 1.5;
-            if (facing == RIGHT) {
-                velocity_x = -velocity_x;
-            }
-        }
-        if (moveTimer == 0) {
-            resetPhysic();
-        }
-    }
+const struct RectLanes *Sprite::getCurRealHitLanes()
+{
+    return &realHitLanes;
+}
 
-    if (state == FALL) {
-        if (oldstate != state) {
-            playSequence("fall");
-            useCollisionSequence("fall");
-            resetPhysic();
-            velocity_x = speed * 1.5;
-            if (facing == RIGHT) {
-                velocity_x = -velocity_x;
-            }
-            velocity_y = -speed * 3;
-            accy = speed * 3 / 11;
-        }
-    }
+const struct RectLanes *Sprite::getCurRealAttackLanes()
+{
+    return &realAttackLanes;
+}
 
-    if (state == LIE) {
-        if (oldstate != state) {
-            playSequence("lie");
-            useCollisionSequence("lie");
-            resetPhysic();
-        }
+bool Sprite::maskCollide(Sprite *other, const struct CollisionRect &clip)
+{
+    const PixelMask *mask1 = getCurMask();
+    const PixelMask *mask2 = other->getCurMask();
+    if (mask1 == NULL || mask2 == NULL) {
+        return true;
     }
 
-    if (state == RAISE) {
-        if (oldstate != state) {
-            playSequence("raise");
-            useCollisionSequence("raise");
-            resetPhysic();
-        }
-    }
+    // top left of each frame as Animation::draw places it
+    SDL_Rect anchor1 = frameAnchorPoints[currentFrame];
+    SDL_Rect anchor2 = other->frameAnchorPoints[other->currentFrame];
+    int x1 = flipHorizontal ? (int)floorf(x) - mask1->getWidth() + anchor1.x : (int)floorf(x) - anchor1.x;
+    int y1 = (int)floorf(y) - anchor1.y;
+    int x2 = other->flipHorizontal ? (int)floorf(other->x) - mask2->getWidth() + anchor2.x : (int)floorf(other->x) - anchor2.x;
+    int y2 = (int)floorf(other->y) - anchor2.y;
+    return PixelMask::overlap(mask1, x1, y1, mask2, x2, y2, clip);
+}
 
-    if (state == JUMP) {
-        if (oldstate != state) {
-            playSequence("jump");
-            useCollisionSequence("jump");
-            resetPhysic();
-            if (jumpingDirection != 0) {
-                velocity_x = speed * 1.5;
-                if (facing == LEFT && jumpingDirection == 1) {
-                    velocity_x = -velocity_x;
-                } else if (facing == RIGHT && jumpingDirection == 2) {
-                    velocity_x = -velocity_x;
-                }
-            }
-            velocity_y = -speed * 6;
-            accy = speed * 6 / 20;
-        }
-    }
+void Sprite::update(Uint32 frameStamp)
+{
+    Character::update(frameStamp);
+    Animation::update(frameStamp);
+    updateCollisionArea(frameStamp);
 
-    if (state == LAND) {
-        if (oldstate != state) {
-            playSequence("land");
-            useCollisionSequence("land");
-            resetPhysic();
-        }
+    const struct StateRow *row = stateTable->getRow(state);
+    if (oldstate != state || (row->direction == STATE_DIR_FORWARD && oldforward != forward)) {
+        enterStatePhysic(row);
     }
-
-    if (state == JUMPATTACK) {
-        if (oldstate != state) {
-            playSequence("jumpattack");
-            useCollisionSequence("jumpattack");
-            if (jumpingDirection != 0) {
-                velocity_x = speed * 1.5;
-                if (facing == LEFT && jumpingDirection == 1) {
-                    velocity_x = -velocity_x;
-                } else if (facing == RIGHT && jumpingDirection == 2) {
-                    velocity_x = -velocity_x;
-                }
-            }
-        }
+    if (row->moveTime != 0 && moveTimer == 0) {
+        resetPhysic();
     }
 
     // physic
@@ -414,6 +362,35 @@ void Sprite::update(Uint32 frameStamp)
     oldforward = forward;
 }
 
+void Sprite::enterStatePhysic(const struct StateRow *row)
+{
+    bool backward = row->backorder && !forward;
+    if (row->animation[0] != '\0') {
+        playSequenceIndex(stateAnimations[state], backward);
+    }
+    useCollisionSequenceIndex(stateCollisions[state]);
+    if (row->resetPhysics) {
+        resetPhysic();
+    }
+
+    if (row->vx.set && (row->direction != STATE_DIR_JUMP || jumpingDirection != 0)) {
+        velocity_x = speed * row->vx.num / row->vx.den;
+        if (row->direction == STATE_DIR_FORWARD && (facing == RIGHT) != forward) {
+            velocity_x = -velocity_x;
+        } else if (row->direction == STATE_DIR_BACK && facing == RIGHT) {
+            velocity_x = -velocity_x;
+        } else if (row->direction == STATE_DIR_JUMP && (facing == RIGHT) != (jumpingDirection == 1)) {
+            velocity_x = -velocity_x;
+        }
+    }
+    if (row->vy.set) {
+        velocity_y = speed * row->vy.num / row->vy.den;
+    }
+    if (row->accy.set) {
+        accy = speed * row->accy.num / row->accy.den;
+    }
+}
+
 void Sprite::CollisionAreaSequence::reset()
 {
     curIndex = 0;
@@ -448,54 +425,37 @@ void Sprite::updateCollisionArea(Uint32 frameStamp)
     }
 }
 
-void Sprite::draw(SDL_Surface *dst)
+void Sprite::render(RenderList *list)
 {
-    Animation::draw(dst);
+    Animation::render(list);
 
 #ifdef DEBUG
-    if (collisionAreas.size() == 0) {
+    if (realHitSize == 0 && realAttackSize == 0) {
         return;
     }
 
-    SDL_Rect screenposition = getPositionScreenCoor();
+    // the rects the last collision test saw, moved from simulation to screen space
+    SDL_Rect parentposition = getPositionScreenCoor();
+    parentposition.x -= position.x;
+    parentposition.y -= position.y;
 
-    SDL_Surface *surface = NULL;//SDL_CreateRGBSurface(SDL_SWSURFACE, 200, 200, 32, rmask, gmask, bmask, amask);
-    surface = SDL_CreateRGBSurface(fullImage->flags, fullImage->w, fullImage->h, fullImage->format->BitsPerPixel,
-        fullImage->format->Rmask, fullImage->format->Gmask, fullImage->format->Bmask, fullImage->format->Amask);
-    SDL_SetAlpha(surface, SDL_RLEACCEL | SDL_SRCALPHA, 0x80);
+    // one level above the frame, fills would sort under its blit
+    Sint16 level = list->getLevel();
+    list->setLevel(level + 1);
 
-    struct CollisionArea *curarea = &collisionAreas.at(curAreaIndex);
-    SDL_FillRect( surface, NULL, SDL_MapRGBA(dst->format, 64, 200, 64, 0));
-    for (int i=0; i<curarea->sizeHit; i++) {
-        SDL_Rect srcrect = {0, 0, curarea->hitRectArray[i].w, curarea->hitRectArray[i].h};
-        if (flipHorizontal) {
-            SDL_Rect dstrect = {(Sint16)(screenposition.x + frameAnchorPoints[currentFrame].x - curarea->hitRectArray[i].w - curarea->hitRectArray[i].x),
-                (Sint16)(screenposition.y + curarea->hitRectArray[i].y - frameAnchorPoints[currentFrame].y),
-                0, 0};
-            SDL_BlitSurface(surface, &srcrect, dst, &dstrect);
-        } else {
-            SDL_Rect dstrect = {(Sint16)(screenposition.x - frameAnchorPoints[currentFrame].x + curarea->hitRectArray[i].x),
-                (Sint16)(screenposition.y + curarea->hitRectArray[i].y - frameAnchorPoints[currentFrame].y),
-                0, 0};
-            SDL_BlitSurface(surface, &srcrect, dst, &dstrect);
-        }
+    for (int i=0; i<realHitSize; i++) {
+        SDL_Rect rect = {(Sint16)(parentposition.x + realHitRectArray[i].x),
+            (Sint16)(parentposition.y + realHitRectArray[i].y),
+            (Uint16)realHitRectArray[i].w, (Uint16)realHitRectArray[i].h};
+        list->fill(rect, 64, 200, 64, 0x80);
     }
-    SDL_FillRect( surface, NULL, SDL_MapRGBA(dst->format, 200, 64, 64, 0));
-    for (int i=0; i<curarea->sizeAttack; i++) {
-        SDL_Rect srcrect = {0, 0, curarea->attackRectArray[i].w, curarea->attackRectArray[i].h};
-        if (flipHorizontal) {
-            SDL_Rect dstrect = {(Sint16)(screenposition.x + frameAnchorPoints[currentFrame].x - curarea->attackRectArray[i].w - curarea->attackRectArray[i].x),
-                (Sint16)(screenposition.y + curarea->attackRectArray[i].y - frameAnchorPoints[currentFrame].y),
-                curarea->attackRectArray[i].w, curarea->attackRectArray[i].h};
-            SDL_BlitSurface(surface, &srcrect, dst, &dstrect);
-        } else {
-            SDL_Rect dstrect = {(Sint16)(screenposition.x + curarea->attackRectArray[i].x - frameAnchorPoints[currentFrame].x),
-                (Sint16)(screenposition.y + curarea->attackRectArray[i].y - frameAnchorPoints[currentFrame].y),
-                curarea->attackRectArray[i].w, curarea->attackRectArray[i].h};
-            SDL_BlitSurface(surface, &srcrect, dst, &dstrect);
-        }
+    for (int i=0; i<realAttackSize; i++) {
+        SDL_Rect rect = {(Sint16)(parentposition.x + realAttackRectArray[i].x),
+            (Sint16)(parentposition.y + realAttackRectArray[i].y),
+            (Uint16)realAttackRectArray[i].w, (Uint16)realAttackRectArray[i].h};
+        list->fill(rect, 200, 64, 64, 0x80);
     }
-    SDL_FreeSurface(surface);
+    list->setLevel(level);
 #endif
 }
 
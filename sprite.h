@@ -3,6 +3,7 @@
 
 #include "animation.h"
 #include "character.h"
+#include "collisiondetect.h"
 
 namespace dragonfighting {
 
@@ -13,10 +14,16 @@ class Sprite : public Character, public Animation
 {
     struct CollisionArea
     {
-        SDL_Rect *hitRectArray;
+        struct CollisionRect *hitRectArray;
+        struct CollisionRect *flipedHitRectArray;   // mirrored around the anchor, baked at load
         int sizeHit;
-        SDL_Rect *attackRectArray;
+        struct CollisionRect *attackRectArray;
+        struct CollisionRect *flipedAttackRectArray;
         int sizeAttack;
+        struct CollisionRect hitBounds;
+        struct CollisionRect flipedHitBounds;
+        struct CollisionRect attackBounds;
+        struct CollisionRect flipedAttackBounds;
     };
 
     struct CollisionAreaSequence
@@ -47,10 +54,25 @@ class Sprite : public Character, public Animation
         struct CollisionAreaSequence *curAreaSequence;
         int curAreaIndex;
         Uint32 oldFrameStamp;
-        SDL_Rect *realHitRectArray;
-        SDL_Rect *realAttackRectArray;
+        // simulation space rects of the current frame, from x and y
+        struct CollisionRect *realHitRectArray;
+        struct CollisionRect *realAttackRectArray;
+        int realHitSize;
+        int realAttackSize;
+        struct CollisionRect realHitBounds;
+        struct CollisionRect realAttackBounds;
+        struct RectLanes realHitLanes;
+        struct RectLanes realAttackLanes;
+        // animation and collision sequence of each state table row, -1 if missing
+        int stateAnimations[MAX_STATES];
+        int stateCollisions[MAX_STATES];
 
         void resetPhysic();
+        void enterStatePhysic(const struct StateRow *row);
+        int findCollisionSequence(const char *name);
+        void useCollisionSequenceIndex(int index);
+        static struct CollisionRect *copyRects(const SDL_Rect *rects, int size, bool flip);
+        static void translateRects(struct CollisionRect *dst, const struct CollisionRect *src, int size, float dx, float dy);
 
     public:
         Sprite();
@@ -69,13 +91,24 @@ class Sprite : public Character, public Animation
         void addCollisionRects(SDL_Rect *hitrects, int hitsize, SDL_Rect *attackrects, int attacksize);
         void addCollisionSequence(const char *name, Uint32 framerate, int indexarray[], int length);
         void useCollisionSequence(const char *name);
-        const SDL_Rect *getCurRealHitCollisionRects(int &size /*out*/);
-        const SDL_Rect *getCurRealAttackCollisionRects(int &size /*out*/);
+        // resolves the rows' sequence names against this sprite's data
+        virtual void setStateTable(const StateTable *table);
+        const struct CollisionRect *getCurRealHitCollisionRects(int &size /*out*/);
+        const struct CollisionRect *getCurRealAttackCollisionRects(int &size /*out*/);
+        const struct CollisionRect &getCurRealHitBounds();
+        const struct CollisionRect &getCurRealAttackBounds();
+        const struct RectLanes *getCurRealHitLanes();
+        const struct RectLanes *getCurRealAttackLanes();
         virtual void update(Uint32 frameStamp);
         void updateCollisionArea(Uint32 frameStamp);
+        // refresh the rects returned by getCurReal*CollisionRects, once a frame
+        // after update, facing and position are settled
+        void updateRealCollisionRects();
+        // pixel exact test of the drawn frames inside clip, true without masks
+        bool maskCollide(Sprite *other, const struct CollisionRect &clip);
 
         //debug
-        void draw(SDL_Surface *dst);
+        void render(RenderList *list);
 
         friend class AI;
 };
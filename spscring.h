@@ -0,0 +1,72 @@
+#ifndef _SPSC_RING_H_
+#define _SPSC_RING_H_
+
+#include <stddef.h>
+#include <atomic>
+
+namespace dragonfighting {
+
+/**
+ * Fixed capacity single-producer/single-consumer ring of T.
+ * push() is called from one thread and peek()/pop() from one other (or the
+ * same) thread, without locks and without allocating.
+ */
+template <typename T, size_t CAPACITY>
+class SPSCRing
+{
+    static_assert((CAPACITY & (CAPACITY - 1)) == 0, "capacity must be a power of 2");
+
+protected:
+    T items[CAPACITY];
+
+    // producer owns head, consumer owns tail; keep them on separate cache lines
+    char padding0[64];
+    std::atomic<size_t> head;
+    char padding1[64];
+    std::atomic<size_t> tail;
+    char padding2[64];
+
+public:
+    SPSCRing() :
+        head(0),
+        tail(0)
+    {
+    }
+
+    // producer: false if the ring is full
+    bool push(const T &item)
+    {
+        size_t h = head.load(std::memory_order_relaxed);
+        if (h - tail.load(std::memory_order_acquire) == CAPACITY) {
+            return false;
+        }
+        items[h & (CAPACITY - 1)] = item;
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+    // consumer: oldest item, NULL if empty
+    T *peek()
+    {
+        size_t t = tail.load(std::memory_order_relaxed);
+        if (t == head.load(std::memory_order_acquire)) {
+            return NULL;
+        }
+        return &items[t & (CAPACITY - 1)];
+    }
+
+    // consumer: drop the item returned by peek()
+    void pop()
+    {
+        tail.store(tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+    size_t size()
+    {
+        return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire);
+    }
+};
+
+}
+
+#endif
@@ -1,31 +1,130 @@
 #include <SDL/SDL_image.h>
 #include <math.h>
 #include "stage.h"
+#include "logger.h"
 
 namespace dragonfighting {
 
-Stage::Stage(Sprite *player1, Sprite *player2) :
-    player1(player1),
-    player2(player2),
+static const int MAX_ENTITIES = 256;
+static const int MAX_ENTITY_HITS = 16;
+
+/*
+ * Render list levels. Each fighter gets two: one for its frame, one above
+ * for its debug boxes. Overlapping fighters then keep a fixed order
+ * whatever surface their frames come from.
+ */
+enum {
+    LEVEL_BACKGROUND = 0,
+    LEVEL_FIGHTERS = 1,
+    LEVEL_ENTITIES = LEVEL_FIGHTERS + 2 * MAX_FIGHTERS,
+    LEVEL_HUD,
+};
+
+// common part of two overlapping rects
+static struct CollisionRect rectOverlap(const struct CollisionRect &rect1, const struct CollisionRect &rect2)
+{
+    struct CollisionRect overlap;
+    overlap.x = std::max(rect1.x, rect2.x);
+    overlap.y = std::max(rect1.y, rect2.y);
+    overlap.w = std::min(rect1.x + rect1.w, rect2.x + rect2.w) - overlap.x;
+    overlap.h = std::min(rect1.y + rect1.h, rect2.y + rect2.h) - overlap.y;
+    return overlap;
+}
+
+static bool rectsMeet(const SDL_Rect &rect1, const SDL_Rect &rect2)
+{
+    return rect1.x <= rect2.x + rect2.w && rect2.x <= rect1.x + rect1.w
+        && rect1.y <= rect2.y + rect2.h && rect2.y <= rect1.y + rect1.h;
+}
+
+static SDL_Rect rectUnion(const SDL_Rect &rect1, const SDL_Rect &rect2)
+{
+    int left = std::min(rect1.x, rect2.x);
+    int top = std::min(rect1.y, rect2.y);
+    int right = std::max(rect1.x + rect1.w, rect2.x + rect2.w);
+    int bottom = std::max(rect1.y + rect1.h, rect2.y + rect2.h);
+    SDL_Rect rect = {(Sint16)left, (Sint16)top, (Uint16)(right - left), (Uint16)(bottom - top)};
+    return rect;
+}
+
+// rect cut to the surface, false if nothing is left
+static bool clipToSurface(SDL_Rect &rect, SDL_Surface *surface)
+{
+    int left = std::max((int)rect.x, 0);
+    int top = std::max((int)rect.y, 0);
+    int right = std::min(rect.x + rect.w, surface->w);
+    int bottom = std::min(rect.y + rect.h, surface->h);
+    if (left >= right || top >= bottom) {
+        return false;
+    }
+    rect.x = left;
+    rect.y = top;
+    rect.w = right - left;
+    rect.h = bottom - top;
+    return true;
+}
+
+// insertion sort of fighter indexes on keys, nearly sorted from last frame
+static void sortOrder(int *order, int size, const float *keys)
+{
+    for (int i=1; i<size; i++) {
+        int index = order[i];
+        int j = i - 1;
+        while (j >= 0 && keys[order[j]] > keys[index]) {
+            order[j + 1] = order[j];
+            j--;
+        }
+        order[j + 1] = index;
+    }
+}
+
+static bool isStanding(Sprite *fighter)
+{
+    return fighter->getState() == Character::STAND || fighter->getState() == Character::WALK;
+}
+
+Stage::Stage() :
+    numFighters(0),
+    prevScroll(0),
+    drawAlpha(1),
+    savedScroll(0),
+    numDrawnRects(0),
+    drawnScroll(0),
+    redrawAll(true),
     groundline(0),
     bkImage(NULL),
     bkRect(),
-    p1Health(0),
-    p2Health(0),
-    healthbarP1(),
-    healthbarP2()
+    replayWriter(NULL),
+    pixelCollision(false),
+    entities(MAX_ENTITIES),
+    numHitEvents(0)
 {
-    addChild(player1);
-    addChild(player2);
-
-    player1->setPosition(275.0f, 200.0f);
-    player1->setFacing(Character::RIGHT);
-    player1->setFlipHorizontal(true);
+    init();
+}
 
-    player2->setPosition(475.0f, 200.0f);
-    player2->setFacing(Character::LEFT);
-    player2->setFlipHorizontal(false);
+Stage::Stage(Sprite *player1, Sprite *player2) :
+    numFighters(0),
+    prevScroll(0),
+    drawAlpha(1),
+    savedScroll(0),
+    numDrawnRects(0),
+    drawnScroll(0),
+    redrawAll(true),
+    groundline(0),
+    bkImage(NULL),
+    bkRect(),
+    replayWriter(NULL),
+    pixelCollision(false),
+    entities(MAX_ENTITIES),
+    numHitEvents(0)
+{
+    init();
+    addFighter(player1, 1, 275.0f);
+    addFighter(player2, 2, 475.0f);
+}
 
+void Stage::init()
+{
     groundline = 200.0f;
 
     // Background
@@ -33,17 +132,6 @@ Stage::Stage(Sprite *player1, Sprite *player2) :
     bkImage = SDL_DisplayFormat(imgloaded);
     SDL_FreeSurface(imgloaded);
     bkRect = {0, 0, 750, 224};
-
-    // Health bar
-    p1Health = 10000;
-    healthbarP1.setGeometry(4, 4, 190, 15);
-    healthbarP1.setMax(p1Health);
-    healthbarP1.setCurrent(p1Health);
-    healthbarP1.setLeftToRight(false);
-    p2Health = 10000;
-    healthbarP2.setGeometry(226, 4, 190, 15);
-    healthbarP2.setMax(p2Health);
-    healthbarP2.setCurrent(p2Health);
 }
 
 Stage::~Stage()
@@ -51,171 +139,272 @@ Stage::~Stage()
     SDL_FreeSurface(bkImage);
 }
 
-void Stage::update(Uint32 frameStamp)
+int Stage::addFighter(Sprite *fighter, int team, float x)
 {
-    player1->update(frameStamp);
-    player2->update(frameStamp);
+    if (numFighters == MAX_FIGHTERS) {
+        throw "Stage: too many fighters";
+    }
+    int i = numFighters;
+    int sameSide = 0;
+    for (int j=0; j<numFighters; j++) {
+        if ((teams[j] == 1) == (team == 1)) {
+            sameSide ++;
+        }
+    }
 
-    float p1vx = player1->getVelocityX();
-    float p1vy = player1->getVelocityY();
-    float p1x = player1->getPositionX();
-    float p1y = player1->getPositionY();
-    float p2vx = player2->getVelocityX();
-    float p2vy = player2->getVelocityY();
-    float p2x = player2->getPositionX();
-    float p2y = player2->getPositionY();
+    fighters[i] = fighter;
+    teams[i] = team;
+    addChild(fighter);
 
-    int edgeleft = std::max(p1x, p2x) - 380;
-    int edgeright = std::min(p1x, p2x) + 380;
-    edgeleft = std::max(edgeleft, 20);
-    edgeright = std::min(edgeright, 730);
+    // face the middle of the stage until there is someone to face
+    fighter->setPosition(x, groundline);
+    prevX[i] = x;
+    prevY[i] = groundline;
+    if (x < 375.0f) {
+        fighter->setFacing(Character::RIGHT);
+        fighter->setFlipHorizontal(true);
+    } else {
+        fighter->setFacing(Character::LEFT);
+        fighter->setFlipHorizontal(false);
+    }
 
-    int rectsize1 = 0, rectsize2 = 0;
-    const SDL_Rect *area1 = NULL, *area2 = NULL;
-    bool p1hit = false, p2hit = false;
+    // Health bar, team 1 on the left, stacked per side
+    healths[i] = 10000;
+    drawnHealths[i] = -1;
+    healthbars[i].setMax(healths[i]);
+    healthbars[i].setCurrent(healths[i]);
+    if (team == 1) {
+        healthbars[i].setGeometry(4, 4 + sameSide * 19, 190, 15);
+        healthbars[i].setLeftToRight(false);
+    } else {
+        healthbars[i].setGeometry(226, 4 + sameSide * 19, 190, 15);
+    }
 
-    if (player1->getState() == Character::STAND || player1->getState() == Character::WALK) {
-        if (p1x > p2x) {
-            player1->setFacing(Character::LEFT);
-            player1->setFlipHorizontal(false);
-        } else if (p1x < p2x) {
-            player1->setFacing(Character::RIGHT);
-            player1->setFlipHorizontal(true);
-        }
+    posOrder[i] = i;
+    reachOrder[i] = i;
+    numFighters ++;
+    return numFighters;
+}
+
+int Stage::getNumFighters()
+{
+    return numFighters;
+}
+
+Sprite *Stage::getFighter(int number)
+{
+    return fighters[number - 1];
+}
+
+// turn fighter at rank of posOrder toward the nearest opponent
+void Stage::updateFacing(int rank)
+{
+    int i = posOrder[rank];
+    int left = rank - 1;
+    int right = rank + 1;
+    while (left >= 0 && teams[posOrder[left]] == teams[i]) {
+        left --;
     }
-    if (player2->getState() == Character::STAND || player2->getState() == Character::WALK) {
-        if (p2x > p1x) {
-            player2->setFacing(Character::LEFT);
-            player2->setFlipHorizontal(false);
-        } else if (p2x < p1x) {
-            player2->setFacing(Character::RIGHT);
-            player2->setFlipHorizontal(true);
-        }
+    while (right < numFighters && teams[posOrder[right]] == teams[i]) {
+        right ++;
+    }
+    if (left < 0 && right >= numFighters) {
+        return;
     }
 
-    if (!player2->isInvincible()) {
-        area1 = player1->getCurRealAttackCollisionRects(rectsize1);
-        area2 = player2->getCurRealHitCollisionRects(rectsize2);
-        p2hit = areaCollide(area1, rectsize1, area2, rectsize2);
+    float target;
+    if (right >= numFighters || (left >= 0 && posX[i] - posX[posOrder[left]] < posX[posOrder[right]] - posX[i])) {
+        target = posX[posOrder[left]];
+    } else {
+        target = posX[posOrder[right]];
+    }
+    if (posX[i] > target) {
+        fighters[i]->setFacing(Character::LEFT);
+        fighters[i]->setFlipHorizontal(false);
+    } else if (posX[i] < target) {
+        fighters[i]->setFacing(Character::RIGHT);
+        fighters[i]->setFlipHorizontal(true);
     }
+}
 
-    if (!player1->isInvincible()) {
-        area1 = player1->getCurRealHitCollisionRects(rectsize1);
-        area2 = player2->getCurRealAttackCollisionRects(rectsize2);
-        p1hit = areaCollide(area1, rectsize1, area2, rectsize2);
+void Stage::update(Uint32 frameStamp)
+{
+    prevScroll = position.x;
+    for (int i=0; i<numFighters; i++) {
+        prevX[i] = fighters[i]->getPositionX();
+        prevY[i] = fighters[i]->getPositionY();
+        fighters[i]->update(frameStamp);
+    }
+
+    if (replayWriter != NULL) {
+        for (int i=0; i<numFighters; i++) {
+            if (fighters[i]->getRecognizedCommand()[0] != '\0') {
+                replayWriter->writeCommand(frameStamp, i + 1, fighters[i]->getRecognizedCommand());
+            }
+        }
     }
 
-    if (p1hit && !player1->isGuard()) {
-        p1Health -= 1000;
-        if (p1Health < 0) p1Health = 0;
-        player1->underAttack( (player2->getState() == Character::ATTACK || player2->getState() == Character::JUMPATTACK) ? Character::HitType::NORMAL : Character::HitType::THUMP);
-        healthbarP1.setCurrent(p1Health);
-        printf("p1hit\n");
+    for (int i=0; i<numFighters; i++) {
+        velX[i] = fighters[i]->getVelocityX();
+        velY[i] = fighters[i]->getVelocityY();
+        posX[i] = fighters[i]->getPositionX();
+        posY[i] = fighters[i]->getPositionY();
     }
-    if (p2hit && !player2->isGuard()) {
-        p2Health -= 1000;
-        if (p2Health < 0) p2Health = 0;
-        player2->underAttack( (player1->getState() == Character::ATTACK || player1->getState() == Character::JUMPATTACK) ? Character::HitType::NORMAL : Character::HitType::THUMP);
-        healthbarP2.setCurrent(p2Health);
-        printf("p2hit\n");
+    sortOrder(posOrder, numFighters, posX);
+    if (numFighters == 0) {
+        return;
     }
 
-    if ((player1->getState() == Character::STAND || player1->getState() == Character::WALK) && (player2->getState() == Character::STAND || player2->getState() == Character::WALK)) {
-        if (fabsf(p1x - p2x) < 40) {
-            if (p1x > p2x) {
-                p1vx = 1;
-                p2vx = -1;
-            } else {
-                p1vx = -1;
-                p2vx = 1;
-            }
-            /*if (abs(p1vx) < 0.001 && abs(p2vx) < 0.001) {
-                if (p1x > p2x) {
-                    p1vx = 1;
-                    p2vx = -1;
-                } else {
-                    p1vx = -1;
-                    p2vx = 1;
-                }
-            } else if (p1x < p2x && p1vx > 0 && p2vx < 0) {
-                p1vx = 0;
-                p2vx = 0;
-            } else if (p1x > p2x && p1vx < 0 && p2vx > 0) {
-                p1vx = 0;
-                p2vx = 0;
-            } else if (p1x < p2x && p1vx > 0 && p2vx >= 0) {
-                p1vx = 1;
-                if (p2vx < 0.001) {
-                    p2vx = 1;
-                }
-            } else if (p1x > p2x && p1vx < 0 && p2vx <= 0) {
-                p1vx = -1;
-                if (p2vx > -0.001) {
-                    p2vx = -1;
-                }
-            } else if (p2x < p1x && p2vx > 0 && p1vx >= 0) {
-                p2vx = 1;
-                if (p1vx < 0.001) {
-                    p1vx = 1;
-                }
-            } else if (p2x > p1x && p2vx < 0 && p1vx <= 0) {
-                p2vx = -1;
-                if (p1vx > -0.001) {
-                    p1vx = -1;
-                }
-            }*/
+    // everyone stays on one screen
+    int edgeleft = posX[posOrder[numFighters - 1]] - 380;
+    int edgeright = posX[posOrder[0]] + 380;
+    edgeleft = std::max(edgeleft, 20);
+    edgeright = std::min(edgeright, 730);
+
+    for (int r=0; r<numFighters; r++) {
+        if (isStanding(fighters[posOrder[r]])) {
+            updateFacing(r);
         }
     }
-    p1x += p1vx;
-    p2x += p2vx;
-    p1y += p1vy;
-    p2y += p2vy;
 
-    if (p1x < edgeleft) {
-        p1x = edgeleft;
+    for (int i=0; i<numFighters; i++) {
+        fighters[i]->updateRealCollisionRects();
     }
-    if (p1x > edgeright) {
-        p1x = edgeright;
+
+    numHitEvents = 0;
+    meleeHits(frameStamp);
+
+    // projectiles
+    for (int i=0; i<numFighters; i++) {
+        if (fighters[i]->takeProjectileRequest()) {
+            spawnProjectile(i);
+        }
     }
-    if (p2x < edgeleft) {
-        p2x = edgeleft;
+    entities.update();
+    for (int i=0; i<entities.getNumActive(); i++) {
+        struct Entity *entity = entities.getActive(i);
+        if (entity->x < 0 || entity->x > 750) {
+            entities.kill(entity);
+        }
     }
-    if (p2x > edgeright) {
-        p2x = edgeright;
+
+    struct CollisionBody bodies[MAX_FIGHTERS];
+    for (int i=0; i<numFighters; i++) {
+        bodies[i].owner = i + 1;
+        bodies[i].bounds = &fighters[i]->getCurRealHitBounds();
+        bodies[i].lanes = fighters[i]->getCurRealHitLanes();
     }
+    struct EntityHit hits[MAX_ENTITY_HITS];
+    int numhits = entities.collide(bodies, numFighters, hits, MAX_ENTITY_HITS);
+    for (int i=0; i<numhits && numHitEvents < MAX_HIT_EVENTS; i++) {
+        struct Entity *entity = hits[i].entity;
+        Sprite *defender = fighters[hits[i].body];
+        // passes through the owner's teammates
+        if (!entity->alive || teams[entity->owner - 1] == teams[hits[i].body] || defender->isInvincible()) {
+            continue;
+        }
+        entities.kill(entity);
 
-    if (p1y > groundline) {
-        p1y = groundline;
-        player1->hitGround();
+        int size = 0;
+        struct CollisionRect rect = entity->rect;
+        rect.x += entity->x;
+        rect.y += entity->y;
+        struct HitEvent *event = &hitEvents[numHitEvents++];
+        event->frame = frameStamp;
+        event->attacker = entity->owner;
+        event->defender = hits[i].body + 1;
+        event->source = HIT_PROJECTILE;
+        event->guarded = defender->isGuard();
+        event->attackerState = Character::NONE;
+        event->attackerCommand = -1;
+        event->attackRect = -1;
+        event->hitRect = hits[i].rect;
+        event->overlap = rectOverlap(rect, defender->getCurRealHitCollisionRects(size)[hits[i].rect]);
     }
-    if (p2y > groundline) {
-        p2y = groundline;
-        player2->hitGround();
+
+    // one hit per defender and frame, melee before projectiles
+    bool damaged[MAX_FIGHTERS] = {false};
+    for (int i=0; i<numHitEvents; i++) {
+        const struct HitEvent *event = &hitEvents[i];
+        int d = event->defender - 1;
+        Sprite *attacker = fighters[event->attacker - 1];
+        Sprite *defender = fighters[d];
+        spawnSpark(event->overlap);
+        if (event->guarded || damaged[d]) {
+            continue;
+        }
+        damaged[d] = true;
+
+        if (replayWriter != NULL) {
+            const char *command = "";
+            if (attacker->getCommandTable() != NULL) {
+                command = attacker->getCommandTable()->getCommandName(event->attackerCommand);
+            }
+            replayWriter->writeHit(frameStamp, event->attacker, event->defender, event->attackerState, command);
+        }
+
+        healths[d] -= 1000;
+        if (healths[d] < 0) healths[d] = 0;
+        defender->underAttack( (event->source == HIT_PROJECTILE || event->attackerState == Character::ATTACK
+                    || event->attackerState == Character::JUMPATTACK) ? Character::HitType::NORMAL : Character::HitType::THUMP);
+        healthbars[d].setCurrent(healths[d]);
+        LOG_DEBUG("p%d hit p%d, state %d, overlap %.1f,%.1f %.1fx%.1f", event->attacker, event->defender,
+                event->attackerState, event->overlap.x, event->overlap.y, event->overlap.w, event->overlap.h);
     }
 
-    player1->setPosition(p1x, p1y);
-    player2->setPosition(p2x, p2y);
+    // standing fighters closer than 40 push each other apart, teammates too
+    for (int r=0; r<numFighters; r++) {
+        int i = posOrder[r];
+        for (int q=r+1; q<numFighters && posX[posOrder[q]] - posX[i] < 40; q++) {
+            int j = posOrder[q];
+            if (isStanding(fighters[i]) && isStanding(fighters[j])) {
+                velX[i] = -1;
+                velX[j] = 1;
+            }
+        }
+    }
 
-    // scroll
-    int p1ScreenX = player1->getPositionScreenCoor().x;
-    int p2ScreenX = player2->getPositionScreenCoor().x;
-    int distance = abs(p1ScreenX - p2ScreenX);
+    for (int i=0; i<numFighters; i++) {
+        posX[i] += velX[i];
+        posY[i] += velY[i];
 
-    if (distance < 240) {
-        if (p1ScreenX < 90) {
-            position.x = (position.x + 90 - p1ScreenX);
+        if (posX[i] < edgeleft) {
+            posX[i] = edgeleft;
         }
-        if (p1ScreenX > 330) {
-            position.x = (position.x + 330 - p1ScreenX);
+        if (posX[i] > edgeright) {
+            posX[i] = edgeright;
+        }
+
+        if (posY[i] > groundline) {
+            posY[i] = groundline;
+            fighters[i]->hitGround();
         }
-        if (p2ScreenX < 90) {
-            position.x = (position.x + 90 - p2ScreenX);
+
+        fighters[i]->setPosition(posX[i], posY[i]);
+    }
+
+    // scroll
+    int minScreenX = fighters[0]->getPositionScreenCoor().x;
+    int maxScreenX = minScreenX;
+    float minX = posX[0], maxX = posX[0];
+    for (int i=1; i<numFighters; i++) {
+        int screenX = fighters[i]->getPositionScreenCoor().x;
+        minScreenX = std::min(minScreenX, screenX);
+        maxScreenX = std::max(maxScreenX, screenX);
+        minX = std::min(minX, posX[i]);
+        maxX = std::max(maxX, posX[i]);
+    }
+    int distance = maxScreenX - minScreenX;
+
+    if (distance < 240) {
+        if (minScreenX < 90) {
+            position.x = (position.x + 90 - minScreenX);
         }
-        if (p2ScreenX > 330) {
-            position.x = (position.x + 330 - p2ScreenX);
+        if (maxScreenX > 330) {
+            position.x = (position.x + 330 - maxScreenX);
         }
     } else if (distance <= 380) {
-        position.x = - ((p1x + p2x) / 2 - 210);
+        position.x = - ((minX + maxX) / 2 - 210);
     } else {
         printf("Can't be here!\n");
     }
@@ -226,18 +415,293 @@ void Stage::update(Uint32 frameStamp)
     if (position.x < -330) {
         position.x = -330;
     }
+
+    if (replayWriter != NULL) {
+        replayWriter->endFrame(frameStamp);
+    }
+}
+
+/*
+ * Broad phase: fighters sorted on the left edge of their hit and attack
+ * areas, only pairs whose extents meet on x reach the rect tests.
+ */
+void Stage::meleeHits(Uint32 frameStamp)
+{
+    for (int i=0; i<numFighters; i++) {
+        const struct CollisionRect &hit = fighters[i]->getCurRealHitBounds();
+        const struct CollisionRect &attack = fighters[i]->getCurRealAttackBounds();
+        reachLeft[i] = std::min(hit.x, attack.x);
+        reachRight[i] = std::max(hit.x + hit.w, attack.x + attack.w);
+    }
+    sortOrder(reachOrder, numFighters, reachLeft);
+
+    for (int r=0; r<numFighters; r++) {
+        int i = reachOrder[r];
+        for (int q=r+1; q<numFighters && reachLeft[reachOrder[q]] <= reachRight[i]; q++) {
+            int j = reachOrder[q];
+            if (teams[i] == teams[j]) {
+                continue;
+            }
+            // lower fighter number first, events keep the old p1 then p2 order
+            int a = std::min(i, j), b = std::max(i, j);
+            if (!fighters[b]->isInvincible()) {
+                meleeHit(frameStamp, a, b);
+            }
+            if (!fighters[a]->isInvincible()) {
+                meleeHit(frameStamp, b, a);
+            }
+        }
+    }
+}
+
+void Stage::spawnProjectile(int owner)
+{
+    Sprite *fighter = fighters[owner];
+    float direction = (fighter->getFacing() == Character::RIGHT) ? 1.0f : -1.0f;
+    struct Entity *entity = entities.spawn(ENTITY_PROJECTILE, owner + 1,
+            fighter->getPositionX() + 40 * direction, fighter->getPositionY() - 50, 4 * direction, 0, 120);
+    if (entity == NULL) {
+        return;
+    }
+    entity->rect.x = -12;
+    entity->rect.y = -8;
+    entity->rect.w = 24;
+    entity->rect.h = 16;
+}
+
+// record a hit of attacker's attack area on defender's hit area
+void Stage::meleeHit(Uint32 frameStamp, int a, int d)
+{
+    Sprite *attacker = fighters[a];
+    Sprite *defender = fighters[d];
+    int attacksize = 0, hitsize = 0;
+    int attackindex = -1, hitindex = -1;
+    const struct CollisionRect *attackrects = attacker->getCurRealAttackCollisionRects(attacksize);
+    const struct CollisionRect *hitrects = defender->getCurRealHitCollisionRects(hitsize);
+
+    if (!areaCollide(attackrects, attacksize, attacker->getCurRealAttackBounds(),
+                defender->getCurRealHitLanes(), defender->getCurRealHitBounds(), &attackindex, &hitindex)) {
+        return;
+    }
+    if (pixelCollision && !pixelCollide(attacker, defender)) {
+        return;
+    }
+    if (numHitEvents == MAX_HIT_EVENTS) {
+        return;
+    }
+
+    struct HitEvent *event = &hitEvents[numHitEvents++];
+    event->frame = frameStamp;
+    event->attacker = a + 1;
+    event->defender = d + 1;
+    event->source = HIT_MELEE;
+    event->guarded = defender->isGuard();
+    event->attackerState = attacker->getState();
+    event->attackerCommand = attacker->getStateCommandId();
+    event->attackRect = attackindex;
+    event->hitRect = hitindex;
+    event->overlap = rectOverlap(attackrects[attackindex], hitrects[hitindex]);
+}
+
+const struct HitEvent *Stage::getHitEvents(int &size)
+{
+    size = numHitEvents;
+    return hitEvents;
+}
+
+// a short lived spark in the middle of rect
+void Stage::spawnSpark(const struct CollisionRect &rect)
+{
+    struct Entity *entity = entities.spawn(ENTITY_SPARK, 0, rect.x + rect.w / 2, rect.y + rect.h / 2, 0, 0, 10);
+    if (entity == NULL) {
+        return;
+    }
+    entity->rect.x = -6;
+    entity->rect.y = -6;
+    entity->rect.w = 12;
+    entity->rect.h = 12;
+}
+
+void Stage::setReplayWriter(ReplayWriter *writer)
+{
+    this->replayWriter = writer;
+}
+
+void Stage::setPixelCollision(bool enable)
+{
+    this->pixelCollision = enable;
+}
+
+// the frames must touch where the attack and hit areas meet
+bool Stage::pixelCollide(Sprite *attacker, Sprite *defender)
+{
+    return attacker->maskCollide(defender,
+            rectOverlap(attacker->getCurRealAttackBounds(), defender->getCurRealHitBounds()));
 }
 
-void Stage::draw(SDL_Surface *dst)
+void Stage::setDrawAlpha(float alpha)
+{
+    this->drawAlpha = alpha;
+}
+
+// move the widgets to their in between positions, put back after drawing
+void Stage::placeForDraw()
+{
+    savedScroll = position.x;
+    position.x = (Sint16)(prevScroll + (savedScroll - prevScroll) * drawAlpha);
+    for (int i=0; i<numFighters; i++) {
+        float x = fighters[i]->getPositionX();
+        float y = fighters[i]->getPositionY();
+        fighters[i]->Widget::setPosition((int)(prevX[i] + (x - prevX[i]) * drawAlpha),
+                (int)(prevY[i] + (y - prevY[i]) * drawAlpha));
+    }
+}
+
+void Stage::restoreAfterDraw()
+{
+    position.x = savedScroll;
+    for (int i=0; i<numFighters; i++) {
+        fighters[i]->setPosition(fighters[i]->getPositionX(), fighters[i]->getPositionY());
+    }
+}
+
+SDL_Rect Stage::entityScreenRect(const struct Entity *entity, const SDL_Rect &screenposition)
+{
+    // entities moved by vx, vy in the last update
+    float x = entity->x - entity->vx * (1 - drawAlpha);
+    float y = entity->y - entity->vy * (1 - drawAlpha);
+    SDL_Rect rect = {(Sint16)(screenposition.x + x + entity->rect.x),
+        (Sint16)(screenposition.y + y + entity->rect.y),
+        (Uint16)entity->rect.w, (Uint16)entity->rect.h};
+    return rect;
+}
+
+void Stage::renderScene(RenderList *list)
 {
     SDL_Rect screenposition = getPositionScreenCoor();
-    SDL_BlitSurface(bkImage, &bkRect, dst, &screenposition);
-    player1->draw(dst);
-    player2->draw(dst);
-    healthbarP1.draw(dst);
-    healthbarP2.draw(dst);
+    list->setLevel(LEVEL_BACKGROUND);
+    list->blit(bkImage, bkRect, screenposition.x, screenposition.y);
+    for (int i=0; i<numFighters; i++) {
+        list->setLevel(LEVEL_FIGHTERS + 2 * i);
+        fighters[i]->render(list);
+    }
+    list->setLevel(LEVEL_ENTITIES);
+    for (int i=0; i<entities.getNumActive(); i++) {
+        struct Entity *entity = entities.getActive(i);
+        SDL_Rect rect = entityScreenRect(entity, screenposition);
+        if (entity->type == ENTITY_PROJECTILE) {
+            list->fill(rect, 255, 128, 0);
+        } else {
+            list->fill(rect, 255, 255, 160);
+        }
+    }
+    list->setLevel(LEVEL_HUD);
+    for (int i=0; i<numFighters; i++) {
+        healthbars[i].render(list);
+        SDL_Rect geometry = healthbars[i].getGeometry();
+        list->text(geometry.x + 3, geometry.y + (geometry.h - FONT_HEIGHT) / 2, fighters[i]->getName(), 64, 32, 32);
+    }
+}
+
+void Stage::render(RenderList *list)
+{
+    placeForDraw();
+    renderScene(list);
+    restoreAfterDraw();
+}
+
+void Stage::invalidate()
+{
+    redrawAll = true;
 }
 
+int Stage::drawDirty(SDL_Surface *dst, SDL_Rect *rects, int maxRects)
+{
+    placeForDraw();
+
+    // what is on screen now: sprites, entities and health bars that changed
+    SDL_Rect current[MAX_DIRTY_RECTS];
+    int numCurrent = 0;
+    bool overflow = false;
+    SDL_Rect screenposition = getPositionScreenCoor();
+    for (int i=0; i<numFighters + entities.getNumActive(); i++) {
+        SDL_Rect rect;
+        if (i < numFighters) {
+            rect = fighters[i]->getScreenRect();
+        } else {
+            rect = entityScreenRect(entities.getActive(i - numFighters), screenposition);
+        }
+        if (!clipToSurface(rect, dst)) {
+            continue;
+        }
+        if (numCurrent == MAX_DIRTY_RECTS) {
+            overflow = true;
+            break;
+        }
+        current[numCurrent++] = rect;
+    }
 
+    // dirty: where things were plus where they are, overlaps merged
+    SDL_Rect dirty[MAX_DIRTY_RECTS * 2 + MAX_FIGHTERS];
+    int numDirty = 0;
+    for (int i=0; i<numDrawnRects; i++) {
+        dirty[numDirty++] = drawnRects[i];
+    }
+    for (int i=0; i<numCurrent; i++) {
+        dirty[numDirty++] = current[i];
+    }
+    for (int i=0; i<numFighters; i++) {
+        SDL_Rect rect = healthbars[i].getGeometry();
+        if (healths[i] != drawnHealths[i] && clipToSurface(rect, dst)) {
+            dirty[numDirty++] = rect;
+        }
+        drawnHealths[i] = healths[i];
+    }
+    // a grown rect may meet ones already passed, repeat until nothing merges
+    bool merged = true;
+    while (merged) {
+        merged = false;
+        for (int i=0; i<numDirty; i++) {
+            for (int j=i+1; j<numDirty; j++) {
+                if (rectsMeet(dirty[i], dirty[j])) {
+                    dirty[i] = rectUnion(dirty[i], dirty[j]);
+                    dirty[j--] = dirty[--numDirty];
+                    merged = true;
+                }
+            }
+        }
+    }
+
+#ifdef DEBUG
+    // collision boxes are drawn outside the sprite frames
+    redrawAll = true;
+#endif
+    // built once, executed for each dirty rect
+    sceneList.clear();
+    renderScene(&sceneList);
+    sceneList.sort();
+    SurfaceBackend backend(dst);
+    if (redrawAll || overflow || position.x != drawnScroll || numDirty > maxRects) {
+        backend.execute(sceneList, NULL);
+        rects[0].x = 0;
+        rects[0].y = 0;
+        rects[0].w = dst->w;
+        rects[0].h = dst->h;
+        numDirty = 1;
+    } else {
+        for (int i=0; i<numDirty; i++) {
+            backend.execute(sceneList, &dirty[i]);
+            rects[i] = dirty[i];
+        }
+    }
+
+    memcpy(drawnRects, current, sizeof(SDL_Rect) * numCurrent);
+    numDrawnRects = numCurrent;
+    drawnScroll = position.x;
+    redrawAll = overflow;
+    restoreAfterDraw();
+    return numDirty;
 }
 
+
+}
@@ -4,30 +4,124 @@
 #include "widget.h"
 #include "sprite.h"
 #include "collisiondetect.h"
+#include "entitypool.h"
 #include "healthbar.h"
+#include "replay.h"
 
 namespace dragonfighting {
 
+enum HitSource {
+    HIT_MELEE,
+    HIT_PROJECTILE,
+};
+
+// one attack connecting in a frame, guarded or not
+struct HitEvent {
+    Uint32 frame;
+    Uint8 attacker;         // fighter number, 1 based
+    Uint8 defender;
+    Uint8 source;
+    Uint8 guarded;
+    int attackerState;      // when the hit was found, NONE for projectiles
+    int attackerCommand;    // command id that started the attack, -1 for none
+    Sint16 attackRect;      // index in the attacker's attack rects, -1 for projectiles
+    Sint16 hitRect;         // index in the defender's hit rects
+    struct CollisionRect overlap;
+};
+
+const int MAX_HIT_EVENTS = 32;
+const int MAX_FIGHTERS = 8;
+const int MAX_DIRTY_RECTS = 64;
+
 class Stage : public Widget
 {
     public:
+        Stage();
+        // one on one, p1 on team 1 and p2 on team 2
         Stage(Sprite *p1, Sprite *p2);
         ~Stage();
 
+        // returns the fighter number, fighters of the same team never hit each other
+        int addFighter(Sprite *fighter, int team, float x);
+        int getNumFighters();
+        Sprite *getFighter(int number);
+
         void update(Uint32 frameStamp);
-        void draw(SDL_Surface *dst);
+        void render(RenderList *list);
+        /*
+         * Draw between the last two updates, 0 the one before, 1 the last.
+         * Only for presents that run off the step clock, e.g. a display
+         * faster than the simulation; presenting right after a step wants 1.
+         */
+        void setDrawAlpha(float alpha);
+        /*
+         * Redraw only what moved or changed since the last call and return
+         * the screen rects to pass to SDL_UpdateRects. A camera scroll, or
+         * more changes than maxRects, redraws and returns the whole of dst.
+         */
+        int drawDirty(SDL_Surface *dst, SDL_Rect *rects, int maxRects);
+        // the next drawDirty redraws everything
+        void invalidate();
+        void setReplayWriter(ReplayWriter *writer);
+        // melee hits also need the drawn pixels to touch
+        void setPixelCollision(bool enable);
+        // hits found by the last update
+        const struct HitEvent *getHitEvents(int &size /*out*/);
 
     private:
-        Sprite *player1;
-        Sprite *player2;
+        // per fighter state in parallel arrays, indexed by fighter number - 1
+        Sprite *fighters[MAX_FIGHTERS];
+        int teams[MAX_FIGHTERS];
+        int healths[MAX_FIGHTERS];
+        HealthBar healthbars[MAX_FIGHTERS];
+        float posX[MAX_FIGHTERS];
+        float posY[MAX_FIGHTERS];
+        float velX[MAX_FIGHTERS];
+        float velY[MAX_FIGHTERS];
+        float reachLeft[MAX_FIGHTERS];     // x extent of hit and attack areas
+        float reachRight[MAX_FIGHTERS];
+        // fighters sorted on posX and on reachLeft, kept from frame to frame
+        int posOrder[MAX_FIGHTERS];
+        int reachOrder[MAX_FIGHTERS];
+        int numFighters;
+        // positions before the last update, for drawing in between
+        float prevX[MAX_FIGHTERS];
+        float prevY[MAX_FIGHTERS];
+        Sint16 prevScroll;
+        float drawAlpha;
+        Sint16 savedScroll;
+        // what the last drawDirty put on screen
+        SDL_Rect drawnRects[MAX_DIRTY_RECTS];
+        int numDrawnRects;
+        Sint16 drawnScroll;
+        int drawnHealths[MAX_FIGHTERS];
+        bool redrawAll;
+        RenderList sceneList;
         float groundline;
         SDL_Surface *bkImage;
         SDL_Rect bkRect;
 
-        int p1Health;
-        int p2Health;
-        HealthBar healthbarP1;
-        HealthBar healthbarP2;
+        ReplayWriter *replayWriter;
+        bool pixelCollision;
+
+        // projectiles and hit sparks
+        EntityPool entities;
+
+        struct HitEvent hitEvents[MAX_HIT_EVENTS];
+        int numHitEvents;
+
+        void init();
+        void updateFacing(int rank);
+        void meleeHits(Uint32 frameStamp);
+        void spawnProjectile(int owner);
+        void meleeHit(Uint32 frameStamp, int attacker, int defender);
+        void spawnSpark(const struct CollisionRect &rect);
+        bool pixelCollide(Sprite *attacker, Sprite *defender);
+        void placeForDraw();
+        void restoreAfterDraw();
+        SDL_Rect entityScreenRect(const struct Entity *entity, const SDL_Rect &screenposition);
+        // at the positions placeForDraw set
+        void renderScene(RenderList *list);
 };
 
 
@@ -0,0 +1,158 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include "character.h"
+#include "statetable.h"
+
+namespace dragonfighting {
+
+// in Character::State order
+static const char *stateNames[] = {
+    "NONE",
+    "STAND",
+    "ATTACK",
+    "ATTACK2",
+    "ATTACK3",
+    "ATTACK4",
+    "GUARD",
+    "HIT",
+    "FALL",
+    "LIE",
+    "RAISE",
+    "WALK",
+    "RUN",
+    "DASH",
+    "SQUAT",
+    "SQUATATTACK",
+    "SQUATGUARD",
+    "JUMP",
+    "JUMP2",
+    "JUMPATTACK",
+    "JUMPGUARD",
+    "JUMPHIT",
+    "LAND",
+    "COUNTERED",
+    "GUARDBREAK",
+};
+static const int NUM_STATE_NAMES = sizeof(stateNames) / sizeof(stateNames[0]);
+
+StateTable::StateTable()
+{
+    assert(NUM_STATE_NAMES == Character::GUARDBREAK + 1);
+    assert(NUM_STATE_NAMES <= MAX_STATES);
+    // a state nobody described lasts until something ends it and returns to STAND
+    for (int i=0; i<MAX_STATES; i++) {
+        memset(&rows[i], 0, sizeof(rows[i]));
+        rows[i].duration = -1;
+        rows[i].allow = Character::ALLOW_ALL;
+        rows[i].next = Character::STAND;
+        rows[i].invincible = -1;
+        rows[i].direction = STATE_DIR_NONE;
+    }
+}
+
+void StateTable::setRow(int state, const struct StateRow &row)
+{
+    assert(state >= 0 && state < MAX_STATES);
+    rows[state] = row;
+}
+
+const struct StateRow *StateTable::getRow(int state) const
+{
+    assert(state >= 0 && state < MAX_STATES);
+    return &rows[state];
+}
+
+void StateTable::addCommand(const struct StateCommand &command)
+{
+    commands.push_back(command);
+}
+
+int StateTable::getNumCommands() const
+{
+    return commands.size();
+}
+
+const struct StateCommand *StateTable::getCommand(int i) const
+{
+    return &commands[i];
+}
+
+int StateTable::findState(const char *name)
+{
+    for (int i=0; i<NUM_STATE_NAMES; i++) {
+        if (strcmp(stateNames[i], name) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+const char *StateTable::getStateName(int state)
+{
+    if (state < 0 || state >= NUM_STATE_NAMES) {
+        return "";
+    }
+    return stateNames[state];
+}
+
+Uint32 StateTable::allowBit(int state)
+{
+    // ALLOW_STAND is bit 0, every other state is shifted by its value
+    return (state == Character::STAND) ? Character::ALLOW_STAND : Character::ALLOW_STAND << state;
+}
+
+Uint32 StateTable::parseAllow(const char *text)
+{
+    if (strcmp(text, "ALL") == 0) {
+        return Character::ALLOW_ALL;
+    }
+    if (strcmp(text, "NONE") == 0) {
+        return Character::ALLOW_NONE;
+    }
+
+    Uint32 allow = Character::ALLOW_NONE;
+    const char *p = text;
+    while (*p != '\0') {
+        char name[16];
+        size_t length = strcspn(p, "|");
+        if (length == 0 || length >= sizeof(name)) {
+            throw "Bad allow list";
+        }
+        memcpy(name, p, length);
+        name[length] = '\0';
+        int state = findState(name);
+        if (state < 0) {
+            throw "Unknown state name";
+        }
+        allow |= allowBit(state);
+        p += length;
+        if (*p == '|') {
+            p ++;
+        }
+    }
+    return allow;
+}
+
+struct StateFactor StateTable::parseFactor(const char *text)
+{
+    struct StateFactor factor = {true, 0, 1};
+    char *end = NULL;
+    factor.num = strtof(text, &end);
+    if (end == text) {
+        throw "Bad factor";
+    }
+    if (*end == '/') {
+        const char *den = end + 1;
+        factor.den = strtof(den, &end);
+        if (end == den || factor.den == 0) {
+            throw "Bad factor";
+        }
+    }
+    if (*end != '\0') {
+        throw "Bad factor";
+    }
+    return factor;
+}
+
+}
@@ -0,0 +1,83 @@
+#ifndef _STATE_TABLE_H_
+#define _STATE_TABLE_H_
+
+#include <vector>
+#include <SDL/SDL.h>
+
+namespace dragonfighting {
+
+const int MAX_STATES = 32;
+
+// which way a state's vx points
+enum StateDirection {
+    STATE_DIR_NONE,     // as given
+    STATE_DIR_FORWARD,  // toward facing when moving forward, away when backward
+    STATE_DIR_BACK,     // away from facing, knockback
+    STATE_DIR_JUMP,     // jumping direction, no vx for a straight jump
+};
+
+// speed * num / den, only applied when set
+struct StateFactor {
+    bool set;
+    float num;
+    float den;
+};
+
+/*
+ * One row per Character::State, read from <character>_state.xml.
+ * Animation and collision sequences are kept by name here and resolved to
+ * indexes once per sprite, so a state change is a table lookup.
+ */
+struct StateRow {
+    char animation[32];     // empty keeps the current animation
+    char collision[32];
+    Uint32 duration;        // frames, (Uint32)-1 until something ends the state
+    bool keepTimer;         // carry the timer over from the previous state
+    Uint32 allow;           // ALLOW_ mask of the states that may start from this one
+    int next;               // state entered when the timer runs out
+    int invincible;         // 1 or 0, -1 leaves it as it is
+    Uint32 moveTime;        // frames of movement before the sprite stops, 0 for no limit
+    bool resetPhysics;
+    bool backorder;         // animation plays backwards when moving backward
+    int direction;
+    struct StateFactor vx;
+    struct StateFactor vy;
+    struct StateFactor accy;
+};
+
+// a command that starts a state
+struct StateCommand {
+    char command[16];
+    int state;
+    bool projectile;
+};
+
+class StateTable
+{
+protected:
+    struct StateRow rows[MAX_STATES];
+    std::vector<struct StateCommand> commands;
+
+public:
+    StateTable();
+
+    void setRow(int state, const struct StateRow &row);
+    const struct StateRow *getRow(int state) const;
+    void addCommand(const struct StateCommand &command);
+    int getNumCommands() const;
+    const struct StateCommand *getCommand(int i) const;
+
+    // Character::State by its enum name ("JUMPATTACK"), -1 if unknown
+    static int findState(const char *name);
+    static const char *getStateName(int state);
+    // the ALLOW_ bit of a state
+    static Uint32 allowBit(int state);
+    // "ALL", "NONE" or state names joined by '|'
+    static Uint32 parseAllow(const char *text);
+    // "1.5", "-6" or "3/11"
+    static struct StateFactor parseFactor(const char *text);
+};
+
+}
+
+#endif
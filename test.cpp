@@ -1,7 +1,10 @@
 #include <stdlib.h>
+#include <stddef.h>
 #include <SDL/SDL.h>
 #include <SDL/SDL_image.h>
 #include <math.h>
+#include <time.h>
+#include <algorithm>
 
 #include "keyfilter.h"
 #include "ftgkeys.h"
@@ -13,18 +16,30 @@
 #include "ai.h"
 #include "stage.h"
 #include "netudp.h"
+#include "replay.h"
+#include "inputtrace.h"
+#include "lobby.h"
+#include "inputpump.h"
+#include "logger.h"
+#include "render.h"
 
 using namespace dragonfighting;
 
+static Uint64 nowNanoseconds()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (Uint64)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
 int main(int argc, char **argv)
 {
     int exited = 0;
     SDL_Surface *screen = NULL;
     bool paused = false;
-    Uint32 interval = 1000/60;
+    const Uint32 FrameRate = 60;
+    Uint32 interval = 1000/FrameRate;
     Uint32 frame = 0;
-    Uint32 oldtime = SDL_GetTicks();
-    Uint32 newtime = oldtime;
     SDL_Init(SDL_INIT_EVERYTHING);
     atexit(SDL_Quit);
 
@@ -54,30 +69,6 @@ int main(int argc, char **argv)
     // Init key filter
     KeyFilter keyFilter1;
     KeyFilter keyFilter2;
-    unsigned char cmd[][8] = {
-        {FTGKEY_6, FTGKEY_3, FTGKEY_2, FTGKEY_3, FTGKEY_A},
-        {FTGKEY_2, FTGKEY_3, FTGKEY_6, FTGKEY_A},
-        {FTGKEY_2, FTGKEY_3, FTGKEY_6, FTGKEY_B},
-        {FTGKEY_2, FTGKEY_2, FTGKEY_A},
-        {FTGKEY_6, FTGKEY_A},
-        {FTGKEY_2, FTGKEY_A},
-        {FTGKEY_3, FTGKEY_A},
-    };
-    keyFilter1.addCommand("6323A", cmd[0], 5);
-    keyFilter1.addCommand("236A", cmd[1], 4);
-    keyFilter1.addCommand("236B", cmd[2], 4);
-    keyFilter1.addCommand("22A", cmd[3], 3);
-    keyFilter1.addCommand("6A", cmd[4], 2);
-    keyFilter1.addCommand("2A", cmd[5], 2);
-    keyFilter1.addCommand("3A", cmd[6], 2);
-
-    keyFilter2.addCommand("6323A", cmd[0], 5);
-    keyFilter2.addCommand("236A", cmd[1], 4);
-    keyFilter2.addCommand("236B", cmd[2], 4);
-    keyFilter2.addCommand("22A", cmd[3], 3);
-    keyFilter2.addCommand("6A", cmd[4], 2);
-    keyFilter2.addCommand("2A", cmd[5], 2);
-    keyFilter2.addCommand("3A", cmd[6], 2);
 
     //Init network
     enum Mode
@@ -89,29 +80,115 @@ int main(int argc, char **argv)
 
     Mode mode = AIcontrol;
     Address address;
-
-    if ( argc >= 2 ) {
-        if (strcmp(argv[1], "server") == 0) {
+    const char *recordFilename = NULL;
+    const char *traceFilename = NULL;
+    bool latencyMode = false;
+    bool pixelCollision = false;
+    int numBots = 0;
+    const char *playFilename = NULL;
+    int renderEvery = 1;    // turbo: simulated frames per presented frame
+    bool uncapped = false;  // no frame pacing, as fast as the simulation goes
+    bool fullRedraw = false;    // redraw and flip the whole screen every frame
+    bool renderThread = false;  // full redraws on a thread of their own, shown a frame late
+    const char *snapshotFilename = NULL;
+    const char *logFilename = NULL;
+    const char *lobbyHost = NULL;
+    int lobbyPort = 0;
+    Uint16 udpPort = 0;
+
+    for (int i=1; i<argc; i++) {
+        if (strcmp(argv[i], "server") == 0) {
             mode = Server;
             address = Address(127,0,0,1,26801);
-        } else if (strcmp(argv[1], "client") == 0) {
+        } else if (strcmp(argv[i], "client") == 0) {
             mode = Client;
             address = Address(127,0,0,1,26800);
+        } else if (strcmp(argv[i], "lobby") == 0 && i + 3 < argc) {
+            lobbyHost = argv[++i];
+            lobbyPort = atoi(argv[++i]);
+            udpPort = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+            recordFilename = argv[++i];
+        } else if (strcmp(argv[i], "--trace-input") == 0 && i + 1 < argc) {
+            traceFilename = argv[++i];
+        } else if (strcmp(argv[i], "--latency") == 0) {
+            latencyMode = true;
+        } else if (strcmp(argv[i], "--pixel") == 0) {
+            pixelCollision = true;
+        } else if (strcmp(argv[i], "--log") == 0 && i + 1 < argc) {
+            logFilename = argv[++i];
+        } else if (strcmp(argv[i], "--bots") == 0 && i + 1 < argc) {
+            numBots = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--play") == 0 && i + 1 < argc) {
+            playFilename = argv[++i];
+        } else if (strcmp(argv[i], "--turbo") == 0 && i + 1 < argc) {
+            renderEvery = std::max(atoi(argv[++i]), 1);
+        } else if (strcmp(argv[i], "--uncapped") == 0) {
+            uncapped = true;
+        } else if (strcmp(argv[i], "--full-redraw") == 0) {
+            fullRedraw = true;
+        } else if (strcmp(argv[i], "--render-thread") == 0) {
+            renderThread = true;
+        } else if (strcmp(argv[i], "--snapshot") == 0 && i + 1 < argc) {
+            snapshotFilename = argv[++i];
         } else {
-            printf("Usage:\n");
+            printf("Usage: %s [server | client | lobby <host> <port> <udpport>] [--record replayfile] [--trace-input tracefile] [--latency] [--pixel] [--log logfile] [--bots n]"
+                    " [--play replayfile] [--turbo k] [--uncapped] [--full-redraw]"
+                    " [--render-thread] [--snapshot ppmfile]\n", argv[0]);
             return 1;
         }
-    } else {
-        mode = AIcontrol;
+    }
+    // replays only hold controllers 1 and 2, bot hits could not be replayed
+    if (numBots > 0 && (recordFilename != NULL || playFilename != NULL)) {
+        printf("--record and --play do not work with --bots\n");
+        return 1;
+    }
+    // a network match runs at the peer's pace
+    if (mode != AIcontrol || lobbyHost != NULL) {
+        if (playFilename != NULL) {
+            printf("--play is offline only\n");
+            return 1;
+        }
+        renderEvery = 1;
+        uncapped = false;
     }
 
     if ( !InitializeSockets() ) {
         printf( "failed to initialize sockets\n" );
         return 1;
     }
-    const int ProtocolId = 0x11223344;
+    int ProtocolId = 0x11223344;
+
+    if (lobbyHost != NULL) {
+        // the lobby only pairs us up, the match itself goes peer to peer
+        struct LobbyMatch match;
+        LobbyClient lobby;
+        int ret = 0;
+        try {
+            lobby.connectSocket(lobbyHost, lobbyPort);
+        } catch (const char *e) {
+            printf("lobby: %s\n", e);
+            return 1;
+        }
+        if (!lobby.sendHello(udpPort)) {
+            printf("lobby: send hello failed\n");
+            return 1;
+        }
+        printf("Waiting for an opponent...\n");
+        while ((ret = lobby.pollMatch(&match)) == 0) {
+            SDL_Delay(10);
+        }
+        lobby.disconnectSocket();
+        if (ret < 0) {
+            printf("lobby: connection lost\n");
+            return 1;
+        }
+        mode = (match.role == LOBBY_ROLE_SERVER) ? Server : Client;
+        address = Address(match.peerAddress, match.peerPort);
+        ProtocolId = match.token;
+    }
     const float TimeOut = 5.0f;
-    const float DeltaTime = interval / 1000;
+    const float DeltaTime = 1.0f / FrameRate;
     bool connected = false;
     const unsigned int maxFrameDis = 30; // 30f = 0.5sec
     const unsigned int minFrameDis = 5;
@@ -119,7 +196,10 @@ int main(int argc, char **argv)
 
     ReliableConnection connection(ProtocolId, TimeOut);
 
-    if (!connection.Start(mode == Server ? 26800 : 26801)) {
+    if (udpPort == 0) {
+        udpPort = (mode == Server) ? 26800 : 26801;
+    }
+    if (!connection.Start(udpPort)) {
         printf( "failed to start\n" );
         return -1;
     }
@@ -157,12 +237,96 @@ int main(int argc, char **argv)
     p2->setSpeed(2.0f);
 
     // Init Stage
-    Stage firstStage = Stage(p1, p2);
+    Stage firstStage(p1, p2);
     firstStage.setPosition(-165, 0);
+    firstStage.setPixelCollision(pixelCollision);
+
+    // Init replay playback, the recorded inputs drive both players
+    ReplayFile playback;
+    ReplayReader playbackP1(&playback, 1);
+    ReplayReader playbackP2(&playback, 2);
+    if (playFilename != NULL) {
+        try {
+            playback.load(playFilename);
+        } catch (const char *e) {
+            fprintf(stderr, "Error: %s\n", e);
+            exit(1);
+        }
+        p1->setInputer(&playbackP1);
+        p2->setInputer(&playbackP2);
+    }
+
+    // Init replay recording
+    AsyncWriter replayFile;
+    ReplayWriter replayWriter(&replayFile);
+    if (recordFilename != NULL) {
+        try {
+            replayFile.open(recordFilename);
+        } catch (const char *e) {
+            fprintf(stderr, "Error: %s\n", e);
+            exit(1);
+        }
+        replayWriter.begin(time(NULL), "minotaur", "minotaur", frame);
+        sdlkeyrw1.setRecorder(&replayWriter, 1);
+        sdlkeyrw2.setRecorder(&replayWriter, 2);
+        firstStage.setReplayWriter(&replayWriter);
+    }
+
+    // Init input trace
+    AsyncWriter traceFile;
+    InputTrace *inputTrace = NULL;
+    if (traceFilename != NULL) {
+        try {
+            traceFile.open(traceFilename);
+        } catch (const char *e) {
+            fprintf(stderr, "Error: %s\n", e);
+            exit(1);
+        }
+        inputTrace = new InputTrace(&traceFile);
+    } else if (latencyMode) {
+        inputTrace = new InputTrace(NULL);
+    }
+
+    // Init log
+    AsyncWriter logFile;
+    if (logFilename != NULL) {
+        try {
+            logFile.open(logFilename);
+        } catch (const char *e) {
+            fprintf(stderr, "Error: %s\n", e);
+            exit(1);
+        }
+        Logger::open(&logFile);
+    }
+    int localPlayer = (mode == Client) ? 2 : 1;
 
     // Init AI
     AI ai2 = AI(p2, p1);
 
+    // extra AI fighters on p2's team, offline only
+    if (mode != AIcontrol || numBots < 0) {
+        numBots = 0;
+    }
+    numBots = std::min(numBots, MAX_FIGHTERS - 2);
+    Sprite *bots[MAX_FIGHTERS];
+    KeyFilter botFilters[MAX_FIGHTERS];
+    CtrlKeyReaderWriter botKeys[MAX_FIGHTERS];
+    AI *botAIs[MAX_FIGHTERS];
+    for (int i=0; i<numBots; i++) {
+        bots[i] = SpriteFactory::loadSprite("data", "minotaur");
+        if (bots[i] == NULL) {
+            exit(1);
+        }
+        bots[i]->setName("bot");
+        bots[i]->setKeyFilter(&botFilters[i]);
+        bots[i]->setInputer(&botKeys[i]);
+        bots[i]->playSequence("stand");
+        bots[i]->useCollisionSequence("stand");
+        bots[i]->setSpeed(2.0f);
+        firstStage.addFighter(bots[i], 2, 505.0f + 30 * i);
+        botAIs[i] = new AI(bots[i], p1);
+    }
+
     if (mode == Server) {
         localKeyReaderWriter = &sdlkeyrw1;
         remoteKeyReaderWriter = &sdlkeyrw2;
@@ -174,7 +338,20 @@ int main(int argc, char **argv)
         remoteKeyReaderWriter = &sdlkeyrw2;
     }
 
-    struct Ctrl_KeyEvent ctrlevent;
+    // Init input
+    InputPump inputPump(&keyconv);
+    inputPump.setWriter(localKeyReaderWriter, 1);
+    inputPump.setTrace(inputTrace, localPlayer);
+
+    // one packet per frame, carrying every local key event of that frame
+    const int MaxPacketEvents = 8;
+    struct KeyPacket {
+        Uint32 frameStamp;
+        Uint32 count;
+        struct Ctrl_KeyEvent events[MaxPacketEvents];
+    };
+    const size_t KeyPacketHeader = offsetof(struct KeyPacket, events);
+    struct KeyPacket packet;
     // trying connection
     while(mode != AIcontrol && exited==0) {
         SDL_Event event;
@@ -193,11 +370,11 @@ int main(int argc, char **argv)
             break;
         }
 
-        memset(&ctrlevent, 0, sizeof(ctrlevent));
-        if (!connection.SendPacket(&ctrlevent, sizeof(ctrlevent))) {
+        memset(&packet, 0, sizeof(packet));
+        if (!connection.SendPacket(&packet, KeyPacketHeader)) {
         }
-        memset(&ctrlevent, 0, sizeof(ctrlevent));
-        if (connection.ReceivePacket(&ctrlevent, sizeof(ctrlevent)) > 0) {
+        memset(&packet, 0, sizeof(packet));
+        if (connection.ReceivePacket(&packet, sizeof(packet)) > 0) {
             printf("recved\n");
         }
 
@@ -207,41 +384,72 @@ int main(int argc, char **argv)
 
     // main loop
     struct PendingAckNode {
-        struct Ctrl_KeyEvent event;
+        struct KeyPacket packet;
         unsigned int sequence;
     };
     struct PendingAckNode pendingAck;
     memset(&pendingAck, 0, sizeof(pendingAck));
     unsigned int localSequence = 0;
+    Uint64 logicTime = 0;
+    Uint64 runStart = nowNanoseconds();
+    Uint32 firstFrame = frame;
+    Uint32 presentedFrame = frame;
+    // the stage only repaints what changed, the rest keeps this
+    SDL_Rect dirtyRects[MAX_DIRTY_RECTS];
+    SDL_FillRect( screen, NULL, 0x00008080 );
+    SDL_Rect screenRect = {0, 0, (Uint16)screen->w, (Uint16)screen->h};
+    SurfaceBackend screenBackend(screen);
+    RenderThread renderer(&screenBackend);
+    RenderList frameList;
+    bool frameSubmitted = false;
+    Uint32 submittedFrame = 0;  // frame the submitted list shows, reported once flipped
+    if (renderThread) {
+        renderer.start();
+    }
+
+    // fixed steps at exactly FrameRate (times renderEvery in turbo). Time is
+    // counted in 1/(FrameRate * renderEvery) ns so one step is StepUnits
+    // whatever the rate, without rounding drift.
+    const Uint64 StepUnits = 1000000000ULL;
+    const Uint64 UnitsPerNanosecond = (Uint64)FrameRate * renderEvery;
+    const Uint64 SpinNanoseconds = 2000000;    // SDL_Delay oversleeps, spin the rest
+    const int MaxCatchUp = 5;                   // steps in a row before dropping time
+    Uint64 accumulator = StepUnits;
+    Uint64 lastTime = nowNanoseconds();
+    int catchUp = 0;
     while(exited==0)
     {
-        memset(&ctrlevent, 0, sizeof(ctrlevent));
+        memset(&packet, 0, sizeof(packet));
         // Net
         if ( mode == Server && connected && !connection.IsConnected() ) {
-            printf( "reset flow control\n" );
+            LOG_INFO("reset flow control");
             connected = false;
         }
 
         if (mode == Client) {
             static Uint32 serverFrame = 0;
             if (paused && serverFrame - frame > minFrameDis) {
-                printf("unpause. serverFrame: %d, localFrame: %d\n", serverFrame, frame);
+                LOG_INFO("unpause. serverFrame: %d, localFrame: %d", serverFrame, frame);
                 paused = false;
             }
 
-            if (connection.ReceivePacket(&ctrlevent, sizeof(ctrlevent)) > 0) {
-                if (ctrlevent.frameStamp > serverFrame) {
-                    serverFrame = ctrlevent.frameStamp;
+            int received = connection.ReceivePacket(&packet, sizeof(packet));
+            if (received >= (int)KeyPacketHeader && packet.count <= MaxPacketEvents) {
+                if (packet.frameStamp > serverFrame) {
+                    serverFrame = packet.frameStamp;
                 }
-                if (ctrlevent.type != Ctrl_KEYNONE && ctrlevent.frameStamp == serverFrame) {
-                    printf("recv key: %d, packetframe: %d, localframe: %d\n", ctrlevent.key, ctrlevent.frameStamp, frame);
-                    remoteKeyReaderWriter->writeEvent(&ctrlevent);
+                if (packet.frameStamp == serverFrame) {
+                    for (Uint32 i=0; i<packet.count; i++) {
+                        LOG_DEBUG("recv key: %d, packetframe: %d, localframe: %d", packet.events[i].key, packet.frameStamp, frame);
+                        packet.events[i].frameStamp = packet.frameStamp;
+                        remoteKeyReaderWriter->writeEvent(&packet.events[i]);
+                    }
                 }
             } else {
-                printf("recv error\n");
+                LOG_DEBUG("recv error");
             }
             if (serverFrame - frame < minFrameDis) {
-                printf("pause. serverFrame: %d, localFrame: %d\n", serverFrame, frame);
+                LOG_INFO("pause. serverFrame: %d, localFrame: %d", serverFrame, frame);
                 paused = true;
             }
 
@@ -251,60 +459,39 @@ int main(int argc, char **argv)
             for (int i=0; i<ack_count; i++) {
                 if (acks[i] == pendingAck.sequence) {
                     // last event acked
-                    printf("sequence %d adked\n", pendingAck.sequence);
+                    LOG_DEBUG("sequence %d adked", pendingAck.sequence);
                     pendingAck.sequence = 0;
                 }
             }
 
+            memset(&packet, 0, sizeof(packet));
             if (!paused) {
                 // if no pending ack
                 if (pendingAck.sequence == 0) {
                     //----input----
-                    SDL_Event event;
-                    if (SDL_PollEvent(&event) == 1) {
-                        localSequence = connection.GetReliabilitySystem().GetLocalSequence();
-                        ctrlevent.frameStamp = frame;
-                        ctrlevent.controler = 1;
-                        if((event.type==SDL_KEYDOWN && event.key.keysym.sym==SDLK_ESCAPE) || (event.type==SDL_QUIT)) exited=1;
-                        else if (event.type==SDL_KEYDOWN)
-                        {
-                            ctrlevent.type = Ctrl_KEYDOWN;
-                            ctrlevent.key = keyconv.convert(event.key.keysym.sym);
-                            if (ctrlevent.key != 0) {
-                                localKeyReaderWriter->writeEvent(&ctrlevent);
-                                pendingAck = {ctrlevent, localSequence};
-                            }
-                        }
-                        else if (event.type==SDL_KEYUP)
-                        {
-                            ctrlevent.type = Ctrl_KEYUP;
-                            ctrlevent.key = keyconv.convert(event.key.keysym.sym);
-                            if (ctrlevent.key != 0) {
-                                localKeyReaderWriter->writeEvent(&ctrlevent);
-                                pendingAck = {ctrlevent, localSequence};
-                            }
-                        }
-                    } else {
-                        ctrlevent.type = Ctrl_KEYNONE;
+                    localSequence = connection.GetReliabilitySystem().GetLocalSequence();
+                    packet.count = inputPump.pump(frame, packet.events, MaxPacketEvents);
+                    if (inputPump.quitRequested()) exited = 1;
+                    if (packet.count > 0) {
+                        pendingAck = {packet, localSequence};
                     }
                 } else {
                     if (connection.GetReliabilitySystem().GetLastLostPacket() == pendingAck.sequence) {
                         localSequence = connection.GetReliabilitySystem().GetLocalSequence();
-                        ctrlevent = pendingAck.event;
-                        ctrlevent.frameStamp = frame;
-                        pendingAck = {ctrlevent, localSequence};
+                        packet = pendingAck.packet;
+                        pendingAck.sequence = localSequence;
                     }
                 }
             }
 
-            ctrlevent.frameStamp = frame;
-            if (!connection.SendPacket(&ctrlevent, sizeof(ctrlevent))) {
-                printf("send error\n");
+            packet.frameStamp = frame;
+            if (!connection.SendPacket(&packet, KeyPacketHeader + packet.count * sizeof(struct Ctrl_KeyEvent))) {
+                LOG_WARN("send error");
             }
         } else if (mode == Server) {
             static Uint32 clientFrame = 0;
             if (paused && frame - clientFrame < maxFrameDis) {
-                printf("unpause. clientFrame: %d, localFrame: %d\n", clientFrame, frame);
+                LOG_INFO("unpause. clientFrame: %d, localFrame: %d", clientFrame, frame);
                 paused = false;
             }
 
@@ -312,62 +499,44 @@ int main(int argc, char **argv)
                 // if no pending ack
                 if (pendingAck.sequence == 0) {
                     //----input----
-                    SDL_Event event;
-                    if (SDL_PollEvent(&event) == 1) {
-                        localSequence = connection.GetReliabilitySystem().GetLocalSequence();
-                        ctrlevent.frameStamp = frame;
-                        ctrlevent.controler = 1;
-                        if((event.type==SDL_KEYDOWN && event.key.keysym.sym==SDLK_ESCAPE) || (event.type==SDL_QUIT)) exited=1;
-                        else if (event.type==SDL_KEYDOWN)
-                        {
-                            ctrlevent.type = Ctrl_KEYDOWN;
-                            ctrlevent.key = keyconv.convert(event.key.keysym.sym);
-                            if (ctrlevent.key != 0) {
-                                localKeyReaderWriter->writeEvent(&ctrlevent);
-                                pendingAck = {ctrlevent, localSequence};
-                            }
-                        }
-                        else if (event.type==SDL_KEYUP)
-                        {
-                            ctrlevent.type = Ctrl_KEYUP;
-                            ctrlevent.key = keyconv.convert(event.key.keysym.sym);
-                            if (ctrlevent.key != 0) {
-                                localKeyReaderWriter->writeEvent(&ctrlevent);
-                                pendingAck = {ctrlevent, localSequence};
-                            }
-                        }
-                    } else {
-                        ctrlevent.type = Ctrl_KEYNONE;
+                    localSequence = connection.GetReliabilitySystem().GetLocalSequence();
+                    packet.count = inputPump.pump(frame, packet.events, MaxPacketEvents);
+                    if (inputPump.quitRequested()) exited = 1;
+                    if (packet.count > 0) {
+                        pendingAck = {packet, localSequence};
                     }
                 } else {
                     if (connection.GetReliabilitySystem().GetLastLostPacket() == pendingAck.sequence) {
                         localSequence = connection.GetReliabilitySystem().GetLocalSequence();
-                        ctrlevent = pendingAck.event;
-                        ctrlevent.frameStamp = frame;
-                        pendingAck = {ctrlevent, localSequence};
+                        packet = pendingAck.packet;
+                        pendingAck.sequence = localSequence;
                     }
                 }
             }
 
-            ctrlevent.frameStamp = frame;
-            if (!connection.SendPacket(&ctrlevent, sizeof(ctrlevent))) {
-                printf("send error\n");
+            packet.frameStamp = frame;
+            if (!connection.SendPacket(&packet, KeyPacketHeader + packet.count * sizeof(struct Ctrl_KeyEvent))) {
+                LOG_WARN("send error");
             }
             
-            if (connection.ReceivePacket(&ctrlevent, sizeof(ctrlevent)) > 0) {
-                if (ctrlevent.frameStamp > clientFrame) {
-                    clientFrame = ctrlevent.frameStamp;
+            memset(&packet, 0, sizeof(packet));
+            int received = connection.ReceivePacket(&packet, sizeof(packet));
+            if (received >= (int)KeyPacketHeader && packet.count <= MaxPacketEvents) {
+                if (packet.frameStamp > clientFrame) {
+                    clientFrame = packet.frameStamp;
                 }
-                if (ctrlevent.type != Ctrl_KEYNONE && ctrlevent.frameStamp == clientFrame) {
-                    printf("recv key: %d, packetframe: %d, localframe: %d\n", ctrlevent.key, ctrlevent.frameStamp, frame);
-                    ctrlevent.frameStamp = frame;
-                    remoteKeyReaderWriter->writeEvent(&ctrlevent);
+                if (packet.frameStamp == clientFrame) {
+                    for (Uint32 i=0; i<packet.count; i++) {
+                        LOG_DEBUG("recv key: %d, packetframe: %d, localframe: %d", packet.events[i].key, packet.frameStamp, frame);
+                        packet.events[i].frameStamp = frame;
+                        remoteKeyReaderWriter->writeEvent(&packet.events[i]);
+                    }
                 }
             } else {
-                printf("recv error\n");
+                LOG_DEBUG("recv error");
             }
             if (frame - clientFrame > maxFrameDis) {
-                printf("pause. clientFrame: %d, localFrame: %d\n", clientFrame, frame);
+                LOG_INFO("pause. clientFrame: %d, localFrame: %d", clientFrame, frame);
                 paused = true;
             }
 
@@ -377,53 +546,60 @@ int main(int argc, char **argv)
             for (int i=0; i<ack_count; i++) {
                 if (acks[i] == pendingAck.sequence) {
                     // last event acked
-                    printf("sequence %d adked\n", pendingAck.sequence);
+                    LOG_DEBUG("sequence %d adked", pendingAck.sequence);
                     pendingAck.sequence = 0;
                 }
             }
         } else if (mode == AIcontrol) {
             //----input----
-            SDL_Event event;
-            if (SDL_PollEvent(&event) == 1) {
-                ctrlevent.frameStamp = frame;
-                ctrlevent.controler = 1;
-                if((event.type==SDL_KEYDOWN && event.key.keysym.sym==SDLK_ESCAPE) || (event.type==SDL_QUIT)) exited=1;
-                else if (event.type==SDL_KEYDOWN)
-                {
-                    ctrlevent.type = Ctrl_KEYDOWN;
-                    ctrlevent.key = keyconv.convert(event.key.keysym.sym);
-                    if (ctrlevent.key != 0) {
-                        localKeyReaderWriter->writeEvent(&ctrlevent);
-                    }
-                }
-                else if (event.type==SDL_KEYUP)
-                {
-                    ctrlevent.type = Ctrl_KEYUP;
-                    ctrlevent.key = keyconv.convert(event.key.keysym.sym);
-                    if (ctrlevent.key != 0) {
-                        localKeyReaderWriter->writeEvent(&ctrlevent);
-                    }
-                }
-            } else {
-                ctrlevent.type = Ctrl_KEYNONE;
-            }
+            inputPump.pump(frame, packet.events, MaxPacketEvents);
+            if (inputPump.quitRequested()) exited = 1;
 
-            if (ai2.pollEvent(&ctrlevent)) {
+            struct Ctrl_KeyEvent ctrlevent;
+            memset(&ctrlevent, 0, sizeof(ctrlevent));
+            if (playFilename == NULL && ai2.pollEvent(&ctrlevent)) {
                 ctrlevent.frameStamp = frame;
                 ctrlevent.controler = 2;
                 remoteKeyReaderWriter->writeEvent(&ctrlevent);
             }
+            for (int i=0; i<numBots; i++) {
+                memset(&ctrlevent, 0, sizeof(ctrlevent));
+                if (playFilename == NULL && botAIs[i]->pollEvent(&ctrlevent)) {
+                    ctrlevent.frameStamp = frame;
+                    ctrlevent.controler = 3 + i;
+                    botKeys[i].writeEvent(&ctrlevent);
+                }
+            }
         }
 
         if (!paused) {
             // ----logic----
+            Character::State p1state = p1->getState();
+            Character::State p2state = p2->getState();
+            Uint64 logicStart = nowNanoseconds();
             firstStage.update(frame);
+            logicTime += nowNanoseconds() - logicStart;
+            if (inputTrace != NULL) {
+                if (p1->getState() != p1state) {
+                    inputTrace->stateChanged(1, frame);
+                }
+                if (p2->getState() != p2state) {
+                    inputTrace->stateChanged(2, frame);
+                }
+                inputTrace->endFrame(frame);
+            }
             // AI
-            if (mode == AIcontrol) {
+            if (mode == AIcontrol && playFilename == NULL) {
                 ai2.update(frame);
+                for (int i=0; i<numBots; i++) {
+                    botAIs[i]->update(frame);
+                }
             }
             // ----frame control----
             frame++;
+            if (playFilename != NULL && frame >= playback.numFrames) {
+                exited = 1;
+            }
         } else {
             waiting_timer --;
             if (waiting_timer == 0) {
@@ -433,22 +609,131 @@ int main(int argc, char **argv)
 
         connection.Update(DeltaTime);
 
+        // behind the clock: simulate again before presenting, up to a point
+        accumulator -= StepUnits;
+        if (!uncapped && accumulator >= StepUnits) {
+            if (++catchUp < MaxCatchUp) {
+                continue;
+            }
+            accumulator %= StepUnits;
+        }
+        catchUp = 0;
+
         // ----draw----
-        SDL_FillRect( screen, NULL, 0x00008080 );
-        //SDL_FillRect( screen, &rect, color );
-        firstStage.draw(screen);
+        // turbo presents every renderEvery simulated frames
+        if (paused || frame - presentedFrame >= (Uint32)renderEvery) {
+            presentedFrame = frame;
+            // presents follow steps here, the last step is what to show
+            firstStage.setDrawAlpha(1.0f);
+            if (renderThread) {
+                // the last list is drawn by now, show it and hand over this frame
+                renderer.wait();
+                if (frameSubmitted) {
+                    SDL_Flip(screen);
+                    if (inputTrace != NULL && submittedFrame > 0) {
+                        inputTrace->framePresented(submittedFrame - 1);
+                    }
+                }
+                frameList.clear();
+                frameList.setLevel(-1);
+                frameList.fill(screenRect, 0, 128, 128);
+                firstStage.render(&frameList);
+                frameList.sort();
+                renderer.submit(&frameList);
+                frameSubmitted = true;
+                submittedFrame = frame;
+            } else if (fullRedraw) {
+                SDL_FillRect( screen, NULL, 0x00008080 );
+                //SDL_FillRect( screen, &rect, color );
+                firstStage.draw(screen);
+                SDL_Flip(screen);
+            } else {
+                int numDirty = firstStage.drawDirty(screen, dirtyRects, MAX_DIRTY_RECTS);
+                SDL_UpdateRects(screen, numDirty, dirtyRects);
+            }
+            if (inputTrace != NULL && frame > 0 && !renderThread) {
+                // shows the state after the last simulated frame
+                inputTrace->framePresented(frame - 1);
+            }
+        }
+
+        // wait for the next step: sleep coarsely, spin on the precise clock
+        if (uncapped) {
+            accumulator = StepUnits;
+            continue;
+        }
+        for (;;) {
+            Uint64 now = nowNanoseconds();
+            accumulator += (now - lastTime) * UnitsPerNanosecond;
+            lastTime = now;
+            if (accumulator >= StepUnits) {
+                break;
+            }
+            Uint64 left = (StepUnits - accumulator) / UnitsPerNanosecond;
+            if (left > SpinNanoseconds) {
+                SDL_Delay((left - SpinNanoseconds) / 1000000);
+            }
+        }
+    }
+
+    // show the list still in flight
+    if (frameSubmitted) {
+        renderer.wait();
         SDL_Flip(screen);
+        if (inputTrace != NULL && submittedFrame > 0) {
+            inputTrace->framePresented(submittedFrame - 1);
+        }
+    }
+    renderer.stop();
+
+    // the last frame, drawn offscreen
+    if (snapshotFilename != NULL) {
+        MemoryBackend snapshot(screen->w, screen->h);
+        snapshot.clear(0x008080);
+        RenderList list;
+        firstStage.render(&list);
+        char label[MAX_RENDER_TEXT];
+        snprintf(label, sizeof(label), "FRAME %u", frame);
+        // the stage leaves its top level set, go above it
+        list.setLevel(list.getLevel() + 1);
+        list.text(4, screen->h - FONT_HEIGHT - 4, label, 255, 255, 255);
+        list.sort();
+        snapshot.execute(list, NULL);
+        snapshot.save(snapshotFilename);
+    }
 
+    if (renderEvery > 1 || uncapped) {
+        Uint32 frames = frame - firstFrame;
+        double seconds = (double)(nowNanoseconds() - runStart) / 1e9;
+        printf("%u frames in %.2f s, %.0f frames/s, logic %.1f us per frame\n", frames, seconds,
+                seconds > 0 ? frames / seconds : 0, frames > 0 ? (double)logicTime / frames / 1000 : 0);
+    }
 
-        newtime = SDL_GetTicks();
-        if (newtime - oldtime < interval) {
-            SDL_Delay(interval - newtime + oldtime);
+    if (recordFilename != NULL) {
+        replayWriter.end(frame);
+        replayFile.close();
+    }
+    if (inputTrace != NULL) {
+        inputTrace->finish();
+        if (latencyMode) {
+            inputTrace->getStats()->print(stdout);
+        }
+        delete inputTrace;
+        if (traceFilename != NULL) {
+            traceFile.close();
         }
-        oldtime = SDL_GetTicks();
+    }
+    if (logFilename != NULL) {
+        Logger::close();
+        logFile.close();
     }
 
     SpriteFactory::freeSprite(p1);
     SpriteFactory::freeSprite(p2);
+    for (int i=0; i<numBots; i++) {
+        delete botAIs[i];
+        SpriteFactory::freeSprite(bots[i]);
+    }
 
     SDL_Quit();
     return 0;
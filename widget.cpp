@@ -14,6 +14,15 @@ Widget::Widget() :
     position = {0, 0, 0, 0};
 }
 
+void Widget::draw(SDL_Surface *dst)
+{
+    RenderList list;
+    render(&list);
+    list.sort();
+    SurfaceBackend backend(dst);
+    backend.execute(list, NULL);
+}
+
 void Widget::setLevel(Sint16 val)
 {
     if (level == val) {
@@ -2,6 +2,7 @@
 #define _WIDGET_H_
 
 #include <SDL/SDL.h>
+#include "render.h"
 
 namespace dragonfighting {
 
@@ -10,7 +11,9 @@ class Widget
     public:
         Widget();
         virtual ~Widget() {};
-        virtual void draw(SDL_Surface *dst) = 0;
+        // render into a list and execute it on dst right away
+        virtual void draw(SDL_Surface *dst);
+        virtual void render(RenderList *list) = 0;
         virtual void update(Uint32 frameStamp) = 0;
 
         virtual void setPosition(int x, int y);